@@ -1,4 +1,5 @@
 using System;
+using System.Buffers;
 using System.Collections.Generic;
 using System.Diagnostics;
 using System.Runtime.InteropServices;
@@ -31,11 +32,12 @@ namespace SharedManagedUtils
             initialized_.Set();
         }
 
-        [DllImport("TMHost64.exe", EntryPoint = "MessageFromModuleToHost", CharSet = CharSet.Unicode)]
-        static extern int MessageFromModuleToHost64(string msg, string service, int session);
+        // The msg as UTF-8 bytes, not zero-terminated, and the service as a binary GUID.
+        [DllImport("TMHost64.exe", EntryPoint = "MessageFromModuleToHost")]
+        static extern int MessageFromModuleToHost64(byte[] msg, int size, ref Guid service, int session);
 
-        [DllImport("TMHost32.exe", EntryPoint = "MessageFromModuleToHost", CharSet = CharSet.Unicode)]
-        static extern int MessageFromModuleToHost32(string msg, string service, int session);
+        [DllImport("TMHost32.exe", EntryPoint = "MessageFromModuleToHost")]
+        static extern int MessageFromModuleToHost32(byte[] msg, int size, ref Guid service, int session);
 
         public static int SendMessage(string msg, string service, int session = -1)
         {
@@ -45,10 +47,20 @@ namespace SharedManagedUtils
                 if (!image.Equals("TMHost32.exe", StringComparison.OrdinalIgnoreCase) && !image.Equals("TMHost64.exe", StringComparison.OrdinalIgnoreCase))
                     return 0;
 
-                if (IntPtr.Size == 4)
-                    return MessageFromModuleToHost32(msg, service, session);
-                else
-                    return MessageFromModuleToHost64(msg, service, session);
+                var serviceId = Guid.Parse(service);
+                var bytes = ArrayPool<byte>.Shared.Rent(Encoding.UTF8.GetMaxByteCount(msg.Length));
+                try
+                {
+                    int size = Encoding.UTF8.GetBytes(msg, 0, msg.Length, bytes, 0);
+                    if (IntPtr.Size == 4)
+                        return MessageFromModuleToHost32(bytes, size, ref serviceId, session);
+                    else
+                        return MessageFromModuleToHost64(bytes, size, ref serviceId, session);
+                }
+                finally
+                {
+                    ArrayPool<byte>.Shared.Return(bytes);
+                }
             }
             catch
             {
@@ -58,7 +70,7 @@ namespace SharedManagedUtils
         }
 
         [UnmanagedCallersOnly]
-        public static int MessageFromHostToModule(IntPtr msg, IntPtr service, int session)
+        public static int MessageFromHostToModule(IntPtr msg, int size, IntPtr service, int session)
         {
             try
             {
@@ -70,13 +82,9 @@ namespace SharedManagedUtils
                 //}
                 //Debugger.Break();
 
-                string m = RuntimeInformation.IsOSPlatform(OSPlatform.Windows)
-                    ? Marshal.PtrToStringUni(msg)
-                    : Marshal.PtrToStringUTF8(msg);
-
-                string s = RuntimeInformation.IsOSPlatform(OSPlatform.Windows)
-                    ? Marshal.PtrToStringUni(service)
-                    : Marshal.PtrToStringUTF8(service);
+                // UTF-8 bytes and a binary GUID, formatted like the service constants above.
+                string m = Marshal.PtrToStringUTF8(msg, size);
+                string s = Marshal.PtrToStructure<Guid>(service).ToString("B").ToUpperInvariant();
 
                 if (s == ManagedHost)
                 {
@@ -0,0 +1,143 @@
+#include "pch.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <lz4.h>
+#include "Compression.h"
+#include "ipc.h"
+
+namespace ipc
+{
+namespace
+{
+// Buffers grown beyond this by a large msg are released once a smaller one comes along.
+const size_t MaxRetained = 1024 * 1024;
+
+// Not worth compressing unless it saves at least 1 / SavingsDivisor of the msg.
+const size_t SavingsDivisor = 16;
+
+// Reused by all msgs of a thread, so that compressing or decompressing doesn't allocate per frame.
+class Buffer final
+{
+public:
+    // nullptr if out of memory.
+    char* Reserve(size_t size) noexcept
+    {
+        if (size > size_ || (size_ > MaxRetained && size <= MaxRetained))
+        {
+            data_.reset(new (std::nothrow) char[size]);
+            size_ = data_ ? size : 0;
+        }
+        return data_.get();
+    }
+
+private:
+    std::unique_ptr<char[]> data_;
+    size_t                  size_ = 0;
+};
+
+thread_local Buffer t_compressed;
+thread_local Buffer t_decompressed;
+
+std::atomic<size_t> compressAbove {DefaultCompressAbove};
+
+struct Counters
+{
+    std::atomic<uint64_t> Compressed;
+    std::atomic<uint64_t> Incompressible;
+    std::atomic<uint64_t> RawBytes;
+    std::atomic<uint64_t> CompressedBytes;
+    std::atomic<uint64_t> CompressMicros;
+    std::atomic<uint64_t> Decompressed;
+    std::atomic<uint64_t> DecompressMicros;
+} counters;
+
+void Add(std::atomic<uint64_t>& counter, uint64_t value) noexcept
+{
+    counter.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t MicrosSince(std::chrono::steady_clock::time_point start) noexcept
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+}
+
+void SetCompressAbove(size_t size) noexcept
+{
+    compressAbove.store(size, std::memory_order_relaxed);
+}
+
+size_t GetCompressAbove() noexcept
+{
+    return compressAbove.load(std::memory_order_relaxed);
+}
+
+CompressionStats GetCompressionStats() noexcept
+{
+    CompressionStats stats;
+    stats.Compressed       = counters.Compressed.load(std::memory_order_relaxed);
+    stats.Incompressible   = counters.Incompressible.load(std::memory_order_relaxed);
+    stats.RawBytes         = counters.RawBytes.load(std::memory_order_relaxed);
+    stats.CompressedBytes  = counters.CompressedBytes.load(std::memory_order_relaxed);
+    stats.CompressMicros   = counters.CompressMicros.load(std::memory_order_relaxed);
+    stats.Decompressed     = counters.Decompressed.load(std::memory_order_relaxed);
+    stats.DecompressMicros = counters.DecompressMicros.load(std::memory_order_relaxed);
+    return stats;
+}
+
+WirePayload::WirePayload(const std::string_view msg, uint8_t version) noexcept : bytes_(msg)
+{
+    const size_t above = GetCompressAbove();
+    if (version < FrameVersion::V2 || !above || msg.size() < above || msg.size() > LZ4_MAX_INPUT_SIZE)
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // LZ4 gives up as soon as the output doesn't fit, so an incompressible msg costs little.
+    const size_t capacity = msg.size() - msg.size() / SavingsDivisor;
+    char*        out      = t_compressed.Reserve(capacity);
+    const int    size     = out ? LZ4_compress_default(msg.data(), out, (int)msg.size(), (int)capacity) : 0;
+
+    Add(counters.CompressMicros, MicrosSince(start));
+    if (size <= 0)
+    {
+        Add(counters.Incompressible, 1);
+        return;
+    }
+
+    Add(counters.Compressed, 1);
+    Add(counters.RawBytes, msg.size());
+    Add(counters.CompressedBytes, (uint64_t)size);
+
+    bytes_   = std::string_view(out, (size_t)size);
+    rawSize_ = (DWORD)msg.size();
+}
+
+bool Decompress(const std::string_view compressed, DWORD rawSize, std::string_view& msg) noexcept
+{
+    // A block expands at most 255 times, reject sizes no valid one has before allocating for them.
+    if (!rawSize || rawSize > LZ4_MAX_INPUT_SIZE || rawSize > compressed.size() * 255)
+        return false;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    char* out = t_decompressed.Reserve((size_t)rawSize + 1);
+    if (!out)
+        return false;
+
+    const int size = LZ4_decompress_safe(compressed.data(), out, (int)compressed.size(), (int)rawSize);
+    if (size != (int)rawSize)
+        return false;
+
+    // Zero-terminated like any msg handed out by a reader.
+    out[rawSize] = 0;
+    msg          = std::string_view(out, rawSize);
+
+    Add(counters.Decompressed, 1);
+    Add(counters.DecompressMicros, MicrosSince(start));
+    return true;
+}
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "platform.h"
+#include <cstdint>
+#include <string_view>
+
+namespace ipc
+{
+// Msgs of at least the size set by SetCompressAbove() are LZ4 compressed when framed with FrameVersion::V2 or later.
+// Off by default: between processes of the same machine copying bytes is cheaper than decompressing them, it pays
+// off where bytes are scarce, e.g. a shared memory ring or queues holding large broadcasts.
+const size_t DefaultCompressAbove = 0;
+
+// Process wide, 0 disables compression. The broker tells its hosts with HostInitMsg::CompressAbove.
+void   SetCompressAbove(size_t size) noexcept;
+size_t GetCompressAbove() noexcept;
+
+// Process wide counters of what was compressed and decompressed, and how long it took.
+struct CompressionStats
+{
+    uint64_t Compressed       = 0;
+    // Large enough but not getting smaller, sent as is.
+    uint64_t Incompressible   = 0;
+    uint64_t RawBytes         = 0;
+    uint64_t CompressedBytes  = 0;
+    uint64_t CompressMicros   = 0;
+    uint64_t Decompressed     = 0;
+    uint64_t DecompressMicros = 0;
+};
+CompressionStats GetCompressionStats() noexcept;
+
+// The msg bytes of a frame, compressed if the frame version supports it, the msg is large enough and it pays off.
+// A compressed payload is a view into a buffer of the calling thread, valid until it creates the next WirePayload.
+class WirePayload final
+{
+public:
+    WirePayload(const std::string_view msg, uint8_t version) noexcept;
+
+    std::string_view Bytes() const
+    {
+        return bytes_;
+    }
+    // Size of the msg, 0 if Bytes() is the msg itself.
+    DWORD RawSize() const
+    {
+        return rawSize_;
+    }
+
+private:
+    std::string_view bytes_;
+    DWORD            rawSize_ = 0;
+};
+
+// Decompresses a frame's payload into a buffer of the calling thread, valid until its next call.
+// Fails if the payload is corrupt or doesn't decompress to rawSize bytes.
+bool Decompress(const std::string_view compressed, DWORD rawSize, std::string_view& msg) noexcept;
+}
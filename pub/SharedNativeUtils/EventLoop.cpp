@@ -0,0 +1,738 @@
+#include "pch.h"
+#include <algorithm>
+#include "EventLoop.h"
+#include "FrameReader.h"
+#include "Transport.h"
+#ifdef _WIN32
+#    include <format>
+#    include "TMProcess.h"
+#else
+#    include <poll.h>
+#    include <pthread.h>
+#    include <unistd.h>
+#    include <sys/epoll.h>
+#    include <sys/eventfd.h>
+#    include "Uring.h"
+#endif
+
+namespace ipc
+{
+struct EventLoop::Op
+{
+#ifdef _WIN32
+    // First, completions hand out a pointer to it.
+    OVERLAPPED Overlapped {};
+    PTP_WAIT   Wait = nullptr;
+    // Set once the exit was handed over to the port.
+    std::atomic<bool> Posted {false};
+#else
+    bool Added = false;
+    // Hands the op over from the thread arming it to the one polling it, epoll itself isn't seen as a fence.
+    std::atomic<bool> Armed {false};
+#endif
+    EventLoop* Loop   = nullptr;
+    // Read done but not issued again until the stream resumes, guarded by lock_.
+    bool       Parked = false;
+
+    // Read
+    Handle                  In = InvalidHandle;
+    std::shared_ptr<Stream> Source;
+
+    // WatchExit
+    Handle                Process = InvalidHandle;
+    std::function<void()> OnExit;
+
+    // WriteAll, the callback is shared by all outs.
+    Handle                           Out = InvalidHandle;
+    Frame                            Data;
+    size_t                           Written = 0;
+    std::shared_ptr<const OnWritten> OnDone;
+
+    ~Op()
+    {
+#ifdef _WIN32
+        if (Wait)
+            ::CloseThreadpoolWait(Wait);
+        if (Process != InvalidHandle)
+            ::CloseHandle(Process);
+#else
+        if (Process != InvalidHandle)
+            ::close(Process);
+#endif
+    }
+};
+
+namespace
+{
+#ifdef _WIN32
+const ULONG_PTR ReadKey = 0;
+const ULONG_PTR ExitKey = 1;
+const ULONG_PTR QuitKey = 2;
+
+void SetLoopThreadName(size_t n)
+{
+    Process::SetThreadName(std::format(L"TM-EventLoop-{}", n).c_str());
+}
+#else
+// Submission entries, the completion queue gets twice as many. Should it overflow anyway the kernel keeps them until
+// there's room.
+const unsigned RingEntries = 1024;
+
+// user_data of completions which aren't of an Op.
+const uint64_t QuitTag   = 0;
+const uint64_t CancelTag = ~0ull;
+
+void SetLoopThreadName(size_t n)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "TM-Loop-%zu", n);
+    (void)::pthread_setname_np(::pthread_self(), name);
+}
+#endif
+}
+
+EventLoop::EventLoop(bool uring) : preferUring_(uring)
+{
+}
+
+EventLoop::~EventLoop()
+{
+    Stop();
+
+#ifdef _WIN32
+    if (port_ != InvalidHandle)
+        ::CloseHandle(port_);
+#else
+    for (Handle handle : {epoll_, wake_})
+    {
+        if (handle != InvalidHandle)
+            ::close(handle);
+    }
+#endif
+}
+
+bool EventLoop::UsesUring() const noexcept
+{
+#ifdef _WIN32
+    return false;
+#else
+    return ring_ != nullptr;
+#endif
+}
+
+size_t EventLoop::DefaultThreads() noexcept
+{
+    return std::clamp<size_t>(std::thread::hardware_concurrency() / 4, 1, 4);
+}
+
+HRESULT EventLoop::Start(size_t threads) noexcept
+try
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, !threads_.empty());
+
+    if (!threads)
+        threads = DefaultThreads();
+
+#ifdef _WIN32
+    port_ = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, (DWORD)threads);
+    RETURN_LAST_ERROR_IF_NULL(port_);
+#else
+    if (preferUring_)
+    {
+        // Falls back to epoll, e.g. if io_uring is disabled for containers.
+        auto ring = std::make_unique<Uring>();
+        if (SUCCEEDED(ring->Init(RingEntries)))
+            ring_ = std::move(ring);
+    }
+
+    if (!ring_)
+    {
+        epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+        RETURN_LAST_ERROR_IF(epoll_ < 0);
+        wake_ = ::eventfd(0, EFD_CLOEXEC);
+        RETURN_LAST_ERROR_IF(wake_ < 0);
+
+        // Level triggered and never reset, so once signaled every thread sees it.
+        epoll_event event {};
+        event.events   = EPOLLIN;
+        event.data.ptr = nullptr;
+        RETURN_LAST_ERROR_IF(::epoll_ctl(epoll_, EPOLL_CTL_ADD, wake_, &event) != 0);
+    }
+#endif
+
+    for (size_t n = 0; n < threads; ++n)
+    {
+        threads_.emplace_back([this, n] {
+            SetLoopThreadName(n);
+            Run();
+        });
+    }
+    return S_OK;
+}
+CATCH_RETURN();
+
+void EventLoop::Stop() noexcept
+{
+    if (threads_.empty())
+        return;
+
+    std::vector<Op*> abandoned;
+    {
+        std::unique_lock lock(lock_);
+        stopping_ = true;
+
+#ifdef _WIN32
+        for (Op* op : ops_)
+        {
+            if (op->Parked)
+            {
+                // No read in flight.
+                op->Parked = false;
+                abandoned.push_back(op);
+            }
+            else if (op->Wait)
+            {
+                // Either the exit was handed over to the port already, or it never will be.
+                ::SetThreadpoolWait(op->Wait, nullptr, nullptr);
+                ::WaitForThreadpoolWaitCallbacks(op->Wait, TRUE);
+                if (!op->Posted)
+                    abandoned.push_back(op);
+            }
+            else
+            {
+                // Completes with ERROR_OPERATION_ABORTED, which releases the op.
+                ::CancelIoEx(op->In, &op->Overlapped);
+            }
+        }
+#else
+        if (ring_)
+        {
+            // Writes waiting for the one issued before them are never issued.
+            for (auto& [out, chain] : writes_)
+            {
+                if (chain.size() > 1)
+                {
+                    abandoned.insert(abandoned.end(), chain.begin() + 1, chain.end());
+                    chain.resize(1);
+                }
+            }
+            std::unordered_set<Op*> issued = ops_;
+            for (Op* op : abandoned)
+            {
+                issued.erase(op);
+            }
+
+            // Completes with -ECANCELED, which releases the op. Cancelling one which is done already just fails.
+            for (Op* op : issued)
+            {
+                if (op->Parked)
+                    continue;
+                if (auto sqe = ring_->Prepare())
+                {
+                    sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+                    sqe->addr      = (uintptr_t)op;
+                    sqe->user_data = CancelTag;
+                }
+            }
+            (void)ring_->Submit();
+        }
+
+        // Nothing to cancel, resuming them does nothing from now on.
+        for (Op* op : ops_)
+        {
+            if (op->Parked)
+            {
+                op->Parked = false;
+                abandoned.push_back(op);
+            }
+        }
+#endif
+    }
+
+    for (Op* op : abandoned)
+    {
+        Release(op);
+    }
+    abandoned.clear();
+
+#ifdef _WIN32
+    {
+        // A stopping loop doesn't issue any further read, so pending ones are all it waits for.
+        std::unique_lock lock(lock_);
+        released_.wait(lock, [&] { return ops_.empty() && !releasing_; });
+    }
+
+    for (size_t n = 0; n < threads_.size(); ++n)
+    {
+        ::PostQueuedCompletionStatus(port_, 0, QuitKey, nullptr);
+    }
+#else
+    if (ring_)
+    {
+        // Same as for Windows above.
+        std::unique_lock lock(lock_);
+        released_.wait(lock, [&] { return ops_.empty() && !releasing_; });
+
+        for (size_t n = 0; n < threads_.size(); ++n)
+        {
+            if (auto sqe = ring_->Prepare())
+                sqe->user_data = QuitTag;
+        }
+        (void)ring_->Submit();
+    }
+    else
+    {
+        const uint64_t one = 1;
+        (void)::write(wake_, &one, sizeof(one));
+    }
+#endif
+
+    for (auto& thread : threads_)
+    {
+        thread.join();
+    }
+    threads_.clear();
+
+#ifndef _WIN32
+    // Nothing is polled anymore.
+    {
+        std::scoped_lock lock(lock_);
+        abandoned.assign(ops_.begin(), ops_.end());
+    }
+    for (Op* op : abandoned)
+    {
+        Release(op);
+    }
+#endif
+}
+
+HRESULT EventLoop::Read(Handle in, std::shared_ptr<Stream> stream) noexcept
+try
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, threads_.empty());
+
+#ifdef _WIN32
+    RETURN_LAST_ERROR_IF_NULL(::CreateIoCompletionPort(in, port_, ReadKey, 0));
+#endif
+
+    auto op    = std::make_unique<Op>();
+    op->Loop   = this;
+    op->In     = in;
+    op->Source = std::move(stream);
+    {
+        std::scoped_lock lock(lock_);
+        RETURN_HR_IF(E_NOT_VALID_STATE, stopping_);
+        ops_.insert(op.get());
+        op->Source->loop_ = this;
+        op->Source->op_   = op.get();
+    }
+
+    // Once issued the op is owned by the loop.
+    (void)Issue(op.release(), true);
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT EventLoop::WatchExit(Handle process, std::function<void()> onExit) noexcept
+try
+{
+    // Closes process if anything fails before the loop owns the op.
+    auto op     = std::make_unique<Op>();
+    op->Loop    = this;
+    op->Process = process;
+    op->OnExit  = std::move(onExit);
+
+    std::scoped_lock lock(lock_);
+    RETURN_HR_IF(E_NOT_VALID_STATE, threads_.empty() || stopping_);
+
+#ifdef _WIN32
+    op->Wait = ::CreateThreadpoolWait(
+        [](PTP_CALLBACK_INSTANCE, void* context, PTP_WAIT, TP_WAIT_RESULT) {
+            auto op = static_cast<Op*>(context);
+            // Run the handler on a loop thread rather than on a thread pool one.
+            op->Posted = true;
+            ::PostQueuedCompletionStatus(op->Loop->port_, 0, ExitKey, &op->Overlapped);
+        },
+        op.get(), nullptr);
+    RETURN_LAST_ERROR_IF_NULL(op->Wait);
+    ops_.insert(op.get());
+    ::SetThreadpoolWait(op->Wait, process, nullptr);
+#else
+    if (ring_)
+    {
+        auto sqe = ring_->Prepare();
+        RETURN_HR_IF_NULL(E_OUTOFMEMORY, sqe);
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = process;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data     = (uintptr_t)op.get();
+        ops_.insert(op.get());
+        (void)ring_->Submit();
+    }
+    else
+    {
+        epoll_event event {};
+        event.events   = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = op.get();
+        op->Added      = true;
+        op->Armed.store(true, std::memory_order_release);
+        RETURN_LAST_ERROR_IF(::epoll_ctl(epoll_, EPOLL_CTL_ADD, process, &event) != 0);
+        ops_.insert(op.get());
+    }
+#endif
+
+    (void)op.release();
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT EventLoop::WriteAll(std::span<const Handle> outs, const Frame& frame, OnWritten onWritten) noexcept
+try
+{
+#ifdef _WIN32
+    return E_NOTIMPL;
+#else
+    RETURN_HR_IF(E_NOTIMPL, !ring_);
+
+    auto                             onDone = std::make_shared<const OnWritten>(std::move(onWritten));
+    std::vector<std::unique_ptr<Op>> ops;
+    ops.reserve(outs.size());
+    for (Handle out : outs)
+    {
+        auto op    = std::make_unique<Op>();
+        op->Loop   = this;
+        op->Out    = out;
+        op->Data   = frame;
+        op->OnDone = onDone;
+        ops.push_back(std::move(op));
+    }
+
+    std::scoped_lock lock(lock_);
+    RETURN_HR_IF(E_NOT_VALID_STATE, threads_.empty() || stopping_);
+
+    for (auto& op : ops)
+    {
+        // Otherwise issued once the write before it is done.
+        auto& chain = writes_[op->Out];
+        if (chain.empty() && !PrepareWrite(op.get()))
+        {
+            (void)ring_->Submit();
+            RETURN_HR(E_OUTOFMEMORY);
+        }
+
+        chain.push_back(op.get());
+        ops_.insert(op.release());
+    }
+
+    RETURN_IF_FAILED(ring_->Submit());
+    return S_OK;
+#endif
+}
+CATCH_RETURN();
+
+bool EventLoop::Issue(Op* op, bool submit) noexcept
+{
+    std::unique_lock lock(lock_);
+    return Issue(op, submit, lock);
+}
+
+bool EventLoop::Issue(Op* op, bool submit, std::unique_lock<std::mutex>& lock) noexcept
+{
+    if (stopping_)
+    {
+        lock.unlock();
+        Release(op);
+        return false;
+    }
+
+#ifdef _WIN32
+    // Even if the read completes right away, the completion is queued to the port.
+    op->Overlapped = {};
+    if (::ReadFile(op->In, op->Source->Buffer(), (DWORD)op->Source->BufferSize(), nullptr, &op->Overlapped) ||
+        ::GetLastError() == ERROR_IO_PENDING)
+        return true;
+#else
+    if (ring_)
+    {
+        // Once prepared it's submitted eventually, even if submitting fails right now.
+        if (PrepareRead(op))
+        {
+            if (submit)
+                (void)ring_->Submit();
+            return true;
+        }
+    }
+    else
+    {
+        // One shot, so a stream is never read by two threads at once.
+        epoll_event event {};
+        event.events   = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = op;
+        // Nothing is touched past arming, another thread may own the op right away.
+        const int ctl = op->Added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        op->Added     = true;
+        op->Armed.store(true, std::memory_order_release);
+        if (::epoll_ctl(epoll_, ctl, op->In, &event) == 0)
+            return true;
+        op->Added = ctl == EPOLL_CTL_MOD;
+    }
+#endif
+
+    // E.g. the pipe broke already.
+    lock.unlock();
+    Release(op);
+    return false;
+}
+
+void EventLoop::Complete(Op* op, bool ok, size_t read) noexcept
+{
+    if (!ok || read == 0 || !op->Source->OnRead(read))
+    {
+        Release(op);
+        return;
+    }
+
+    std::unique_lock lock(lock_);
+    if (op->Source->pausing_ && !stopping_)
+    {
+        // Issued again by Stream::Resume().
+        op->Parked = true;
+        return;
+    }
+    (void)Issue(op, false, lock);
+}
+
+void EventLoop::Stream::Pause() noexcept
+{
+    std::scoped_lock lock(loop_->lock_);
+    pausing_ = true;
+}
+
+void EventLoop::Stream::Resume() noexcept
+{
+    std::unique_lock lock(loop_->lock_);
+    pausing_ = false;
+    if (!op_ || !op_->Parked)
+        return;
+
+    // Without letting go of the lock, Stop() releases parked ops. Not on a loop thread, so submitted right away.
+    op_->Parked = false;
+    (void)loop_->Issue(op_, true, lock);
+}
+
+void EventLoop::Release(Op* op) noexcept
+{
+#ifndef _WIN32
+    if (op->Added)
+        (void)::epoll_ctl(epoll_, EPOLL_CTL_DEL, op->Process != InvalidHandle ? op->Process : op->In, nullptr);
+#endif
+
+    {
+        std::scoped_lock lock(lock_);
+        ops_.erase(op);
+        if (op->Source)
+            op->Source->op_ = nullptr;
+        ++releasing_;
+    }
+
+    // Outside the lock, releasing a stream may release its transport.
+    delete op;
+
+    std::scoped_lock lock(lock_);
+    --releasing_;
+    released_.notify_all();
+}
+
+void EventLoop::Run() noexcept
+{
+#ifndef _WIN32
+    if (ring_)
+    {
+        RunUring();
+        return;
+    }
+#endif
+
+    for (;;)
+    {
+#ifdef _WIN32
+        DWORD       read       = 0;
+        ULONG_PTR   key        = 0;
+        OVERLAPPED* overlapped = nullptr;
+        const BOOL  ok         = ::GetQueuedCompletionStatus(port_, &read, &key, &overlapped, INFINITE);
+        if (key == QuitKey)
+            return;
+        if (!overlapped)
+            continue;
+
+        auto op = CONTAINING_RECORD(overlapped, Op, Overlapped);
+        if (key == ExitKey)
+        {
+            if (!stopping_)
+                op->OnExit();
+            Release(op);
+        }
+        else
+        {
+            Complete(op, ok, read);
+        }
+#else
+        epoll_event events[16];
+        const int   count = ::epoll_wait(epoll_, events, (int)std::size(events), -1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return;
+
+        for (int n = 0; n < count; ++n)
+        {
+            auto op = static_cast<Op*>(events[n].data.ptr);
+            if (!op)
+                return;
+            (void)op->Armed.exchange(false, std::memory_order_acquire);
+
+            if (op->Process != InvalidHandle)
+            {
+                if (!stopping_)
+                    op->OnExit();
+                Release(op);
+            }
+            else
+            {
+                const long read = ReadSome(op->In, op->Source->Buffer(), op->Source->BufferSize());
+                Complete(op, read > 0, read > 0 ? (size_t)read : 0);
+            }
+        }
+#endif
+    }
+}
+
+#ifndef _WIN32
+void EventLoop::RunUring() noexcept
+{
+    for (;;)
+    {
+        if (FAILED(ring_->Wait()))
+            return;
+
+        // Several threads may wait for the same completion, only one of them gets it.
+        io_uring_cqe completions[16];
+        size_t       count = 0;
+        bool         quit  = false;
+        {
+            std::scoped_lock lock(lock_);
+            while (!quit && count < std::size(completions) && ring_->Pop(completions[count]))
+            {
+                // One per thread, the others are left to the other threads.
+                quit = completions[count++].user_data == QuitTag;
+            }
+        }
+
+        for (size_t n = 0; n < count; ++n)
+        {
+            const io_uring_cqe& cqe = completions[n];
+            if (cqe.user_data == QuitTag || cqe.user_data == CancelTag)
+                continue;
+
+            auto op = (Op*)(uintptr_t)cqe.user_data;
+            if (op->Process != InvalidHandle)
+            {
+                if (!stopping_)
+                    op->OnExit();
+                Release(op);
+            }
+            else if (op->Out != InvalidHandle)
+            {
+                CompleteWrite(op, cqe.res);
+            }
+            else
+            {
+                Complete(op, cqe.res > 0, cqe.res > 0 ? (size_t)cqe.res : 0);
+            }
+        }
+
+        // Reads rearmed and writes continued while handling the batch go out with a single syscall.
+        {
+            std::scoped_lock lock(lock_);
+            (void)ring_->Submit();
+        }
+
+        if (quit)
+            return;
+    }
+}
+
+bool EventLoop::PrepareRead(Op* op) noexcept
+{
+    auto sqe = ring_->Prepare();
+    if (!sqe)
+        return false;
+
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = op->In;
+    sqe->addr      = (uintptr_t)op->Source->Buffer();
+    sqe->len       = (uint32_t)op->Source->BufferSize();
+    sqe->off       = (uint64_t)-1;
+    sqe->user_data = (uintptr_t)op;
+    return true;
+}
+
+bool EventLoop::PrepareWrite(Op* op) noexcept
+{
+    auto sqe = ring_->Prepare();
+    if (!sqe)
+        return false;
+
+    sqe->opcode    = IORING_OP_WRITE;
+    sqe->fd        = op->Out;
+    sqe->addr      = (uintptr_t)(op->Data.Data() + op->Written);
+    sqe->len       = (uint32_t)(op->Data.Size() - op->Written);
+    sqe->off       = (uint64_t)-1;
+    sqe->user_data = (uintptr_t)op;
+    return true;
+}
+
+void EventLoop::CompleteWrite(Op* op, int result) noexcept
+{
+    if (result <= 0)
+    {
+        FinishWrite(op, result ? HRESULT_FROM_ERRNO(-result) : E_FAIL);
+        return;
+    }
+
+    op->Written += (size_t)result;
+    if (op->Written == op->Data.Size())
+    {
+        FinishWrite(op, S_OK);
+        return;
+    }
+
+    // Pipes may take part of a frame only, continue with the rest.
+    {
+        std::scoped_lock lock(lock_);
+        if (!stopping_ && PrepareWrite(op))
+            return;
+    }
+    FinishWrite(op, HRESULT_FROM_ERRNO(ECANCELED));
+}
+
+void EventLoop::FinishWrite(Op* op, HRESULT hr) noexcept
+{
+    Op* failed = nullptr;
+    {
+        std::scoped_lock lock(lock_);
+        auto&            chain = writes_[op->Out];
+        chain.pop_front();
+        if (!chain.empty() && !PrepareWrite(chain.front()))
+            failed = chain.front();
+    }
+
+    if (!stopping_)
+        (*op->OnDone)(op->Out, hr);
+    Release(op);
+
+    if (failed)
+        FinishWrite(failed, E_OUTOFMEMORY);
+}
+#endif
+}
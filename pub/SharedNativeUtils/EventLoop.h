@@ -0,0 +1,134 @@
+#pragma once
+#include "platform.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ipc.h"
+
+namespace ipc
+{
+class Frame;
+class Uring;
+
+// Multiplexes reads from many pipes and the exit of many processes on a few threads, instead of blocking a thread
+// per pipe and process.
+// On Windows reads are overlapped and complete on an I/O completion port, process exits are observed by the thread
+// pool and handed over to the port. Elsewhere reads and waits for pidfds are submitted to an io_uring, a batch of
+// completions is handled and the reads of it are rearmed with a single syscall, as are the writes of a WriteAll().
+// Where io_uring isn't available pipes and pidfds are polled via epoll.
+class EventLoop final
+{
+    struct Op;
+
+public:
+    // A byte stream read by the loop, there's never more than a single read of a stream in flight.
+    class Stream
+    {
+    public:
+        virtual ~Stream() = default;
+
+        // Where the next read goes.
+        virtual uint8_t* Buffer()     = 0;
+        virtual size_t   BufferSize() = 0;
+        // read > 0 bytes arrived in Buffer(). Returns false to stop reading.
+        virtual bool OnRead(size_t read) = 0;
+
+        // Holds off the next read, e.g. while what was read can't be handed on without blocking the loop thread.
+        // Only from within OnRead().
+        void Pause() noexcept;
+        // Reads on after Pause(), from any thread, even before OnRead() returned.
+        void Resume() noexcept;
+
+    private:
+        friend EventLoop;
+
+        // Guarded by lock_ of the loop, set while the stream is read.
+        EventLoop* loop_    = nullptr;
+        Op*        op_      = nullptr;
+        bool       pausing_ = false;
+    };
+
+    // uring == false uses epoll even if io_uring is available, ignored on Windows.
+    explicit EventLoop(bool uring = true);
+    ~EventLoop();
+
+    EventLoop(const EventLoop&)            = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // threads == 0 picks DefaultThreads().
+    HRESULT Start(size_t threads = 0) noexcept;
+
+    // A few depending on the count of cores.
+    static size_t DefaultThreads() noexcept;
+
+    // Waits for the threads, reads still in flight are cancelled and their streams released.
+    void Stop() noexcept;
+
+    // Reads from in until stream asks to stop or the peer closed, then releases stream.
+    // in is not owned and has to stay open until then, on Windows it must have been opened for overlapped I/O.
+    HRESULT Read(Handle in, std::shared_ptr<Stream> stream) noexcept;
+
+    // Calls onExit on a loop thread once process exited. Takes ownership of process, a process handle on Windows
+    // and a pidfd elsewhere.
+    HRESULT WatchExit(Handle process, std::function<void()> onExit) noexcept;
+
+    using OnWritten = std::function<void(Handle out, HRESULT hr)>;
+
+    // Writes frame to each of outs with a single syscall, e.g. a message to all hosts subscribed to a service.
+    // Writes to the same handle are done one after the other in the order requested. onWritten is called on a loop
+    // thread for each of outs once its write is done, unless the loop is stopping. The handles are not owned and have
+    // to stay open until then.
+    // On failure writes to some of outs may have been issued nonetheless. E_NOTIMPL unless io_uring is used.
+    HRESULT WriteAll(std::span<const Handle> outs, const Frame& frame, OnWritten onWritten) noexcept;
+
+    bool UsesUring() const noexcept;
+
+private:
+    void Run() noexcept;
+    // Returns false if the read couldn't be issued, the op is done then.
+    // With io_uring a read issued by a loop thread is submitted along with the rest of its batch, unless submit.
+    bool Issue(Op* op, bool submit) noexcept;
+    // Same, with lock_ held by lock, which may be unlocked.
+    bool Issue(Op* op, bool submit, std::unique_lock<std::mutex>& lock) noexcept;
+    void Complete(Op* op, bool ok, size_t read) noexcept;
+    void Release(Op* op) noexcept;
+#ifndef _WIN32
+    void RunUring() noexcept;
+    void CompleteWrite(Op* op, int result) noexcept;
+    // Issues the next write to the same handle, if any.
+    void FinishWrite(Op* op, HRESULT hr) noexcept;
+    // Called with lock_ held.
+    bool PrepareRead(Op* op) noexcept;
+    bool PrepareWrite(Op* op) noexcept;
+#endif
+
+#ifdef _WIN32
+    Handle port_ = InvalidHandle;
+#else
+    Handle epoll_ = InvalidHandle;
+    Handle wake_  = InvalidHandle;
+    // Used instead of epoll_ if available.
+    std::unique_ptr<Uring> ring_;
+#endif
+    const bool               preferUring_;
+    std::vector<std::thread> threads_;
+
+    // Ops registered and not released yet, so Stop() can get rid of them.
+    std::mutex              lock_;
+    std::condition_variable released_;
+    std::unordered_set<Op*> ops_;
+    size_t                  releasing_ = 0;
+    std::atomic<bool>       stopping_ = false;
+    // Writes per handle, the first one is issued, the others wait for it. Kept once empty, handles are reused.
+    std::unordered_map<Handle, std::deque<Op*>> writes_;
+};
+}
@@ -0,0 +1,413 @@
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include "FrameReader.h"
+#include "Compression.h"
+#include "ServiceTable.h"
+#ifndef _WIN32
+#    include <unistd.h>
+#endif
+
+namespace ipc
+{
+namespace
+{
+// Oversized frame buffers above this are released after use instead of being kept for reuse.
+const size_t MaxRetainedOversized = 1024 * 1024;
+
+std::atomic<size_t> maxReassembly {DefaultMaxReassembly};
+
+bool IsControlFrame(const uint8_t* frame) noexcept
+{
+    uint16_t magic, flags;
+    memcpy(&magic, &frame[offsetof(FrameHeaderV1, Magic)], sizeof(magic));
+    memcpy(&flags, &frame[offsetof(FrameHeaderV1, Flags)], sizeof(flags));
+    return magic == FrameMagic && (flags & FrameFlags::Control);
+}
+}
+
+void SetMaxReassembly(size_t size) noexcept
+{
+    maxReassembly.store(size, std::memory_order_relaxed);
+}
+
+size_t GetMaxReassembly() noexcept
+{
+    return maxReassembly.load(std::memory_order_relaxed);
+}
+
+bool SkipUndecodable() noexcept
+{
+    LOG_HR_MSG(E_UNEXPECTED, "Skipped IPC frame for an unknown service id or with unknown flags");
+    return false;
+}
+
+long ReadSome(Handle in, void* buf, size_t size) noexcept
+{
+#ifdef _WIN32
+    DWORD read = 0;
+    if (!::ReadFile(in, buf, (DWORD)size, &read, nullptr))
+        return ::GetLastError() == ERROR_BROKEN_PIPE ? 0 : -1;
+    return (long)read;
+#else
+    for (;;)
+    {
+        ssize_t read = ::read(in, buf, size);
+        if (read < 0 && errno == EINTR)
+            continue;
+        return (long)read;
+    }
+#endif
+}
+
+FrameStatus PeekFrame(const uint8_t* data, size_t available, size_t& frameSize) noexcept
+{
+    if (available < 4)
+        return FrameStatus::Incomplete;
+
+    DWORD size = 0;
+    memcpy(&size, data, 4);
+    if (size < sizeof(FrameHeader) - 4 + 1 /*zero-term*/)
+        return FrameStatus::Invalid;
+
+    frameSize = 4 + (size_t)size;
+    return available < frameSize ? FrameStatus::Incomplete : FrameStatus::Complete;
+}
+
+bool DecodeFrame(
+    const uint8_t* frame, size_t frameSize, std::string_view& msg, Target& target, ChunkInfo& chunk) noexcept
+{
+    // Field by field, copying the header as a whole stalls on reading it back.
+    uint16_t magic;
+    memcpy(&magic, &frame[offsetof(FrameHeaderV1, Magic)], sizeof(magic));
+
+    ServiceId id;
+    size_t    offset;
+    chunk = {};
+    if (magic == FrameMagic)
+    {
+        uint16_t flags, headerSize;
+        memcpy(&flags, &frame[offsetof(FrameHeaderV1, Flags)], sizeof(flags));
+        memcpy(&headerSize, &frame[offsetof(FrameHeaderV1, HeaderSize)], sizeof(headerSize));
+        if ((flags & ~FrameFlags::Known) || headerSize < sizeof(FrameHeaderV1) || frameSize < headerSize + 1u)
+            return false;
+
+        memcpy(&id, &frame[offsetof(FrameHeaderV1, Service)], sizeof(id));
+        memcpy(&target.Session, &frame[offsetof(FrameHeaderV1, Session)], sizeof(target.Session));
+        memcpy(&target.Meta.Id, &frame[offsetof(FrameHeaderV1, MsgId)], sizeof(target.Meta.Id));
+        memcpy(&target.Meta.Sent, &frame[offsetof(FrameHeaderV1, Sent)], sizeof(target.Meta.Sent));
+        target.Meta.Payload  = (PayloadType)frame[offsetof(FrameHeaderV1, Payload)];
+        target.Meta.Priority = flags & FrameFlags::Control ? MsgPriority::Control : MsgPriority::Bulk;
+        offset               = headerSize;
+        if (flags & FrameFlags::Lz4)
+            memcpy(&chunk.RawSize, &frame[offsetof(FrameHeaderV1, RawSize)], sizeof(chunk.RawSize));
+        if (flags & FrameFlags::Chunk)
+        {
+            FrameChunk where;
+            if (headerSize < sizeof(FrameHeaderV1) + sizeof(where))
+                return false;
+
+            memcpy(&where, &frame[sizeof(FrameHeaderV1)], sizeof(where));
+            // Each chunk has at least one byte and there's at least one more.
+            if (where.Offset >= where.Total || where.Total < 2)
+                return false;
+
+            chunk.Offset = where.Offset;
+            chunk.Total  = where.Total;
+        }
+    }
+    else
+    {
+        memcpy(&id, &frame[offsetof(FrameHeader, Service)], sizeof(id));
+        memcpy(&target.Session, &frame[offsetof(FrameHeader, Session)], sizeof(target.Session));
+        target.Meta = {};
+        offset      = sizeof(FrameHeader);
+    }
+    target.Id = id;
+
+    if (id == KnownServiceId::Unresolved)
+    {
+        if (frameSize < offset + sizeof(Guid) + 1)
+            return false;
+
+        memcpy((void*)&target.Service, &frame[offset], sizeof(Guid));
+        offset += sizeof(Guid);
+        target.Id = Services().Resolve(target.Service);
+    }
+    else
+    {
+        const Guid* service = Services().Lookup(id);
+        if (!service)
+            return false;
+
+        target.Service = *service;
+    }
+
+    msg = std::string_view((const char*)&frame[offset], frameSize - offset - 1);
+    return chunk.Total || !chunk.RawSize || Decompress(msg, chunk.RawSize, msg);
+}
+
+EncodedHeader::EncodedHeader(
+    const Target& target, size_t msgSize, uint8_t version, DWORD rawSize, const FrameChunk& chunk) noexcept
+{
+    service_ = target.Id != KnownServiceId::Unresolved ? target.Id : Services().Resolve(target.Service);
+
+    if (version >= FrameVersion::V1)
+    {
+        const bool    chunked = chunk.Total != 0;
+        const bool    control = version >= FrameVersion::V4 && target.Meta.Priority == MsgPriority::Control;
+        FrameHeaderV1 header {};
+        header.Flags      = (uint16_t)((rawSize ? FrameFlags::Lz4 : 0) | (chunked ? FrameFlags::Chunk : 0) |
+                                  (control ? FrameFlags::Control : 0));
+        header.Magic      = FrameMagic;
+        header.Version    = version;
+        header.Payload    = (uint8_t)target.Meta.Payload;
+        header.HeaderSize = (uint16_t)(sizeof(FrameHeaderV1) + (chunked ? sizeof(FrameChunk) : 0));
+        header.Service    = service_;
+        header.Session    = target.Session;
+        header.RawSize    = rawSize;
+        header.MsgId      = target.Meta.Id ? target.Meta.Id : NextMsgId();
+        header.Sent       = target.Meta.Sent ? target.Meta.Sent : TimestampNow();
+        memcpy(bytes_, &header, sizeof(header));
+        size_ = sizeof(header);
+        if (chunked)
+        {
+            memcpy(&bytes_[size_], &chunk, sizeof(chunk));
+            size_ += sizeof(chunk);
+        }
+    }
+    else
+    {
+        FrameHeader header {};
+        header.Service = service_;
+        header.Session = target.Session;
+        memcpy(bytes_, &header, sizeof(header));
+        size_ = sizeof(header);
+    }
+
+    if (service_ == KnownServiceId::Unresolved)
+    {
+        memcpy(&bytes_[size_], (const void*)&target.Service, sizeof(Guid));
+        size_ += sizeof(Guid);
+    }
+
+    // count of bytes following the length prefix
+    const DWORD size = (DWORD)(size_ + msgSize + 1 /*zero-term*/ - 4);
+    memcpy(bytes_, &size, sizeof(size));
+    frameSize_ = 4 + (size_t)size;
+}
+
+MirroredRing::~MirroredRing()
+{
+    Release();
+}
+
+void MirroredRing::Release() noexcept
+{
+    view_.Unmap();
+    CloseSection(section_);
+    section_ = InvalidHandle;
+    head_ = tail_ = 0;
+}
+
+HRESULT MirroredRing::Create(size_t minCapacity) noexcept
+{
+    Release();
+
+    const size_t size = MirrorAlign(minCapacity);
+    RETURN_IF_FAILED(CreateSection(size, false, section_));
+    RETURN_IF_FAILED(view_.Map(section_, 0, size));
+    return S_OK;
+}
+
+HRESULT FrameReader::Init(size_t capacity) noexcept
+{
+    return ring_.Create(capacity);
+}
+
+HRESULT FrameReader::ReadChunk(Handle in, const OnMessage& onMessage) noexcept
+try
+{
+    const long read = ReadSome(in, ReadBuffer(), ReadBufferSize());
+    RETURN_HR_IF(S_FALSE, read == 0); // pipe closed
+    RETURN_LAST_ERROR_IF(read < 0);
+
+    return OnRead((size_t)read, onMessage);
+}
+CATCH_RETURN();
+
+HRESULT FrameReader::OnRead(size_t read, const OnMessage& onMessage) noexcept
+try
+{
+    ++stats_.Reads;
+    stats_.Bytes += (uint64_t)read;
+
+    if (oversizedSize_)
+    {
+        oversizedHave_ += read;
+        return oversizedHave_ < oversizedSize_ ? S_OK : DispatchOversized(onMessage);
+    }
+
+    ring_.Commit(read);
+
+    const HRESULT hr = DispatchComplete(onMessage);
+    if (hr != S_OK)
+        return hr;
+
+    // A frame larger than the ring can never complete within it.
+    // Take over what's already in the ring and let the following reads go directly into place.
+    size_t frameSize = 0;
+    if (PeekFrame(ring_.ReadPtr(), ring_.Readable(), frameSize) == FrameStatus::Incomplete &&
+        frameSize > ring_.Capacity())
+    {
+        oversized_.resize(frameSize);
+        oversizedSize_ = frameSize;
+        oversizedHave_ = ring_.Readable();
+        memcpy(oversized_.data(), ring_.ReadPtr(), oversizedHave_);
+        ring_.Consume(oversizedHave_);
+    }
+
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT FrameReader::DispatchComplete(const OnMessage& onMessage) noexcept
+try
+{
+    if (reassembler_.DispatchControl(ring_.ReadPtr(), ring_.Readable(), onMessage))
+        return S_FALSE;
+
+    for (;;)
+    {
+        size_t     frameSize = 0;
+        const auto status    = PeekFrame(ring_.ReadPtr(), ring_.Readable(), frameSize);
+        RETURN_HR_IF_MSG(E_UNEXPECTED, status == FrameStatus::Invalid, "Invalid IPC frame");
+        if (status == FrameStatus::Incomplete)
+            break;
+
+        ++stats_.Frames;
+        const bool stop = reassembler_.Dispatch(ring_.ReadPtr(), frameSize, onMessage);
+        ring_.Consume(frameSize);
+
+        if (stop)
+            return S_FALSE;
+    }
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT FrameReader::DispatchOversized(const OnMessage& onMessage) noexcept
+try
+{
+    const size_t frameSize = oversizedSize_;
+
+    oversizedSize_ = oversizedHave_ = 0;
+
+    ++stats_.Frames;
+    const bool stop = reassembler_.Dispatch(oversized_.data(), frameSize, onMessage);
+
+    if (oversized_.capacity() > MaxRetainedOversized)
+        std::vector<uint8_t>().swap(oversized_);
+
+    return stop ? S_FALSE : S_OK;
+}
+CATCH_RETURN();
+
+bool Reassembler::DispatchControl(const uint8_t* frames, size_t available, const OnMessage& onMessage)
+{
+    size_t frameSize = 0;
+    for (size_t offset = 0; PeekFrame(&frames[offset], available - offset, frameSize) == FrameStatus::Complete;
+         offset += frameSize)
+    {
+        if (!IsControlFrame(&frames[offset]))
+            continue;
+
+        ++controlAhead_;
+        if (Decode(&frames[offset], frameSize, onMessage))
+            return true;
+    }
+    return false;
+}
+
+bool Reassembler::Dispatch(const uint8_t* frame, size_t frameSize, const OnMessage& onMessage)
+{
+    if (controlAhead_ && IsControlFrame(frame))
+    {
+        --controlAhead_;
+        return false;
+    }
+    return Decode(frame, frameSize, onMessage);
+}
+
+bool Reassembler::Decode(const uint8_t* frame, size_t frameSize, const OnMessage& onMessage)
+{
+    std::string_view msg;
+    Target           target;
+    ChunkInfo        chunk;
+    if (!DecodeFrame(frame, frameSize, msg, target, chunk))
+        return SkipUndecodable();
+
+    if (!chunk.Total)
+        return onMessage(msg, target);
+
+    ++stats_.Chunks;
+    return Assemble(msg, target, chunk, onMessage);
+}
+
+bool Reassembler::Assemble(
+    std::string_view bytes, const Target& target, const ChunkInfo& chunk, const OnMessage& onMessage)
+{
+    auto it = pending_.find(target.Meta.Id);
+    if (it == pending_.end())
+    {
+        // The rest of a msg dropped before.
+        if (chunk.Offset != 0)
+            return false;
+
+        if (stats_.Pending + chunk.Total > GetMaxReassembly())
+        {
+            ++stats_.Dropped;
+            LOG_HR_MSG(E_OUTOFMEMORY, "Dropped chunked IPC msg of %u bytes, reassembly limit reached", chunk.Total);
+            return false;
+        }
+
+        Pending pending {std::make_unique_for_overwrite<char[]>((size_t)chunk.Total + 1), 0, chunk.Total};
+        it = pending_.emplace(target.Meta.Id, std::move(pending)).first;
+        stats_.Pending += chunk.Total;
+        stats_.MaxPending = std::max(stats_.MaxPending, stats_.Pending);
+    }
+
+    auto& pending = it->second;
+    if (chunk.Offset != pending.Have || chunk.Total != pending.Total || bytes.size() > pending.Total - pending.Have)
+    {
+        // Chunks of a msg are sent in order, the sender is broken.
+        ++stats_.Dropped;
+        stats_.Pending -= pending.Total;
+        pending_.erase(it);
+        return SkipUndecodable();
+    }
+
+    if (onChunk_ && !chunk.RawSize)
+        onChunk_(bytes, chunk.Offset, chunk.Total, target);
+
+    memcpy(&pending.Bytes[pending.Have], bytes.data(), bytes.size());
+    pending.Have += (DWORD)bytes.size();
+    if (pending.Have < pending.Total)
+        return false;
+
+    // Released once onMessage is done with it.
+    const auto complete = std::move(pending.Bytes);
+    stats_.Pending -= pending.Total;
+    ++stats_.Reassembled;
+    pending_.erase(it);
+
+    complete[chunk.Total] = 0;
+    std::string_view msg(complete.get(), chunk.Total);
+    if (chunk.RawSize && !Decompress(msg, chunk.RawSize, msg))
+        return SkipUndecodable();
+
+    return onMessage(msg, target);
+}
+}
@@ -0,0 +1,294 @@
+#pragma once
+#include "platform.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <absl/container/flat_hash_map.h>
+#include "ipc.h"
+#include "Compression.h"
+#include "MirroredMemory.h"
+
+namespace ipc
+{
+enum class FrameStatus
+{
+    Complete,
+    Incomplete,
+    Invalid
+};
+
+// Reads whatever is available (up to size bytes), blocking until at least one byte arrived.
+// Returns count of bytes read, 0 if the pipe was closed, <0 on error.
+long ReadSome(Handle in, void* buf, size_t size) noexcept;
+
+// Inspects the frame starting at data of which available bytes are present.
+// Once the length prefix is present frameSize receives the size of the entire frame incl. the prefix.
+FrameStatus PeekFrame(const uint8_t* data, size_t available, size_t& frameSize) noexcept;
+
+// Where the msg bytes of a frame belong, see FrameFlags::Chunk.
+struct ChunkInfo final
+{
+    DWORD Offset  = 0;
+    // 0 if the frame carries a whole msg.
+    DWORD Total   = 0;
+    // Of the msg once put together and decompressed, 0 if it isn't compressed.
+    DWORD RawSize = 0;
+};
+
+// Decodes a complete frame, msg is a view into the frame or, if it was compressed, into a buffer of the calling
+// thread which is reused by its next call. A chunk isn't decompressed, msg are its bytes as sent, see Reassembler.
+// Fails if the frame carries a service id unknown to this process or can't be decompressed.
+bool DecodeFrame(
+    const uint8_t* frame, size_t frameSize, std::string_view& msg, Target& target, ChunkInfo& chunk) noexcept;
+
+// Logs that a frame DecodeFrame() failed on is skipped. Returns false, i.e. don't stop reading.
+bool SkipUndecodable() noexcept;
+
+// Everything of a frame preceding the msg bytes, see FrameHeader and FrameHeaderV1.
+// Uses target.Id, or the id this process knows for target.Service. If neither is known the GUID is sent.
+// From FrameVersion::V1 on target.Meta is sent too, a message without id and timestamp gets them assigned.
+// A non zero rawSize flags the msg bytes as compressed, see WirePayload. A chunk with a non zero Total flags them as a
+// chunk of a larger msg.
+class EncodedHeader final
+{
+public:
+    EncodedHeader(const Target& target, size_t msgSize, uint8_t version, DWORD rawSize = 0,
+        const FrameChunk& chunk = {}) noexcept;
+
+    const uint8_t* Data() const
+    {
+        return bytes_;
+    }
+    // Count of bytes at Data().
+    size_t Size() const
+    {
+        return size_;
+    }
+    // Size of the entire frame incl. msg and zero-term.
+    size_t FrameSize() const
+    {
+        return frameSize_;
+    }
+    ServiceId Service() const
+    {
+        return service_;
+    }
+
+private:
+    uint8_t   bytes_[sizeof(FrameHeaderV1) + sizeof(FrameChunk) + sizeof(Guid)];
+    size_t    size_;
+    size_t    frameSize_;
+    ServiceId service_;
+};
+
+// Msgs with more bytes are sent in chunks of at most this size from FrameVersion::V3 on, so a chunk frame fits into
+// a reader's ring and doesn't hold up other msgs for long.
+const size_t MaxChunk = 60 * 1024;
+
+// Calls onFrame(header, bytes) for every frame payload is sent as: a single one, or a chunk frame per MaxChunk bytes.
+// Stops at the first failure onFrame returns.
+template <class OnFrame>
+HRESULT EncodeFrames(const Target& target, const WirePayload& payload, uint8_t version, OnFrame&& onFrame)
+{
+    const std::string_view bytes = payload.Bytes();
+    if (version < FrameVersion::V3 || bytes.size() <= MaxChunk)
+        return onFrame(EncodedHeader(target, bytes.size(), version, payload.RawSize()), bytes);
+
+    // All chunks carry the same id, by which the reader puts them together.
+    Target chunked    = target;
+    chunked.Meta.Id   = target.Meta.Id ? target.Meta.Id : NextMsgId();
+    chunked.Meta.Sent = target.Meta.Sent ? target.Meta.Sent : TimestampNow();
+    for (size_t offset = 0; offset < bytes.size(); offset += MaxChunk)
+    {
+        const auto       chunk = bytes.substr(offset, MaxChunk);
+        const FrameChunk where {(DWORD)offset, (DWORD)bytes.size()};
+        const HRESULT    hr = onFrame(EncodedHeader(chunked, chunk.size(), version, payload.RawSize(), where), chunk);
+        if (FAILED(hr))
+            return hr;
+    }
+    return S_OK;
+}
+
+// Process wide limit of the bytes a Reassembler holds for msgs not complete yet.
+// The broker tells its hosts with HostInitMsg::MaxReassembly.
+const size_t DefaultMaxReassembly = 64 * 1024 * 1024;
+void         SetMaxReassembly(size_t size) noexcept;
+size_t       GetMaxReassembly() noexcept;
+
+// Decodes the frames of a connection and puts msgs sent in chunks back together.
+// A msg exceeding the reassembly limit is dropped, so a runaway sender can't exhaust memory.
+class Reassembler final
+{
+public:
+    struct Stats
+    {
+        uint64_t Chunks      = 0;
+        uint64_t Reassembled = 0;
+        uint64_t Dropped     = 0;
+        size_t   Pending     = 0;
+        size_t   MaxPending  = 0;
+    };
+
+    Reassembler() = default;
+
+    Reassembler(const Reassembler&)            = delete;
+    Reassembler& operator=(const Reassembler&) = delete;
+
+    // Called for chunks of msgs not compressed, as they arrive. Set before the first frame is dispatched.
+    void SetOnChunk(OnChunk onChunk)
+    {
+        onChunk_ = std::move(onChunk);
+    }
+
+    // Decodes a frame and hands msgs to onMessage, those sent in chunks once complete. Returns true to stop reading.
+    // Skips control frames DispatchControl() handled ahead.
+    bool Dispatch(const uint8_t* frame, size_t frameSize, const OnMessage& onMessage);
+
+    // Dispatches the control frames among the complete frames at frames, see FrameFlags::Control. The caller then
+    // passes all these frames to Dispatch() in order. Returns true to stop reading.
+    bool DispatchControl(const uint8_t* frames, size_t available, const OnMessage& onMessage);
+
+    const Stats& GetStats() const
+    {
+        return stats_;
+    }
+
+private:
+    struct Pending
+    {
+        std::unique_ptr<char[]> Bytes;
+        DWORD                   Have;
+        DWORD                   Total;
+    };
+
+    bool Decode(const uint8_t* frame, size_t frameSize, const OnMessage& onMessage);
+    bool Assemble(std::string_view bytes, const Target& target, const ChunkInfo& chunk, const OnMessage& onMessage);
+
+    // By MsgId, chunks of a connection's msgs are in order but msgs may interleave.
+    absl::flat_hash_map<uint64_t, Pending> pending_;
+    OnChunk                                onChunk_;
+    Stats                                  stats_;
+    // Control frames dispatched ahead which Dispatch() yet has to skip.
+    size_t                                 controlAhead_ = 0;
+};
+
+// A private ring buffer whose memory is mapped twice back-to-back.
+// Any range of up to Capacity() bytes starting anywhere within the ring is thus contiguous in memory,
+// so frames wrapping around the end of the ring can be handed out as a single view without copying.
+class MirroredRing final
+{
+public:
+    MirroredRing() = default;
+    ~MirroredRing();
+
+    MirroredRing(const MirroredRing&)            = delete;
+    MirroredRing& operator=(const MirroredRing&) = delete;
+
+    // Capacity is rounded up to the allocation granularity of the system.
+    HRESULT Create(size_t minCapacity) noexcept;
+
+    size_t Capacity() const
+    {
+        return view_.Size();
+    }
+
+    uint8_t* WritePtr() const
+    {
+        return view_.Data() + (tail_ % Capacity());
+    }
+    size_t Writable() const
+    {
+        return Capacity() - Readable();
+    }
+    void Commit(size_t count)
+    {
+        tail_ += count;
+    }
+
+    const uint8_t* ReadPtr() const
+    {
+        return view_.Data() + (head_ % Capacity());
+    }
+    size_t Readable() const
+    {
+        return (size_t)(tail_ - head_);
+    }
+    void Consume(size_t count)
+    {
+        head_ += count;
+    }
+
+private:
+    void Release() noexcept;
+
+    MirroredView view_;
+    Handle       section_ = InvalidHandle;
+    // Monotonic byte counters, the ring offset is taken modulo capacity.
+    uint64_t head_ = 0;
+    uint64_t tail_ = 0;
+};
+
+// Reads frames as written by ipc::Send.
+// Each read fetches as many bytes as currently available (up to the ring capacity) and every complete frame within
+// is dispatched before the next read. A partially received frame simply stays in the ring until the rest arrives.
+class FrameReader final
+{
+public:
+    using OnMessage = ipc::OnMessage;
+
+    struct Stats
+    {
+        uint64_t Reads  = 0;
+        uint64_t Frames = 0;
+        uint64_t Bytes  = 0;
+    };
+
+    static const size_t DefaultCapacity = 64 * 1024;
+
+    HRESULT Init(size_t capacity = DefaultCapacity) noexcept;
+
+    // Performs a single read and dispatches all complete frames.
+    // Returns S_FALSE if onMessage requested to stop reading, a failure if the pipe broke or a frame is invalid.
+    // Messages are views into the ring and only valid during the onMessage call. They are zero-terminated.
+    HRESULT ReadChunk(Handle in, const OnMessage& onMessage) noexcept;
+
+    // Where the next read shall go, for reads not issued by ReadChunk(), e.g. by an EventLoop.
+    uint8_t* ReadBuffer()
+    {
+        return oversizedSize_ ? oversized_.data() + oversizedHave_ : ring_.WritePtr();
+    }
+    size_t ReadBufferSize() const
+    {
+        return oversizedSize_ ? oversizedSize_ - oversizedHave_ : ring_.Writable();
+    }
+
+    // Takes over read (> 0) bytes placed at ReadBuffer() and dispatches all complete frames, see ReadChunk().
+    HRESULT OnRead(size_t read, const OnMessage& onMessage) noexcept;
+
+    // See Reassembler::SetOnChunk().
+    void SetOnChunk(OnChunk onChunk)
+    {
+        reassembler_.SetOnChunk(std::move(onChunk));
+    }
+
+    const Stats& GetStats() const
+    {
+        return stats_;
+    }
+
+private:
+    HRESULT DispatchComplete(const OnMessage& onMessage) noexcept;
+    HRESULT DispatchOversized(const OnMessage& onMessage) noexcept;
+
+    MirroredRing ring_;
+    // Frames which don't fit into the ring are assembled here, reused for subsequent oversized frames.
+    std::vector<uint8_t> oversized_;
+    // Size of the frame being assembled in oversized_, 0 if none.
+    size_t      oversizedSize_ = 0;
+    size_t      oversizedHave_ = 0;
+    Reassembler reassembler_;
+    Stats       stats_;
+};
+}
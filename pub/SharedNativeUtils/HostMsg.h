@@ -1,8 +1,14 @@
 #pragma once
 
+#include <cstring>
+#include <optional>
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 #include "guid.h"
+#include "ipc.h"
+#include "ShmRing.h"
+#include "Compression.h"
+#include "FrameReader.h"
 #include "string_extensions.h"
 using namespace Strings;
 
@@ -13,17 +19,67 @@ struct HostInitMsg
 {
     Guid        Service;
     std::string GroupName;
+    // Present if the broker talks to this host via shared memory instead of stdin/stdout.
+    std::optional<ShmChannel::Description> SharedMemory;
+    // Highest frame version the broker reads and writes, Legacy for brokers not sending it.
+    uint8_t FrameVersion  = ipc::FrameVersion::Legacy;
+    // Msgs of at least this size are compressed from FrameVersion::V2 on, 0 never.
+    size_t  CompressAbove = ipc::DefaultCompressAbove;
+    // Limit of a msg reassembled from chunks, sent from FrameVersion::V3 on.
+    size_t  MaxReassembly = ipc::DefaultMaxReassembly;
+    // Bytes of msgs the host may have sent which the broker hasn't written to all recipients yet, 0 for no limit.
+    // The broker grants credit back with HostCmdMsg::Cmd::Credit.
+    size_t  SendWindow    = 0;
 };
 
 inline void to_json(json& j, const HostInitMsg& msg)
 {
-    j = json {{"Service", msg.Service.ToUtf8()}, {"GroupName", msg.GroupName}};
+    j = json {{"Service", msg.Service.ToUtf8()}, {"GroupName", msg.GroupName}, {"FrameVersion", msg.FrameVersion},
+        {"CompressAbove", msg.CompressAbove}, {"MaxReassembly", msg.MaxReassembly}, {"SendWindow", msg.SendWindow}};
+    if (msg.SharedMemory)
+    {
+        const auto& shm   = *msg.SharedMemory;
+        j["SharedMemory"] = json {{"Section", shm.Section}, {"Capacity", shm.Capacity}, {"Events", shm.Events}};
+    }
 }
 
 inline void from_json(const json& j, HostInitMsg& msg)
 {
-    msg.Service.Parse(ToUtf16(j["Service"]));
+    msg.Service.Parse(j.at("Service").get_ref<const json::string_t&>());
     j.at("GroupName").get_to(msg.GroupName);
+    if (j.contains("SharedMemory"))
+    {
+        const auto&             shm = j["SharedMemory"];
+        ShmChannel::Description desc;
+        shm.at("Section").get_to(desc.Section);
+        shm.at("Capacity").get_to(desc.Capacity);
+        shm.at("Events").get_to(desc.Events);
+        msg.SharedMemory = desc;
+    }
+    msg.FrameVersion  = j.value("FrameVersion", ipc::FrameVersion::Legacy);
+    msg.CompressAbove = j.value("CompressAbove", ipc::DefaultCompressAbove);
+    msg.MaxReassembly = j.value("MaxReassembly", ipc::DefaultMaxReassembly);
+    msg.SendWindow    = j.value("SendWindow", (size_t)0);
+}
+
+// The host's answer to a HostInitMsg offering a frame version, sent to KnownService::Broker.
+// From then on both sides send frames of that version. Hosts not knowing about frame versions don't answer.
+struct HostInitAckMsg
+{
+    uint8_t FrameVersion;
+    // HostInitMsg::SendWindow if the host applies it, 0 for hosts not knowing about it.
+    size_t  SendWindow = 0;
+};
+
+inline void to_json(json& j, const HostInitAckMsg& msg)
+{
+    j = json {{"FrameVersion", msg.FrameVersion}, {"SendWindow", msg.SendWindow}};
+}
+
+inline void from_json(const json& j, HostInitAckMsg& msg)
+{
+    j.at("FrameVersion").get_to(msg.FrameVersion);
+    msg.SendWindow = j.value("SendWindow", (size_t)0);
 }
 
 struct HostCmdMsg
@@ -31,10 +87,11 @@ struct HostCmdMsg
     enum class Cmd
     {
         Terminate,
-        CtrlModule
+        CtrlModule,
+        Credit
     };
     Cmd         Cmd;
-    std::string Args; // e.g. CtrlModule => HostCtrlModuleArgs as JSON
+    std::string Args; // e.g. CtrlModule => HostCtrlModuleArgs as JSON, or binary, see HostCmdHeader
 };
 
 inline void to_json(json& j, const HostCmdMsg& msg)
@@ -57,6 +114,8 @@ struct HostCtrlModuleArgs
     };
     Cmd         Cmd;
     std::string Module;
+
+    static constexpr HostCmdMsg::Cmd ForCmd = HostCmdMsg::Cmd::CtrlModule;
 };
 inline void to_json(json& j, const HostCtrlModuleArgs& msg)
 {
@@ -69,4 +128,174 @@ inline void from_json(const json& j, HostCtrlModuleArgs& msg)
     j.at("Module").get_to(msg.Module);
 }
 
+// Credit the broker grants back to a host for msgs written to all their recipients, see HostInitMsg::SendWindow.
+struct HostCreditArgs
+{
+    size_t Bytes;
+
+    static constexpr HostCmdMsg::Cmd ForCmd = HostCmdMsg::Cmd::Credit;
+};
+inline void to_json(json& j, const HostCreditArgs& msg)
+{
+    j = json {{"Bytes", msg.Bytes}};
+}
+
+inline void from_json(const json& j, HostCreditArgs& msg)
+{
+    j.at("Bytes").get_to(msg.Bytes);
+}
+
+// Commands are sent binary as PayloadType::Binary to hosts reading FrameVersion::V5, the JSON form above remains for
+// older hosts, the managed host and diagnostics.
+// Wire layout: [HostCmdHeader][args], the args of a command as laid out below. Both may only grow by appending
+// fields, readers skip what they don't know.
+const uint8_t HostCmdVersion = 1;
+
+struct HostCmdHeader final
+{
+    uint8_t  Version;
+    uint8_t  Cmd;
+    // Where the args start.
+    uint16_t HeaderSize;
+};
+static_assert(sizeof(HostCmdHeader) == 4);
+
+// Args of HostCmdMsg::Cmd::CtrlModule, followed by ModuleSize bytes of the module name in UTF-8.
+struct HostCtrlModuleWire final
+{
+    uint8_t  Cmd;
+    uint8_t  Reserved[3];
+    uint32_t ModuleSize;
+};
+static_assert(sizeof(HostCtrlModuleWire) == 8);
+
+// Args of HostCmdMsg::Cmd::Credit.
+struct HostCreditWire final
+{
+    uint64_t Bytes;
+};
+static_assert(sizeof(HostCreditWire) == 8);
+
+namespace detail
+{
+template <class T>
+void Append(std::string& bytes, const T& value)
+{
+    bytes.append((const char*)&value, sizeof(value));
+}
+
+// Copies the fields of a T at the start of bytes, fails if there are fewer than those.
+template <class T>
+HRESULT Read(std::string_view bytes, T& value) noexcept
+{
+    RETURN_HR_IF(E_INVALIDARG, bytes.size() < sizeof(value));
+    memcpy(&value, bytes.data(), sizeof(value));
+    return S_OK;
+}
+}
+
+inline void AppendArgs(std::string& bytes, const HostCtrlModuleArgs& args)
+{
+    detail::Append(bytes, HostCtrlModuleWire {(uint8_t)args.Cmd, {}, (uint32_t)args.Module.size()});
+    bytes.append(args.Module);
+}
+
+inline void AppendArgs(std::string& bytes, const HostCreditArgs& args)
+{
+    detail::Append(bytes, HostCreditWire {(uint64_t)args.Bytes});
+}
+
+inline std::string ToBinary(HostCmdMsg::Cmd cmd)
+{
+    std::string bytes;
+    detail::Append(bytes, HostCmdHeader {HostCmdVersion, (uint8_t)cmd, (uint16_t)sizeof(HostCmdHeader)});
+    return bytes;
+}
+
+template <class Args>
+std::string ToBinary(const Args& args)
+{
+    std::string bytes = ToBinary(Args::ForCmd);
+    AppendArgs(bytes, args);
+    return bytes;
+}
+
+// A command in either form, its Args are left in the same form.
+inline HRESULT Parse(std::string_view msg, PayloadType payload, HostCmdMsg& cmd) noexcept
+try
+{
+    if (payload == PayloadType::Json)
+    {
+        json::parse(msg).get_to(cmd);
+        return S_OK;
+    }
+
+    HostCmdHeader header;
+    RETURN_IF_FAILED(detail::Read(msg, header));
+    RETURN_HR_IF(E_INVALIDARG,
+        !header.Version || header.HeaderSize < sizeof(header) || header.HeaderSize > msg.size());
+
+    cmd.Cmd = (HostCmdMsg::Cmd)header.Cmd;
+    cmd.Args.assign(msg.substr(header.HeaderSize));
+    return S_OK;
+}
+CATCH_RETURN()
+
+inline HRESULT Parse(std::string_view bytes, PayloadType payload, HostCtrlModuleArgs& args) noexcept
+try
+{
+    if (payload == PayloadType::Json)
+    {
+        json::parse(bytes).get_to(args);
+        return S_OK;
+    }
+
+    HostCtrlModuleWire wire;
+    RETURN_IF_FAILED(detail::Read(bytes, wire));
+    RETURN_HR_IF(E_INVALIDARG, wire.ModuleSize > bytes.size() - sizeof(wire));
+
+    args.Cmd = (HostCtrlModuleArgs::Cmd)wire.Cmd;
+    args.Module.assign(bytes.substr(sizeof(wire), wire.ModuleSize));
+    return S_OK;
+}
+CATCH_RETURN()
+
+inline HRESULT Parse(std::string_view bytes, PayloadType payload, HostCreditArgs& args) noexcept
+try
+{
+    if (payload == PayloadType::Json)
+    {
+        json::parse(bytes).get_to(args);
+        return S_OK;
+    }
+
+    HostCreditWire wire;
+    RETURN_IF_FAILED(detail::Read(bytes, wire));
+    args.Bytes = (size_t)wire.Bytes;
+    return S_OK;
+}
+CATCH_RETURN()
+
+// Ids the broker assigned to services, sent to a host before it receives the first frame carrying one of them.
+struct ServiceIdsMsg
+{
+    // Id of the first service, the others follow in order.
+    ServiceId         First;
+    std::vector<Guid> Services;
+};
+
+inline void to_json(json& j, const ServiceIdsMsg& msg)
+{
+    j = json {{"First", msg.First}, {"Services", json::array()}};
+    for (const auto& service : msg.Services)
+        j["Services"].push_back(service.ToUtf8());
+}
+
+inline void from_json(const json& j, ServiceIdsMsg& msg)
+{
+    j.at("First").get_to(msg.First);
+    for (const auto& service : j.at("Services"))
+        msg.Services.emplace_back(std::string_view(service.get_ref<const json::string_t&>()));
+}
+
 }
@@ -0,0 +1,306 @@
+#include "pch.h"
+#include <array>
+#include <cstring>
+#include "JsonPeek.h"
+
+namespace ipc
+{
+namespace
+{
+// Characters a scan over a container needs to stop at, anything else is skipped.
+constexpr std::array<bool, 256> Structural = [] {
+    std::array<bool, 256> structural {};
+    for (const unsigned char c : std::string_view("\"{}[]"))
+        structural[c] = true;
+    return structural;
+}();
+
+bool IsSpace(char c) noexcept
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+const char* SkipSpace(const char* p, const char* end) noexcept
+{
+    while (p != end && IsSpace(*p))
+        ++p;
+    return p;
+}
+
+// Past the closing quote of the string opened at p, nullptr if it isn't terminated.
+const char* SkipString(const char* p, const char* end) noexcept
+{
+    const char* content = ++p;
+    for (;;)
+    {
+        const auto quote = (const char*)memchr(p, '"', (size_t)(end - p));
+        if (!quote)
+            return nullptr;
+
+        // Escaped by an odd number of backslashes in front of it.
+        size_t backslashes = 0;
+        while (quote - backslashes > content && quote[-1 - (ptrdiff_t)backslashes] == '\\')
+            ++backslashes;
+        if (backslashes % 2 == 0)
+            return quote + 1;
+        p = quote + 1;
+    }
+}
+
+// Past the object or array opened at p, nullptr if it isn't closed. Brackets aren't checked to match in kind.
+const char* SkipContainer(const char* p, const char* end) noexcept
+{
+    size_t depth = 0;
+    while (p != end)
+    {
+        if (!Structural[(unsigned char)*p])
+        {
+            ++p;
+            continue;
+        }
+
+        switch (*p)
+        {
+            case '"':
+                p = SkipString(p, end);
+                if (!p)
+                    return nullptr;
+                continue;
+            case '{':
+            case '[':
+                ++depth;
+                break;
+            default:
+                if (--depth == 0)
+                    return p + 1;
+        }
+        ++p;
+    }
+    return nullptr;
+}
+
+// The value of the 4 hex digits at p, -1 if they aren't.
+int32_t Hex4(const char* p) noexcept
+{
+    int32_t value = 0;
+    for (size_t n = 0; n < 4; ++n)
+    {
+        const char c = p[n];
+        value <<= 4;
+        if (c >= '0' && c <= '9')
+            value |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            value |= c - 'A' + 10;
+        else
+            return -1;
+    }
+    return value;
+}
+
+// Whether name, the raw content of a key, is key once its escapes are decoded to UTF-8. Fails for invalid escapes.
+HRESULT MatchKey(std::string_view name, std::string_view key, bool& match) noexcept
+{
+    match = false;
+    if (name.find('\\') == std::string_view::npos)
+    {
+        match = name == key;
+        return S_OK;
+    }
+
+    size_t k = 0;
+    for (size_t n = 0; n < name.size();)
+    {
+        char   decoded[4] = {name[n++]};
+        size_t size       = 1;
+        if (decoded[0] == '\\')
+        {
+            RETURN_HR_IF_EXPECTED(E_INVALIDARG, n == name.size());
+            switch (name[n++])
+            {
+                case '"':
+                case '\\':
+                case '/':
+                    decoded[0] = name[n - 1];
+                    break;
+                case 'b':
+                    decoded[0] = '\b';
+                    break;
+                case 'f':
+                    decoded[0] = '\f';
+                    break;
+                case 'n':
+                    decoded[0] = '\n';
+                    break;
+                case 'r':
+                    decoded[0] = '\r';
+                    break;
+                case 't':
+                    decoded[0] = '\t';
+                    break;
+                case 'u':
+                {
+                    RETURN_HR_IF_EXPECTED(E_INVALIDARG, name.size() - n < 4);
+                    int32_t code = Hex4(name.data() + n);
+                    RETURN_HR_IF_EXPECTED(E_INVALIDARG, code < 0 || (code >= 0xDC00 && code < 0xE000));
+                    n += 4;
+                    if (code >= 0xD800 && code < 0xDC00)
+                    {
+                        // A surrogate pair, the low one has to follow right away.
+                        RETURN_HR_IF_EXPECTED(
+                            E_INVALIDARG, name.size() - n < 6 || name[n] != '\\' || name[n + 1] != 'u');
+                        const int32_t low = Hex4(name.data() + n + 2);
+                        RETURN_HR_IF_EXPECTED(E_INVALIDARG, low < 0xDC00 || low >= 0xE000);
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        n += 6;
+                    }
+
+                    if (code < 0x80)
+                    {
+                        decoded[0] = (char)code;
+                    }
+                    else if (code < 0x800)
+                    {
+                        decoded[0] = (char)(0xC0 | code >> 6);
+                        decoded[1] = (char)(0x80 | (code & 0x3F));
+                        size       = 2;
+                    }
+                    else if (code < 0x10000)
+                    {
+                        decoded[0] = (char)(0xE0 | code >> 12);
+                        decoded[1] = (char)(0x80 | (code >> 6 & 0x3F));
+                        decoded[2] = (char)(0x80 | (code & 0x3F));
+                        size       = 3;
+                    }
+                    else
+                    {
+                        decoded[0] = (char)(0xF0 | code >> 18);
+                        decoded[1] = (char)(0x80 | (code >> 12 & 0x3F));
+                        decoded[2] = (char)(0x80 | (code >> 6 & 0x3F));
+                        decoded[3] = (char)(0x80 | (code & 0x3F));
+                        size       = 4;
+                    }
+                    break;
+                }
+                default:
+                    return E_INVALIDARG;
+            }
+        }
+
+        // Decoded all the same, a later escape may be invalid.
+        if (k != SIZE_MAX && key.substr(k, size) == std::string_view(decoded, size))
+            k += size;
+        else
+            k = SIZE_MAX;
+    }
+    match = k == key.size();
+    return S_OK;
+}
+
+// Whether only whitespace follows p.
+bool AtEnd(const char* p, const char* end) noexcept
+{
+    return SkipSpace(p, end) == end;
+}
+
+// Past the value starting at p, nullptr if it's malformed.
+const char* SkipValue(const char* p, const char* end) noexcept
+{
+    if (p == end)
+        return nullptr;
+    if (*p == '"')
+        return SkipString(p, end);
+    if (*p == '{' || *p == '[')
+        return SkipContainer(p, end);
+
+    // A number, true, false or null.
+    const char* start = p;
+    while (p != end && !IsSpace(*p) && *p != ',' && *p != '}' && *p != ']')
+        ++p;
+    return p != start ? p : nullptr;
+}
+}
+
+HRESULT PeekJson(std::string_view json, std::string_view key, std::string_view& value) noexcept
+{
+    value = {};
+
+    const char* p   = json.data();
+    const char* end = p + json.size();
+
+    p = SkipSpace(p, end);
+    RETURN_HR_IF_EXPECTED(E_INVALIDARG, p == end || *p != '{');
+    p = SkipSpace(p + 1, end);
+    if (p != end && *p == '}')
+    {
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, !AtEnd(p + 1, end));
+        return S_OK;
+    }
+
+    // To the end even once found, a duplicate key later on counts instead.
+    std::string_view found;
+    for (;;)
+    {
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, p == end || *p != '"');
+        const char* keyEnd = SkipString(p, end);
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, !keyEnd);
+        const std::string_view name(p + 1, (size_t)(keyEnd - p - 2));
+
+        p = SkipSpace(keyEnd, end);
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, p == end || *p != ':');
+        p = SkipSpace(p + 1, end);
+
+        const char* valueEnd = SkipValue(p, end);
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, !valueEnd);
+        bool match = false;
+        RETURN_IF_FAILED_EXPECTED(MatchKey(name, key, match));
+        if (match)
+            found = std::string_view(p, (size_t)(valueEnd - p));
+
+        p = SkipSpace(valueEnd, end);
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, p == end);
+        if (*p == '}')
+        {
+            RETURN_HR_IF_EXPECTED(E_INVALIDARG, !AtEnd(p + 1, end));
+            value = found;
+            return S_OK;
+        }
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, *p != ',');
+        p = SkipSpace(p + 1, end);
+    }
+}
+
+HRESULT PeekStrings(std::string_view array, std::vector<std::string_view>& strings) noexcept
+try
+{
+    strings.clear();
+
+    const char* p   = array.data();
+    const char* end = p + array.size();
+
+    p = SkipSpace(p, end);
+    RETURN_HR_IF_EXPECTED(E_INVALIDARG, p == end || *p != '[');
+    p = SkipSpace(p + 1, end);
+    if (p != end && *p == ']')
+        return S_OK;
+
+    for (;;)
+    {
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, p == end || *p != '"');
+        const char* stringEnd = SkipString(p, end);
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, !stringEnd);
+        const std::string_view string(p + 1, (size_t)(stringEnd - p - 2));
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, string.find('\\') != std::string_view::npos);
+        strings.push_back(string);
+
+        p = SkipSpace(stringEnd, end);
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, p == end);
+        if (*p == ']')
+            return S_OK;
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, *p != ',');
+        p = SkipSpace(p + 1, end);
+    }
+}
+CATCH_RETURN()
+}
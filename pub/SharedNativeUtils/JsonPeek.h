@@ -0,0 +1,21 @@
+#pragma once
+#include "platform.h"
+#include <string_view>
+#include <vector>
+
+namespace ipc
+{
+// Answers questions about the top level of a JSON object without building a DOM, for routing decisions which only
+// need to look at a key or two of a msg. Values are skipped over structurally, strings with memchr, so a msg costs a
+// single pass over its bytes. Parse the msg as a whole if the answer calls for it.
+// Answers as json::parse() would: escaped keys are compared decoded and of duplicate keys the last one counts.
+
+// The raw text of the value of a top level key, e.g. [1, 2] for "a" within {"a": [1, 2]}. Empty if the key is
+// missing. Fails if json isn't an object or is malformed structurally, i.e. in anything but the contents of strings
+// and the spelling of numbers and literals.
+HRESULT PeekJson(std::string_view json, std::string_view key, std::string_view& value) noexcept;
+
+// The strings of a raw JSON array of strings, as returned by PeekJson(). Fails for other values and strings having
+// escapes, which these would need to be decoded for.
+HRESULT PeekStrings(std::string_view array, std::vector<std::string_view>& strings) noexcept;
+}
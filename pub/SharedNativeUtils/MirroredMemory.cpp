@@ -0,0 +1,168 @@
+#include "pch.h"
+#include "MirroredMemory.h"
+#ifndef _WIN32
+#    include <sys/mman.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+namespace ipc
+{
+size_t MirrorGranularity() noexcept
+{
+#ifdef _WIN32
+    SYSTEM_INFO si {};
+    ::GetSystemInfo(&si);
+    return si.dwAllocationGranularity;
+#else
+    return (size_t)::sysconf(_SC_PAGESIZE);
+#endif
+}
+
+size_t MirrorAlign(size_t size) noexcept
+{
+    const size_t granularity = MirrorGranularity();
+    return (size + granularity - 1) / granularity * granularity;
+}
+
+HRESULT CreateSection(size_t size, bool inheritable, Handle& section) noexcept
+{
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES sa {sizeof(SECURITY_ATTRIBUTES), nullptr, inheritable};
+
+    section = ::CreateFileMappingW(
+        INVALID_HANDLE_VALUE, &sa, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, nullptr);
+    RETURN_LAST_ERROR_IF_NULL(section);
+    return S_OK;
+#else
+#    ifdef __linux__
+    int fd = ::memfd_create("tm-section", inheritable ? 0 : MFD_CLOEXEC);
+#    else
+    char name[32];
+    snprintf(name, sizeof(name), "/tm-section-%d", (int)::getpid());
+    int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        (void)::shm_unlink(name);
+    if (fd >= 0 && !inheritable)
+        (void)::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#    endif
+    RETURN_LAST_ERROR_IF(fd < 0);
+
+    if (::ftruncate(fd, (off_t)size) != 0)
+    {
+        const int err = errno;
+        ::close(fd);
+        RETURN_HR(HRESULT_FROM_ERRNO(err));
+    }
+    section = fd;
+    return S_OK;
+#endif
+}
+
+void CloseSection(Handle section) noexcept
+{
+    if (section == InvalidHandle)
+        return;
+#ifdef _WIN32
+    ::CloseHandle(section);
+#else
+    ::close(section);
+#endif
+}
+
+HRESULT SectionView::Map(Handle section, uint64_t offset, size_t size) noexcept
+{
+    Unmap();
+
+#ifdef _WIN32
+    base_ = (uint8_t*)::MapViewOfFile(section, FILE_MAP_ALL_ACCESS, (DWORD)(offset >> 32), (DWORD)offset, size);
+    RETURN_LAST_ERROR_IF_NULL(base_);
+#else
+    auto base = (uint8_t*)::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, section, (off_t)offset);
+    RETURN_LAST_ERROR_IF(base == MAP_FAILED);
+    base_ = base;
+#endif
+    size_ = size;
+    return S_OK;
+}
+
+void SectionView::Unmap() noexcept
+{
+    if (!base_)
+        return;
+
+#ifdef _WIN32
+    ::UnmapViewOfFile(base_);
+#else
+    ::munmap(base_, size_);
+#endif
+    base_ = nullptr;
+    size_ = 0;
+}
+
+HRESULT MirroredView::Map(Handle section, uint64_t offset, size_t size) noexcept
+{
+    Unmap();
+
+#ifdef _WIN32
+    const DWORD offsetHigh = (DWORD)(offset >> 32), offsetLow = (DWORD)offset;
+
+    // W/o VirtualAlloc2 placeholders there's no atomic way to reserve an address range and map into it.
+    // So probe for a free range and retry in the unlikely case another thread grabbed it in between.
+    for (int attempt = 0; attempt < 16; ++attempt)
+    {
+        auto probe = (uint8_t*)::VirtualAlloc(nullptr, 2 * size, MEM_RESERVE, PAGE_NOACCESS);
+        RETURN_LAST_ERROR_IF_NULL(probe);
+        ::VirtualFree(probe, 0, MEM_RELEASE);
+
+        auto first = (uint8_t*)::MapViewOfFileEx(section, FILE_MAP_ALL_ACCESS, offsetHigh, offsetLow, size, probe);
+        if (!first)
+            continue;
+
+        auto second =
+            (uint8_t*)::MapViewOfFileEx(section, FILE_MAP_ALL_ACCESS, offsetHigh, offsetLow, size, probe + size);
+        if (second)
+        {
+            base_ = first;
+            size_ = size;
+            return S_OK;
+        }
+        ::UnmapViewOfFile(first);
+    }
+
+    RETURN_HR_MSG(E_OUTOFMEMORY, "Failed to map mirrored view of %zu bytes", size);
+#else
+    // Reserve twice the size and map the same memory into both halves.
+    auto base = (uint8_t*)::mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    RETURN_LAST_ERROR_IF(base == MAP_FAILED);
+
+    if (::mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, section, (off_t)offset) == MAP_FAILED ||
+        ::mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, section, (off_t)offset) ==
+            MAP_FAILED)
+    {
+        const int err = errno;
+        ::munmap(base, 2 * size);
+        RETURN_HR(HRESULT_FROM_ERRNO(err));
+    }
+
+    base_ = base;
+    size_ = size;
+    return S_OK;
+#endif
+}
+
+void MirroredView::Unmap() noexcept
+{
+    if (!base_)
+        return;
+
+#ifdef _WIN32
+    ::UnmapViewOfFile(base_ + size_);
+    ::UnmapViewOfFile(base_);
+#else
+    ::munmap(base_, 2 * size_);
+#endif
+    base_ = nullptr;
+    size_ = 0;
+}
+}
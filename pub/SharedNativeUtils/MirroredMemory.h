@@ -0,0 +1,76 @@
+#pragma once
+#include "platform.h"
+#include <cstdint>
+#include "ipc.h"
+
+namespace ipc
+{
+// Granularity of section sizes and offsets which can be mapped by MirroredView.
+size_t MirrorGranularity() noexcept;
+
+// Rounds size up to MirrorGranularity().
+size_t MirrorAlign(size_t size) noexcept;
+
+// Creates an anonymous memory section (file mapping on Windows, memfd on Linux).
+// An inheritable section is passed to child processes by handle inheritance.
+HRESULT CreateSection(size_t size, bool inheritable, Handle& section) noexcept;
+
+void CloseSection(Handle section) noexcept;
+
+// Maps a range of a section once. Offset needs to be a multiple of MirrorGranularity().
+class SectionView final
+{
+public:
+    SectionView() = default;
+    ~SectionView()
+    {
+        Unmap();
+    }
+
+    SectionView(const SectionView&)            = delete;
+    SectionView& operator=(const SectionView&) = delete;
+
+    HRESULT Map(Handle section, uint64_t offset, size_t size) noexcept;
+    void    Unmap() noexcept;
+
+    uint8_t* Data() const
+    {
+        return base_;
+    }
+
+private:
+    uint8_t* base_ = nullptr;
+    size_t   size_ = 0;
+};
+
+// Maps size bytes of a section twice back-to-back, so accessing up to size bytes starting at any offset
+// within [Data(), Data() + size) is contiguous. Offset and size need to be multiples of MirrorGranularity().
+class MirroredView final
+{
+public:
+    MirroredView() = default;
+    ~MirroredView()
+    {
+        Unmap();
+    }
+
+    MirroredView(const MirroredView&)            = delete;
+    MirroredView& operator=(const MirroredView&) = delete;
+
+    HRESULT Map(Handle section, uint64_t offset, size_t size) noexcept;
+    void    Unmap() noexcept;
+
+    uint8_t* Data() const
+    {
+        return base_;
+    }
+    size_t Size() const
+    {
+        return size_;
+    }
+
+private:
+    uint8_t* base_ = nullptr;
+    size_t   size_ = 0;
+};
+}
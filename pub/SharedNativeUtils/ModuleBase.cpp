@@ -49,6 +49,12 @@ try
 }
 CATCH_RETURN()
 
+HRESULT ModuleBase::InitFlowControl(ipc::TrySendMsg trySendMsg) noexcept
+{
+    trySendMsg_ = trySendMsg;
+    return S_OK;
+}
+
 HRESULT ModuleBase::Terminate() noexcept
 try
 {
@@ -68,10 +74,37 @@ try
 }
 CATCH_RETURN()
 
-HRESULT ModuleBase::SendMsg(std::string_view msg, const ipc::Target& target) noexcept
+HRESULT ModuleBase::HandleMessages(const ipc::MsgSpan* msgs, DWORD count) noexcept
+{
+    HRESULT result = S_OK;
+    for (DWORD i = 0; i < count; ++i)
+    {
+        const HRESULT hr = HandleMessage(std::string_view(msgs[i].Msg, msgs[i].Size), *msgs[i].Target);
+        if (FAILED(hr) && SUCCEEDED(result))
+            result = hr;
+    }
+    return result;
+}
+
+HRESULT ModuleBase::HandleChunk(std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) noexcept
+try
+{
+    if (!services_.contains(target.Service))
+        return S_FALSE;
+
+    return OnMessageChunk(bytes, offset, total, target);
+}
+CATCH_RETURN()
+
+HRESULT ModuleBase::SendMsg(std::string_view msg, const ipc::Target& target, bool wait) noexcept
 try
 {
     RETURN_HR_IF_NULL(E_FAIL, sendMsg_);
+    if (!wait && trySendMsg_)
+    {
+        RETURN_IF_FAILED_EXPECTED(trySendMsg_(mod_, msg.data(), &target.Service, target.Session));
+        return S_OK;
+    }
     RETURN_IF_FAILED(sendMsg_(mod_, msg.data(), &target.Service, target.Session));
     return S_OK;
 }
@@ -22,8 +22,16 @@ public:
     }
 
     HRESULT Initialize(void* mod, ipc::SendMsg sendMsg, ipc::SendDiag sendDiag) noexcept;
+    // For modules exporting InitFlowControl, called before Initialize().
+    HRESULT InitFlowControl(ipc::TrySendMsg trySendMsg) noexcept;
     HRESULT Terminate() noexcept;
     HRESULT HandleMessage(std::string_view msg, const ipc::Target& target) noexcept;
+    // For modules exporting OnMessages: several messages at once, each handed to OnMessage() in turn.
+    // Fails with the first message failing, after all were handled.
+    HRESULT HandleMessages(const ipc::MsgSpan* msgs, DWORD count) noexcept;
+    // For modules exporting OnMessageChunk: chunk of a large message, bytes belong at offset within the total message.
+    // Once OnMessageChunk() returned S_OK for the last chunk, the message isn't handed to OnMessage() anymore.
+    HRESULT HandleChunk(std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) noexcept;
 
     static std::filesystem::path PathFor(std::wstring_view moduleName, bool bitnessSpecific);
 
@@ -43,13 +51,23 @@ protected:
         return S_OK;
     }
 
-    HRESULT SendMsg(std::string_view msg, const ipc::Target& target) noexcept;
+    // S_FALSE to get the message as a whole instead.
+    virtual HRESULT OnMessageChunk(
+        std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) noexcept
+    {
+        return S_FALSE;
+    }
+
+    // Waits while the host has no credit to send, unless wait is false: it then fails with E_PENDING, which a module
+    // should take as its recipients being behind. Hosts not offering that wait regardless.
+    HRESULT SendMsg(std::string_view msg, const ipc::Target& target, bool wait = true) noexcept;
     HRESULT SendDiag(std::string_view msg) noexcept;
 
 private:
-    void*         mod_      = nullptr;
-    ipc::SendMsg  sendMsg_  = nullptr;
-    ipc::SendDiag sendDiag_ = nullptr;
+    void*           mod_        = nullptr;
+    ipc::SendMsg    sendMsg_    = nullptr;
+    ipc::TrySendMsg trySendMsg_ = nullptr;
+    ipc::SendDiag   sendDiag_   = nullptr;
 
     std::unordered_set<Guid, absl::Hash<Guid>> services_;
 };
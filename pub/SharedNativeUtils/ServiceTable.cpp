@@ -0,0 +1,79 @@
+#include "pch.h"
+#include <mutex>
+#include "ServiceTable.h"
+
+namespace ipc
+{
+ServiceTable::ServiceTable()
+{
+    std::scoped_lock lock(lock_);
+    for (const Guid* service : KnownServiceId::Guids)
+        Append(*service);
+}
+
+ServiceId ServiceTable::Resolve(const Guid& service) const noexcept
+{
+    std::shared_lock lock(lock_);
+    auto             id = ids_.find(service);
+    return id != ids_.end() ? id->second : KnownServiceId::Unresolved;
+}
+
+ServiceId ServiceTable::Intern(const Guid& service)
+{
+    if (const ServiceId id = Resolve(service); id != KnownServiceId::Unresolved)
+        return id;
+
+    std::scoped_lock lock(lock_);
+    // Someone else may have been faster.
+    if (auto id = ids_.find(service); id != ids_.end())
+        return id->second;
+
+    return Append(service);
+}
+
+HRESULT ServiceTable::Learn(ServiceId first, const std::vector<Guid>& services) noexcept
+try
+{
+    std::scoped_lock lock(lock_);
+    RETURN_HR_IF(E_INVALIDARG, first > Count());
+
+    for (size_t i = Count() - first; i < services.size(); ++i)
+        Append(services[i]);
+
+    return S_OK;
+}
+CATCH_RETURN();
+
+std::vector<Guid> ServiceTable::Range(ServiceId first, ServiceId last) const
+{
+    std::vector<Guid> services;
+    last = std::min(last, Count());
+    for (ServiceId id = first; id < last; ++id)
+        services.push_back(*Lookup(id));
+    return services;
+}
+
+ServiceId ServiceTable::Append(const Guid& service)
+{
+    const ServiceId id = count_.load(std::memory_order_relaxed);
+    THROW_HR_IF(E_OUTOFMEMORY, id >= ChunkSize * MaxChunks);
+
+    auto& chunk = chunks_[id >> ChunkBits];
+    if (!chunk)
+        chunk = std::make_unique<Guid[]>(ChunkSize);
+
+    chunk[id & (ChunkSize - 1)] = service;
+    ids_.emplace(service, id);
+
+    // Publishes the entry to lock free readers.
+    count_.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+ServiceTable& Services()
+{
+    // Never freed, detached reader threads may still decode frames while the process exits.
+    static ServiceTable* services = new ServiceTable();
+    return *services;
+}
+}
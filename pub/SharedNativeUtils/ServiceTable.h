@@ -0,0 +1,72 @@
+#pragma once
+#include "platform.h"
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <vector>
+#include <absl/container/flat_hash_map.h>
+#include "guid.h"
+#include "ipc.h"
+
+namespace ipc
+{
+// Maps service GUIDs to compact ids and back, so frames and routing tables use small integers instead of GUIDs.
+// The broker assigns ids as services are announced, hosts learn them from ServiceIdsMsg before they receive a frame
+// carrying one. Ids are dense and never reused, so id to GUID is a plain array lookup without any lock.
+class ServiceTable final
+{
+public:
+    // Registers the KnownService GUIDs with their KnownServiceId.
+    ServiceTable();
+
+    ServiceTable(const ServiceTable&)            = delete;
+    ServiceTable& operator=(const ServiceTable&) = delete;
+
+    // KnownServiceId::Unresolved if service has no id (yet).
+    ServiceId Resolve(const Guid& service) const noexcept;
+
+    // nullptr if id is unknown.
+    const Guid* Lookup(ServiceId id) const noexcept
+    {
+        if (id >= Count())
+            return nullptr;
+
+        return &chunks_[id >> ChunkBits][id & (ChunkSize - 1)];
+    }
+
+    // Broker side: returns the id of service, assigning the next free one if it has none yet.
+    ServiceId Intern(const Guid& service);
+
+    // Host side: takes over ids first, first + 1... as assigned by the broker.
+    // Ids already known are skipped, a gap to the ids known so far fails.
+    HRESULT Learn(ServiceId first, const std::vector<Guid>& services) noexcept;
+
+    // All ids below are known.
+    ServiceId Count() const noexcept
+    {
+        return count_.load(std::memory_order_acquire);
+    }
+
+    // Services with ids from first up to last (exclusive).
+    std::vector<Guid> Range(ServiceId first, ServiceId last) const;
+
+private:
+    static const size_t ChunkBits = 10;
+    static const size_t ChunkSize = size_t(1) << ChunkBits;
+    static const size_t MaxChunks = 1024;
+
+    // Call with lock_ held exclusively.
+    ServiceId Append(const Guid& service);
+
+    // Chunks are never moved or freed, so readers may access any entry below count_ without locking.
+    std::unique_ptr<Guid[]> chunks_[MaxChunks];
+    std::atomic<ServiceId>  count_ {0};
+
+    // Guards ids_ and appending.
+    mutable std::shared_mutex                              lock_;
+    absl::flat_hash_map<Guid, ServiceId, absl::Hash<Guid>> ids_;
+};
+
+// The table of the current process.
+ServiceTable& Services();
+}
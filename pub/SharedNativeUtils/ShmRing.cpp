@@ -0,0 +1,412 @@
+#include "pch.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include "ShmRing.h"
+#include "Compression.h"
+#ifdef _WIN32
+#    include <format>
+#    include "TMProcess.h"
+#else
+#    include <climits>
+#    include <ctime>
+#    include <pthread.h>
+#    include <unistd.h>
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+#endif
+
+namespace ipc
+{
+namespace
+{
+const uint32_t ChannelMagic   = 0x52534D54; // "TMSR"
+const uint32_t ChannelVersion = 1;
+
+// Control block at the start of a channel section, followed by the data of both rings.
+struct ShmChannelControl
+{
+    uint32_t       Magic;
+    uint32_t       Version;
+    uint64_t       Capacity;
+    ShmRingControl Rings[2];
+};
+
+// Upper bound of a single wait, so a reader/writer notices a stop request even if nobody rings.
+const DWORD PollIntervalMs = 500;
+
+void Wait(Doorbell& bell, Handle event, uint32_t seq) noexcept
+{
+#ifdef _WIN32
+    (void)seq;
+    ::WaitForSingleObject(event, PollIntervalMs);
+#else
+    (void)event;
+    timespec timeout {PollIntervalMs / 1000, (long)(PollIntervalMs % 1000) * 1000000};
+    // Not FUTEX_PRIVATE_FLAG, the futex word is shared with another process.
+    (void)::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&bell.Seq), FUTEX_WAIT, seq, &timeout, nullptr, 0);
+#endif
+}
+
+void Wake(Doorbell& bell, Handle event) noexcept
+{
+    bell.Seq.fetch_add(1, std::memory_order_release);
+#ifdef _WIN32
+    ::SetEvent(event);
+#else
+    (void)event;
+    (void)::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&bell.Seq), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+// Sleeps until stillBlocked() turns false (or for a poll interval).
+// The Waiting flag is raised before re-checking, so a peer changing state right after the check will ring.
+template <typename F>
+void WaitUntil(Doorbell& bell, Handle event, F stillBlocked) noexcept
+{
+    const uint32_t seq = bell.Seq.load(std::memory_order_acquire);
+    bell.Waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (stillBlocked())
+        Wait(bell, event, seq);
+
+    bell.Waiting.store(0, std::memory_order_relaxed);
+}
+
+void Ring(Doorbell& bell, Handle event) noexcept
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (bell.Waiting.load(std::memory_order_relaxed) && bell.Waiting.exchange(0, std::memory_order_relaxed))
+        Wake(bell, event);
+}
+
+void SetReaderThreadName(DWORD pid)
+{
+#ifdef _WIN32
+    Process::SetThreadName(std::format(L"TM-ShmReader-{}", pid).c_str());
+#else
+    char name[16];
+    snprintf(name, sizeof(name), "TM-Shm-%u", pid);
+    (void)::pthread_setname_np(::pthread_self(), name);
+#endif
+}
+
+void CloseEvent(Handle& event) noexcept
+{
+#ifdef _WIN32
+    if (event != InvalidHandle)
+        ::CloseHandle(event);
+#endif
+    event = InvalidHandle;
+}
+}
+
+#pragma region ShmRing
+void ShmRing::Attach(
+    ShmRingControl* control, uint8_t* data, size_t capacity, Handle dataEvent, Handle spaceEvent) noexcept
+{
+    control_    = control;
+    data_       = data;
+    capacity_   = capacity;
+    dataEvent_  = dataEvent;
+    spaceEvent_ = spaceEvent;
+    tail_       = control_->Tail.load(std::memory_order_relaxed);
+}
+
+HRESULT ShmRing::Write(const void* data, size_t size) noexcept
+{
+    auto src = (const uint8_t*)data;
+    while (size > 0)
+    {
+        RETURN_HR_IF(E_NOT_VALID_STATE, control_->Closed.load(std::memory_order_relaxed));
+
+        const uint64_t head = control_->Head.load(std::memory_order_acquire);
+        const size_t   free = capacity_ - (size_t)(tail_ - head);
+        if (free == 0)
+        {
+            // Let the consumer drain what we've written so far.
+            Publish();
+            WaitUntil(control_->SpaceAvailable, spaceEvent_, [&] {
+                return control_->Head.load(std::memory_order_acquire) == head &&
+                       !control_->Closed.load(std::memory_order_relaxed);
+            });
+            continue;
+        }
+
+        // Thanks to the mirrored mapping up to capacity bytes are contiguous from any offset.
+        const size_t count = std::min(free, size);
+        memcpy(data_ + (tail_ % capacity_), src, count);
+        tail_ += count;
+        src += count;
+        size -= count;
+    }
+    return S_OK;
+}
+
+void ShmRing::Publish() noexcept
+{
+    control_->Tail.store(tail_, std::memory_order_release);
+    Ring(control_->DataAvailable, dataEvent_);
+}
+
+HRESULT ShmRing::Read(std::stop_token stoken, const OnMessage& onMessage) noexcept
+try
+{
+    uint64_t head = control_->Head.load(std::memory_order_relaxed);
+
+    while (!stoken.stop_requested())
+    {
+        const uint64_t tail = control_->Tail.load(std::memory_order_acquire);
+        if (tail == head)
+        {
+            // Drain everything before honoring a close.
+            if (control_->Closed.load(std::memory_order_relaxed))
+                return S_FALSE;
+
+            WaitUntil(control_->DataAvailable, dataEvent_, [&] {
+                return control_->Tail.load(std::memory_order_acquire) == head &&
+                       !control_->Closed.load(std::memory_order_relaxed);
+            });
+            continue;
+        }
+
+        // Control frames go first, unless the ring continues a frame larger than itself.
+        bool stop = oversized_.empty() &&
+                    reassembler_.DispatchControl(data_ + (head % capacity_), (size_t)(tail - head), onMessage);
+        while (head != tail && !stop)
+        {
+            const uint8_t* data      = data_ + (head % capacity_);
+            const size_t   available = (size_t)(tail - head);
+
+            if (!oversized_.empty())
+            {
+                // Continue assembling a frame larger than the ring.
+                const size_t count = std::min(available, oversized_.size() - oversizedHave_);
+                memcpy(oversized_.data() + oversizedHave_, data, count);
+                oversizedHave_ += count;
+                head += count;
+
+                if (oversizedHave_ == oversized_.size())
+                {
+                    stop = reassembler_.Dispatch(oversized_.data(), oversized_.size(), onMessage);
+
+                    std::vector<uint8_t>().swap(oversized_);
+                    oversizedHave_ = 0;
+                }
+                continue;
+            }
+
+            size_t     frameSize = 0;
+            const auto status    = PeekFrame(data, available, frameSize);
+            RETURN_HR_IF_MSG(E_UNEXPECTED, status == FrameStatus::Invalid, "Invalid IPC frame in shared memory ring");
+
+            if (status == FrameStatus::Incomplete)
+            {
+                if (frameSize <= capacity_)
+                    break;
+
+                // Can never complete within the ring, so take it out piece by piece.
+                oversized_.resize(frameSize);
+                oversizedHave_ = 0;
+                continue;
+            }
+
+            stop = reassembler_.Dispatch(data, frameSize, onMessage);
+            head += frameSize;
+        }
+
+        // Only now the producer may overwrite what the views handed to onMessage pointed to.
+        control_->Head.store(head, std::memory_order_release);
+        Ring(control_->SpaceAvailable, spaceEvent_);
+
+        if (stop)
+            return S_FALSE;
+    }
+    return S_FALSE;
+}
+CATCH_RETURN();
+
+void ShmRing::Close() noexcept
+{
+    if (!control_)
+        return;
+
+    control_->Closed.store(1, std::memory_order_relaxed);
+    Wake(control_->DataAvailable, dataEvent_);
+    Wake(control_->SpaceAvailable, spaceEvent_);
+}
+#pragma endregion
+
+#pragma region ShmChannel
+ShmChannel::~ShmChannel()
+{
+    Close();
+
+    views_[0].Unmap();
+    views_[1].Unmap();
+    control_.Unmap();
+
+    for (auto& event : events_)
+        CloseEvent(event);
+
+    CloseSection(section_);
+}
+
+HRESULT ShmChannel::Create(size_t capacity) noexcept
+{
+    capacity_ = MirrorAlign(capacity);
+
+    const size_t controlSize = MirrorAlign(sizeof(ShmChannelControl));
+    RETURN_IF_FAILED(CreateSection(controlSize + 2 * capacity_, true, section_));
+
+#ifdef _WIN32
+    SECURITY_ATTRIBUTES sa {sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE};
+    for (auto& event : events_)
+    {
+        event = ::CreateEventW(&sa, FALSE, FALSE, nullptr);
+        RETURN_LAST_ERROR_IF_NULL(event);
+    }
+#endif
+
+    RETURN_IF_FAILED(Map(true));
+    return S_OK;
+}
+
+HRESULT ShmChannel::Open(const Description& desc) noexcept
+{
+    section_  = (Handle)desc.Section;
+    capacity_ = (size_t)desc.Capacity;
+#ifdef _WIN32
+    for (size_t n = 0; n < std::size(events_); ++n)
+        events_[n] = (Handle)desc.Events[n];
+#endif
+
+    RETURN_IF_FAILED(Map(false));
+    return S_OK;
+}
+
+HRESULT ShmChannel::Map(bool creator) noexcept
+{
+    const size_t controlSize = MirrorAlign(sizeof(ShmChannelControl));
+
+    RETURN_IF_FAILED(control_.Map(section_, 0, controlSize));
+    RETURN_IF_FAILED(views_[0].Map(section_, controlSize, capacity_));
+    RETURN_IF_FAILED(views_[1].Map(section_, controlSize + capacity_, capacity_));
+
+    auto control = reinterpret_cast<ShmChannelControl*>(control_.Data());
+    if (creator)
+    {
+        new (control) ShmChannelControl {ChannelMagic, ChannelVersion, capacity_, {}};
+    }
+    else
+    {
+        RETURN_HR_IF_MSG(E_INVALIDARG,
+            control->Magic != ChannelMagic || control->Version != ChannelVersion || control->Capacity != capacity_,
+            "Shared memory channel mismatch");
+    }
+
+    // Ring 0 carries creator->opener, ring 1 the other direction.
+    const int outRing = creator ? 0 : 1;
+    const int inRing  = creator ? 1 : 0;
+
+    out_.Attach(&control->Rings[outRing], views_[outRing].Data(), capacity_, events_[2 * outRing],
+        events_[2 * outRing + 1]);
+    in_.Attach(
+        &control->Rings[inRing], views_[inRing].Data(), capacity_, events_[2 * inRing], events_[2 * inRing + 1]);
+    return S_OK;
+}
+
+ShmChannel::Description ShmChannel::Describe() const noexcept
+{
+    Description desc;
+    desc.Section  = (uint64_t)section_;
+    desc.Capacity = capacity_;
+#ifdef _WIN32
+    for (size_t n = 0; n < std::size(events_); ++n)
+        desc.Events[n] = (uint64_t)events_[n];
+#endif
+    return desc;
+}
+
+std::vector<Handle> ShmChannel::InheritableHandles() const
+{
+    std::vector<Handle> handles {section_};
+#ifdef _WIN32
+    handles.insert(handles.end(), std::begin(events_), std::end(events_));
+#endif
+    return handles;
+}
+
+HRESULT ShmChannel::Send(const std::string_view msg, const Target& target) noexcept
+try
+{
+    RETURN_HR_IF_MSG(E_FAIL, target.Service == KnownService::All, "Can't send IPC msg to 'All'");
+
+    const uint8_t     version = GetFrameVersion();
+    const WirePayload payload(msg, version);
+    const char        zeroTerm = 0;
+
+    // Chunks are written one at a time, frames sent by other threads may go in between.
+    return EncodeFrames(target, payload, version, [&](const EncodedHeader& header, const std::string_view bytes) {
+        std::scoped_lock guard(sendLock_);
+
+        RETURN_IF_FAILED(out_.Write(header.Data(), header.Size()));
+        RETURN_IF_FAILED(out_.Write(bytes.data(), bytes.size()));
+        RETURN_IF_FAILED(out_.Write(&zeroTerm, 1));
+        out_.Publish();
+        return S_OK;
+    });
+}
+CATCH_RETURN();
+
+HRESULT ShmChannel::SendFrame(const Frame& frame) noexcept
+try
+{
+    RETURN_HR_IF_MSG(E_FAIL, frame.Service() == KnownServiceId::All, "Can't send IPC msg to 'All'");
+
+    std::scoped_lock guard(sendLock_);
+
+    RETURN_IF_FAILED(out_.Write(frame.Data(), frame.Size()));
+    out_.Publish();
+
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT ShmChannel::SendDiag(const std::string_view msg) noexcept
+{
+    return pipe_ ? pipe_->SendDiag(msg) : S_FALSE;
+}
+
+HRESULT ShmChannel::StartRead(std::jthread& reader, OnMessage onMessage, DWORD pid) noexcept
+try
+{
+    in_.SetOnChunk(GetOnChunk());
+    reader = std::jthread([self = shared_from_this(), this, onMessage, pid](std::stop_token stoken) {
+        SetReaderThreadName(pid);
+        (void)in_.Read(stoken, onMessage);
+    });
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT ShmChannel::StartReadDiag(std::jthread& reader, OnDiag onDiag, DWORD pid) noexcept
+{
+    return pipe_ ? pipe_->StartReadDiag(reader, onDiag, pid) : S_FALSE;
+}
+
+HRESULT ShmChannel::StartReadDiag(EventLoop& loop, OnDiag onDiag) noexcept
+{
+    return pipe_ ? pipe_->StartReadDiag(loop, onDiag) : S_FALSE;
+}
+
+void ShmChannel::Close() noexcept
+{
+    out_.Close();
+    in_.Close();
+    if (pipe_)
+        pipe_->Close();
+}
+#pragma endregion
+}
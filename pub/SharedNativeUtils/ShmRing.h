@@ -0,0 +1,142 @@
+#pragma once
+#include "platform.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "ipc.h"
+#include "Transport.h"
+#include "FrameReader.h"
+#include "MirroredMemory.h"
+
+namespace ipc
+{
+// Lets one side of a shared memory ring sleep until the other side made progress.
+// Lives in shared memory. The waker only issues a syscall if the sleeper announced it's about to wait,
+// so a busy ring runs without any kernel transitions.
+struct Doorbell
+{
+    std::atomic<uint32_t> Seq;     // futex word on Linux
+    std::atomic<uint32_t> Waiting; // set by the sleeper before it re-checks the ring and waits
+};
+
+// Shared state of a single ring direction.
+struct ShmRingControl
+{
+    alignas(64) std::atomic<uint64_t> Tail; // written by producer only
+    alignas(64) std::atomic<uint64_t> Head; // written by consumer only
+    alignas(64) Doorbell DataAvailable;     // rung by producer
+    alignas(64) Doorbell SpaceAvailable;    // rung by consumer
+    std::atomic<uint32_t> Closed;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters are shared between processes");
+
+// One endpoint of a single-producer/single-consumer byte ring in shared memory.
+// The ring carries frames exactly as written to a pipe by ipc::Send, frames may wrap around the end of the ring
+// as the data is mapped mirrored. Frames larger than the ring are streamed through it in pieces.
+class ShmRing final
+{
+public:
+    void Attach(ShmRingControl* control, uint8_t* data, size_t capacity, Handle dataEvent, Handle spaceEvent) noexcept;
+
+    // Producer: appends bytes, waiting for free space if required.
+    // Bytes are visible to the consumer after the next Publish(), or as soon as the producer had to wait for space.
+    HRESULT Write(const void* data, size_t size) noexcept;
+    void    Publish() noexcept;
+
+    // Consumer: dispatches frames until onMessage requests to stop (S_FALSE), the ring got closed (S_FALSE)
+    // or stop is requested.
+    HRESULT Read(std::stop_token stoken, const OnMessage& onMessage) noexcept;
+
+    // Either side: marks the ring closed and wakes a waiting peer.
+    void Close() noexcept;
+
+    // Consumer: see Reassembler::SetOnChunk(), before Read().
+    void SetOnChunk(OnChunk onChunk)
+    {
+        reassembler_.SetOnChunk(std::move(onChunk));
+    }
+
+private:
+    ShmRingControl* control_    = nullptr;
+    uint8_t*        data_       = nullptr;
+    size_t          capacity_   = 0;
+    Handle          dataEvent_  = InvalidHandle;
+    Handle          spaceEvent_ = InvalidHandle;
+
+    // Producer side
+    uint64_t tail_ = 0;
+
+    // Consumer side, frames larger than the ring are assembled here.
+    std::vector<uint8_t> oversized_;
+    size_t               oversizedHave_ = 0;
+    Reassembler          reassembler_;
+};
+
+// Bidirectional shared memory transport between the broker and a host process.
+// A single section holds a control block and one ring per direction, on Windows each doorbell is backed by an
+// auto-reset event, on Linux by a futex within the control block.
+// The broker creates the channel, the host process inherits section (and events) and attaches to them.
+// The pipes the channel is announced on stay in use for diagnostic output and are closed along with the channel.
+class ShmChannel final : public Transport
+{
+public:
+    // What a host process needs to attach to a channel: inherited handle values and ring capacity.
+    struct Description
+    {
+        uint64_t Section  = 0;
+        uint64_t Capacity = 0;
+        uint64_t Events[4] {};
+    };
+
+    static const size_t DefaultCapacity = 256 * 1024;
+
+    explicit ShmChannel(std::shared_ptr<Transport> pipe) : pipe_(std::move(pipe))
+    {
+    }
+    ~ShmChannel();
+
+    ShmChannel(const ShmChannel&)            = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+    // Broker side: creates an inheritable section and events.
+    HRESULT Create(size_t capacity = DefaultCapacity) noexcept;
+    // Host side: attaches to what the broker created.
+    HRESULT Open(const Description& desc) noexcept;
+
+    Description Describe() const noexcept;
+    // Handles a child process needs to inherit to Open() this channel.
+    std::vector<Handle> InheritableHandles() const;
+
+    HRESULT Send(const std::string_view msg, const Target& target) noexcept override;
+    HRESULT SendFrame(const Frame& frame) noexcept override;
+    HRESULT SendDiag(const std::string_view msg) noexcept override;
+    // Dispatches incoming frames, see ShmRing::Read().
+    HRESULT StartRead(std::jthread& reader, OnMessage onMessage, DWORD pid) noexcept override;
+    HRESULT StartReadDiag(std::jthread& reader, OnDiag onDiag, DWORD pid) noexcept override;
+    // Frames are read by a thread of their own, only the diagnostic pipe can be read by loop.
+    HRESULT StartReadDiag(EventLoop& loop, OnDiag onDiag) noexcept override;
+    // Closes both directions and wakes any waiting reader or writer.
+    void Close() noexcept override;
+
+private:
+    HRESULT Map(bool creator) noexcept;
+
+    Handle section_ = InvalidHandle;
+    Handle events_[4] {InvalidHandle, InvalidHandle, InvalidHandle, InvalidHandle};
+    size_t capacity_ = 0;
+
+    SectionView  control_;
+    MirroredView views_[2];
+    // Ring 0 carries broker->host, ring 1 host->broker.
+    ShmRing    out_;
+    ShmRing    in_;
+    std::mutex sendLock_;
+
+    std::shared_ptr<Transport> pipe_;
+};
+}
@@ -0,0 +1,422 @@
+#include "pch.h"
+#include <cstddef>
+#include <cstring>
+#include "Transport.h"
+#include "FrameReader.h"
+#include "Compression.h"
+#ifdef _WIN32
+#    include <format>
+#    include "TMProcess.h"
+#else
+#    include <fcntl.h>
+#    include <pthread.h>
+#    include <unistd.h>
+#    include <sys/uio.h>
+#endif
+
+namespace ipc
+{
+namespace
+{
+// Frames are written as a gather list of these, so the message itself is never copied into an intermediate buffer.
+struct Segment
+{
+    const void* Data;
+    size_t      Size;
+};
+
+const char ZeroTerm = 0;
+
+#ifdef _WIN32
+// Anonymous pipes don't support WriteFileGather (requires unbuffered overlapped I/O on page sized segments).
+// Small frames are thus coalesced into a stack buffer and written at once, larger frames are written segment by
+// segment. Either way there's no heap allocation and large messages are not copied.
+const size_t CoalesceLimit = 4096;
+
+HRESULT WriteSegments(Handle out, const Segment* segments, size_t count, size_t size) noexcept
+{
+    if (count > 1 && size <= CoalesceLimit)
+    {
+        uint8_t buf[CoalesceLimit];
+        size_t  pos = 0;
+        for (size_t n = 0; n < count; ++n)
+        {
+            memcpy(&buf[pos], segments[n].Data, segments[n].Size);
+            pos += segments[n].Size;
+        }
+
+        DWORD written = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(::WriteFile(out, buf, (DWORD)size, &written, nullptr));
+        RETURN_HR_IF_MSG(E_FAIL, written != (DWORD)size, "ipc::Send failed to send all bytes");
+        return S_OK;
+    }
+
+    for (size_t n = 0; n < count; ++n)
+    {
+        DWORD written = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(::WriteFile(out, segments[n].Data, (DWORD)segments[n].Size, &written, nullptr));
+        RETURN_HR_IF_MSG(E_FAIL, written != (DWORD)segments[n].Size, "ipc::Send failed to send all bytes");
+    }
+    return S_OK;
+}
+
+void CloseStream(Handle handle) noexcept
+{
+    ::CloseHandle(handle);
+}
+
+void SetReaderThreadName(bool diag, DWORD pid)
+{
+    Process::SetThreadName(std::format(diag ? L"TM-DiagReader-{}" : L"TM-IpcReader-{}", pid).c_str());
+}
+#else
+HRESULT WriteSegments(Handle out, const Segment* segments, size_t count, size_t) noexcept
+{
+    iovec  iov[4];
+    size_t iovCount = 0;
+    for (size_t n = 0; n < count && iovCount < std::size(iov); ++n)
+    {
+        iov[iovCount++] = {const_cast<void*>(segments[n].Data), segments[n].Size};
+    }
+
+    // writev() may write partially on pipes/sockets, so continue with whatever is left.
+    iovec* next = iov;
+    while (iovCount > 0)
+    {
+        ssize_t written = ::writev(out, next, (int)iovCount);
+        if (written < 0 && errno == EINTR)
+            continue;
+        RETURN_LAST_ERROR_IF(written <= 0);
+
+        while (iovCount > 0 && (size_t)written >= next->iov_len)
+        {
+            written -= (ssize_t)next->iov_len;
+            ++next;
+            --iovCount;
+        }
+        if (iovCount > 0)
+        {
+            next->iov_base = (uint8_t*)next->iov_base + written;
+            next->iov_len -= (size_t)written;
+        }
+    }
+    return S_OK;
+}
+
+void CloseStream(Handle handle) noexcept
+{
+    ::close(handle);
+}
+
+void SetReaderThreadName(bool diag, DWORD pid)
+{
+    char name[16];
+    snprintf(name, sizeof(name), diag ? "TM-Diag-%u" : "TM-Rd-%u", pid);
+    (void)::pthread_setname_np(::pthread_self(), name);
+}
+#endif
+
+// Frames read by an EventLoop, the stream keeps the transport and thus the handle alive.
+class FrameStream final : public EventLoop::Stream
+{
+public:
+    FrameStream(std::shared_ptr<Transport> transport, OnMessage onMessage, OnChunk onChunk)
+        : transport_(std::move(transport)), onMessage_(std::move(onMessage))
+    {
+        frames_.SetOnChunk(std::move(onChunk));
+    }
+
+    HRESULT Init() noexcept
+    {
+        return frames_.Init();
+    }
+
+    uint8_t* Buffer() override
+    {
+        return frames_.ReadBuffer();
+    }
+    size_t BufferSize() override
+    {
+        return frames_.ReadBufferSize();
+    }
+    bool OnRead(size_t read) override
+    {
+        return frames_.OnRead(read, onMessage_) == S_OK;
+    }
+
+private:
+    std::shared_ptr<Transport> transport_;
+    OnMessage                  onMessage_;
+    FrameReader                frames_;
+};
+
+class DiagStream final : public EventLoop::Stream
+{
+public:
+    DiagStream(std::shared_ptr<Transport> transport, OnDiag onDiag)
+        : transport_(std::move(transport)), onDiag_(std::move(onDiag))
+    {
+    }
+
+    uint8_t* Buffer() override
+    {
+        return buf_;
+    }
+    size_t BufferSize() override
+    {
+        return sizeof(buf_);
+    }
+    bool OnRead(size_t read) override
+    {
+        onDiag_(std::string_view((const char*)buf_, read));
+        return true;
+    }
+
+private:
+    std::shared_ptr<Transport> transport_;
+    OnDiag                     onDiag_;
+    uint8_t                    buf_[4096];
+};
+}
+
+Frame::Frame(const std::string_view msg, const ipc::Target& target, uint8_t version)
+    : priority_(target.Meta.Priority)
+{
+    const WirePayload payload(msg, version);
+
+    // Sized first, the chunks of a msg are framed back to back into a single buffer.
+    EncodeFrames(target, payload, version, [&](const EncodedHeader& header, const std::string_view) {
+        size_ += header.FrameSize();
+        service_ = header.Service();
+        return S_OK;
+    });
+
+    auto   bytes  = std::make_shared_for_overwrite<uint8_t[]>(size_);
+    size_t offset = 0;
+    EncodeFrames(target, payload, version, [&](const EncodedHeader& header, const std::string_view chunk) {
+        memcpy(&bytes[offset], header.Data(), header.Size());
+        memcpy(&bytes[offset + header.Size()], chunk.data(), chunk.size());
+        offset += header.FrameSize();
+        bytes[offset - 1] = 0;
+        return S_OK;
+    });
+    bytes_ = std::move(bytes);
+}
+
+Frame Frame::FrameAt(size_t offset) const
+{
+    DWORD size = 0;
+    memcpy(&size, &bytes_[offset], sizeof(size));
+
+    Frame frame;
+    frame.bytes_    = std::shared_ptr<const uint8_t[]>(bytes_, &bytes_[offset]);
+    frame.size_     = 4 + (size_t)size;
+    frame.service_  = service_;
+    frame.priority_ = priority_;
+    return frame;
+}
+
+PipeTransport::PipeTransport(Handle in, Handle out, Handle diag) noexcept : in_(in), out_(out), diag_(diag)
+{
+}
+
+PipeTransport::~PipeTransport()
+{
+    if (!owned_)
+        return;
+
+    for (Handle handle : {in_, out_, diag_})
+    {
+        if (handle != InvalidHandle)
+            CloseStream(handle);
+    }
+}
+
+std::shared_ptr<PipeTransport> PipeTransport::ForStdio()
+{
+    static const auto stdio = [] {
+        std::shared_ptr<PipeTransport> transport(new PipeTransport());
+#ifdef _WIN32
+        transport->in_   = ::GetStdHandle(STD_INPUT_HANDLE);
+        transport->out_  = ::GetStdHandle(STD_OUTPUT_HANDLE);
+        transport->diag_ = ::GetStdHandle(STD_ERROR_HANDLE);
+#else
+        transport->in_   = STDIN_FILENO;
+        transport->out_  = STDOUT_FILENO;
+        transport->diag_ = STDERR_FILENO;
+#endif
+        transport->owned_ = false;
+        return transport;
+    }();
+    return stdio;
+}
+
+HRESULT PipeTransport::CreatePair(std::shared_ptr<PipeTransport>& first, std::shared_ptr<PipeTransport>& second) noexcept
+try
+{
+    // [0] read end, [1] write end
+    Handle firstToSecond[2] {InvalidHandle, InvalidHandle};
+    Handle secondToFirst[2] {InvalidHandle, InvalidHandle};
+#ifdef _WIN32
+    RETURN_IF_WIN32_BOOL_FALSE(::CreatePipe(&firstToSecond[0], &firstToSecond[1], nullptr, 0));
+    if (!::CreatePipe(&secondToFirst[0], &secondToFirst[1], nullptr, 0))
+    {
+        const DWORD err = ::GetLastError();
+        CloseStream(firstToSecond[0]);
+        CloseStream(firstToSecond[1]);
+        RETURN_WIN32(err);
+    }
+#else
+    RETURN_LAST_ERROR_IF(::pipe2(firstToSecond, O_CLOEXEC) != 0);
+    if (::pipe2(secondToFirst, O_CLOEXEC) != 0)
+    {
+        const int err = errno;
+        CloseStream(firstToSecond[0]);
+        CloseStream(firstToSecond[1]);
+        RETURN_HR(HRESULT_FROM_ERRNO(err));
+    }
+#endif
+
+    first  = std::make_shared<PipeTransport>(secondToFirst[0], firstToSecond[1], InvalidHandle);
+    second = std::make_shared<PipeTransport>(firstToSecond[0], secondToFirst[1], InvalidHandle);
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT PipeTransport::Send(const std::string_view msg, const Target& target) noexcept
+try
+{
+    RETURN_HR_IF_MSG(E_FAIL, target.Service == KnownService::All, "Can't send IPC msg to 'All'");
+
+    const uint8_t     version = GetFrameVersion();
+    const WirePayload payload(msg, version);
+
+    // Chunks are written one at a time, frames sent by other threads may go in between.
+    return EncodeFrames(target, payload, version, [&](const EncodedHeader& header, const std::string_view bytes) {
+        const Segment segments[] = {{header.Data(), header.Size()}, {bytes.data(), bytes.size()}, {&ZeroTerm, 1}};
+
+        std::scoped_lock guard(sendLock_);
+        RETURN_HR_IF(E_NOT_VALID_STATE, out_ == InvalidHandle);
+
+        RETURN_IF_FAILED(WriteSegments(out_, segments, std::size(segments), header.FrameSize()));
+        return S_OK;
+    });
+}
+CATCH_RETURN();
+
+HRESULT PipeTransport::SendFrame(const Frame& frame) noexcept
+try
+{
+    RETURN_HR_IF_MSG(E_FAIL, frame.Service() == KnownServiceId::All, "Can't send IPC msg to 'All'");
+
+    const Segment segment {frame.Data(), frame.Size()};
+
+    std::scoped_lock guard(sendLock_);
+    RETURN_HR_IF(E_NOT_VALID_STATE, out_ == InvalidHandle);
+
+    RETURN_IF_FAILED(WriteSegments(out_, &segment, 1, frame.Size()));
+
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT PipeTransport::SendDiag(const std::string_view msg) noexcept
+try
+{
+    // Nobody listens
+    if (diag_ == InvalidHandle)
+        return S_FALSE;
+
+    const Segment segments[] = {{msg.data(), msg.size()}, {&ZeroTerm, 1}};
+
+    std::scoped_lock guard(diagLock_);
+    RETURN_IF_FAILED(WriteSegments(diag_, segments, std::size(segments), msg.size() + 1));
+
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT PipeTransport::StartRead(std::jthread& reader, OnMessage onMessage, DWORD pid) noexcept
+try
+{
+    auto frames = std::make_shared<FrameReader>();
+    RETURN_IF_FAILED(frames->Init());
+    frames->SetOnChunk(GetOnChunk());
+
+    reader = std::jthread([self = shared_from_this(), in = in_, frames, onMessage, pid](std::stop_token stoken) {
+        SetReaderThreadName(false, pid);
+        while (!stoken.stop_requested() && frames->ReadChunk(in, onMessage) == S_OK)
+        {
+        }
+    });
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT PipeTransport::StartReadDiag(std::jthread& reader, OnDiag onDiag, DWORD pid) noexcept
+try
+{
+    if (diag_ == InvalidHandle)
+        return S_FALSE;
+
+    reader = std::jthread([self = shared_from_this(), diag = diag_, onDiag, pid](std::stop_token stoken) {
+        SetReaderThreadName(true, pid);
+        char buf[4096];
+        while (!stoken.stop_requested())
+        {
+            const long read = ReadSome(diag, buf, sizeof(buf));
+            if (read <= 0)
+                break;
+            onDiag(std::string_view(buf, (size_t)read));
+        }
+    });
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT PipeTransport::StartRead(EventLoop& loop, OnMessage onMessage) noexcept
+try
+{
+    auto stream = std::make_shared<FrameStream>(shared_from_this(), std::move(onMessage), GetOnChunk());
+    RETURN_IF_FAILED(stream->Init());
+    stream_ = stream;
+    RETURN_IF_FAILED(loop.Read(in_, std::move(stream)));
+    return S_OK;
+}
+CATCH_RETURN();
+
+bool PipeTransport::PauseRead() noexcept
+{
+    const auto stream = stream_.lock();
+    if (!stream)
+        return false;
+
+    stream->Pause();
+    return true;
+}
+
+void PipeTransport::ResumeRead() noexcept
+{
+    if (const auto stream = stream_.lock())
+        stream->Resume();
+}
+
+HRESULT PipeTransport::StartReadDiag(EventLoop& loop, OnDiag onDiag) noexcept
+try
+{
+    if (diag_ == InvalidHandle)
+        return S_FALSE;
+
+    RETURN_IF_FAILED(loop.Read(diag_, std::make_shared<DiagStream>(shared_from_this(), std::move(onDiag))));
+    return S_OK;
+}
+CATCH_RETURN();
+
+void PipeTransport::Close() noexcept
+{
+    std::scoped_lock guard(sendLock_);
+    if (owned_ && out_ != InvalidHandle)
+        CloseStream(out_);
+    out_ = InvalidHandle;
+}
+}
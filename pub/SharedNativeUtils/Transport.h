@@ -0,0 +1,176 @@
+#pragma once
+#include "platform.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include "ipc.h"
+#include "EventLoop.h"
+
+namespace ipc
+{
+// Raw diagnostic output as read, may contain multiple or partial lines.
+using OnDiag = std::function<void(const std::string_view output)>;
+
+// A complete wire frame of a message as described at FrameHeader.
+// Built once and shared by all recipients of a message, so a broadcast is framed once and not per recipient.
+// Immutable and cheap to copy.
+class Frame final
+{
+public:
+    Frame() = default;
+    // version is one of FrameVersion, the recipients need to support it.
+    Frame(const std::string_view msg, const ipc::Target& target, uint8_t version);
+
+    const uint8_t* Data() const
+    {
+        return bytes_.get();
+    }
+    size_t Size() const
+    {
+        return size_;
+    }
+    ServiceId Service() const
+    {
+        return service_;
+    }
+    // Of the msg, regardless of whether version supports flagging it.
+    MsgPriority Priority() const
+    {
+        return priority_;
+    }
+
+    // A large msg is framed as consecutive chunk frames, see EncodeFrames(). Returns the single frame starting at
+    // offset, which is 0 or where one returned before ends. Shares the bytes of this frame.
+    Frame FrameAt(size_t offset) const;
+
+    explicit operator bool() const
+    {
+        return bytes_ != nullptr;
+    }
+
+private:
+    std::shared_ptr<const uint8_t[]> bytes_;
+    size_t                           size_     = 0;
+    ServiceId                        service_  = KnownServiceId::Unresolved;
+    MsgPriority                      priority_ = MsgPriority::Bulk;
+};
+
+// One end of the connection between broker and a host process: a framed message channel in each direction plus a
+// diagnostic channel from host to broker.
+class Transport : public std::enable_shared_from_this<Transport>
+{
+public:
+    virtual ~Transport() = default;
+
+    // Thread safe.
+    virtual HRESULT Send(const std::string_view msg, const Target& target) noexcept = 0;
+    // Thread safe.
+    virtual HRESULT SendFrame(const Frame& frame) noexcept = 0;
+    // Thread safe.
+    virtual HRESULT SendDiag(const std::string_view msg) noexcept = 0;
+
+    // Dispatches incoming messages in a new thread until onMessage asks to stop, the peer closed or stop is
+    // requested. The thread keeps the transport alive, so it may be detached. pid is used to name the thread.
+    virtual HRESULT StartRead(std::jthread& reader, OnMessage onMessage, DWORD pid) noexcept = 0;
+    // Same for the diagnostic channel.
+    virtual HRESULT StartReadDiag(std::jthread& reader, OnDiag onDiag, DWORD pid) noexcept = 0;
+
+    // Same, but read by loop instead of a thread of its own. E_NOTIMPL if the transport can't be multiplexed.
+    virtual HRESULT StartRead(EventLoop& loop, OnMessage onMessage) noexcept
+    {
+        return E_NOTIMPL;
+    }
+    virtual HRESULT StartReadDiag(EventLoop& loop, OnDiag onDiag) noexcept
+    {
+        return E_NOTIMPL;
+    }
+
+    // Holds off reading further msgs until ResumeRead(), those read already are still dispatched. Only from within
+    // onMessage and only while read by an EventLoop, returns false otherwise, e.g. as a reader thread may just block.
+    virtual bool PauseRead() noexcept
+    {
+        return false;
+    }
+    // From any thread.
+    virtual void ResumeRead() noexcept
+    {
+    }
+
+    // Closes the sending direction, the peer's read loop ends once it consumed what was sent before.
+    virtual void Close() noexcept = 0;
+
+    // Frame layout Send() uses, one of FrameVersion. Legacy until the peer announced a later one.
+    void SetFrameVersion(uint8_t version) noexcept
+    {
+        frameVersion_ = version;
+    }
+    uint8_t GetFrameVersion() const noexcept
+    {
+        return frameVersion_;
+    }
+
+    // Lets the reader started next hand out chunks of large msgs as they arrive, see OnChunk.
+    void SetOnChunk(OnChunk onChunk)
+    {
+        onChunk_ = std::move(onChunk);
+    }
+
+protected:
+    const OnChunk& GetOnChunk() const noexcept
+    {
+        return onChunk_;
+    }
+
+private:
+    std::atomic<uint8_t> frameVersion_ {FrameVersion::Legacy};
+    OnChunk              onChunk_;
+};
+
+// Framed messages over a pair of byte streams: anonymous pipes on Windows, pipes or socketpairs on POSIX.
+class PipeTransport final : public Transport
+{
+public:
+    // Takes ownership of the handles. diag may be InvalidHandle.
+    PipeTransport(Handle in, Handle out, Handle diag) noexcept;
+    ~PipeTransport();
+
+    PipeTransport(const PipeTransport&)            = delete;
+    PipeTransport& operator=(const PipeTransport&) = delete;
+
+    // Host side: stdin, stdout and stderr of the current process, always the same instance. Handles are not owned.
+    static std::shared_ptr<PipeTransport> ForStdio();
+
+    // Two transports connected to each other, e.g. to run broker and host side within a single process.
+    static HRESULT CreatePair(std::shared_ptr<PipeTransport>& first, std::shared_ptr<PipeTransport>& second) noexcept;
+
+    HRESULT Send(const std::string_view msg, const Target& target) noexcept override;
+    HRESULT SendFrame(const Frame& frame) noexcept override;
+    HRESULT SendDiag(const std::string_view msg) noexcept override;
+    HRESULT StartRead(std::jthread& reader, OnMessage onMessage, DWORD pid) noexcept override;
+    HRESULT StartReadDiag(std::jthread& reader, OnDiag onDiag, DWORD pid) noexcept override;
+    // The read ends need to be opened for overlapped I/O on Windows.
+    HRESULT StartRead(EventLoop& loop, OnMessage onMessage) noexcept override;
+    HRESULT StartReadDiag(EventLoop& loop, OnDiag onDiag) noexcept override;
+    bool    PauseRead() noexcept override;
+    void    ResumeRead() noexcept override;
+    void    Close() noexcept override;
+
+private:
+    PipeTransport() = default;
+
+    // Of in_ while read by an EventLoop.
+    std::weak_ptr<EventLoop::Stream> stream_;
+
+    Handle in_    = InvalidHandle;
+    Handle out_   = InvalidHandle;
+    Handle diag_  = InvalidHandle;
+    bool   owned_ = true;
+    // Writes need sequential access to not interleave frames from multiple threads.
+    std::mutex sendLock_;
+    std::mutex diagLock_;
+};
+}
@@ -0,0 +1,150 @@
+#include "pch.h"
+#ifndef _WIN32
+#    include <algorithm>
+#    include <atomic>
+#    include <cstring>
+#    include "Uring.h"
+#    include <unistd.h>
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+
+namespace ipc
+{
+namespace
+{
+int Setup(unsigned entries, io_uring_params& params) noexcept
+{
+    return (int)::syscall(__NR_io_uring_setup, entries, &params);
+}
+
+int Enter(int fd, unsigned submit, unsigned waitFor, unsigned flags) noexcept
+{
+    return (int)::syscall(__NR_io_uring_enter, fd, submit, waitFor, flags, nullptr, 0);
+}
+
+// The kernel reads and writes the ring indices concurrently.
+unsigned LoadAcquire(const unsigned* index) noexcept
+{
+    return std::atomic_ref<const unsigned>(*index).load(std::memory_order_acquire);
+}
+
+void StoreRelease(unsigned* index, unsigned value) noexcept
+{
+    std::atomic_ref<unsigned>(*index).store(value, std::memory_order_release);
+}
+
+void* Map(int fd, size_t size, off_t offset) noexcept
+{
+    void* mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return mapped == MAP_FAILED ? nullptr : mapped;
+}
+}
+
+Uring::~Uring()
+{
+    if (sqes_)
+        ::munmap(sqes_, sqesSize_);
+    if (cqRing_ && cqRing_ != sqRing_)
+        ::munmap(cqRing_, cqRingSize_);
+    if (sqRing_)
+        ::munmap(sqRing_, sqRingSize_);
+    if (fd_ >= 0)
+        ::close(fd_);
+}
+
+HRESULT Uring::Init(unsigned entries) noexcept
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, fd_ >= 0);
+
+    io_uring_params params {};
+    fd_ = Setup(entries, params);
+    RETURN_LAST_ERROR_IF(fd_ < 0);
+    // Without it completions may get lost if the completion queue overflows.
+    RETURN_HR_IF(E_NOTIMPL, !(params.features & IORING_FEAT_NODROP));
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+
+    sqRing_ = Map(fd_, sqRingSize_, IORING_OFF_SQ_RING);
+    RETURN_LAST_ERROR_IF(!sqRing_);
+    cqRing_ = params.features & IORING_FEAT_SINGLE_MMAP ? sqRing_ : Map(fd_, cqRingSize_, IORING_OFF_CQ_RING);
+    RETURN_LAST_ERROR_IF(!cqRing_);
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_     = Map(fd_, sqesSize_, IORING_OFF_SQES);
+    RETURN_LAST_ERROR_IF(!sqes_);
+
+    auto sq  = (uint8_t*)sqRing_;
+    sqHead_  = (unsigned*)(sq + params.sq_off.head);
+    sqTail_  = (unsigned*)(sq + params.sq_off.tail);
+    sqMask_  = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sqCount_ = params.sq_entries;
+    sqArray_ = (unsigned*)(sq + params.sq_off.array);
+
+    auto cq = (uint8_t*)cqRing_;
+    cqHead_ = (unsigned*)(cq + params.cq_off.head);
+    cqTail_ = (unsigned*)(cq + params.cq_off.tail);
+    cqMask_ = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes_   = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return S_OK;
+}
+
+io_uring_sqe* Uring::Prepare() noexcept
+{
+    unsigned tail = *sqTail_;
+    if (tail - LoadAcquire(sqHead_) >= sqCount_)
+    {
+        if (FAILED(Submit()) || tail - LoadAcquire(sqHead_) >= sqCount_)
+            return nullptr;
+    }
+
+    const unsigned index = tail & sqMask_;
+    auto           sqe   = &((io_uring_sqe*)sqes_)[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    StoreRelease(sqTail_, tail + 1);
+    ++pending_;
+    return sqe;
+}
+
+HRESULT Uring::Submit() noexcept
+{
+    while (pending_)
+    {
+        const int submitted = Enter(fd_, pending_, 0, 0);
+        if (submitted < 0 && errno == EINTR)
+            continue;
+        RETURN_LAST_ERROR_IF(submitted < 0);
+        pending_ -= std::min<unsigned>(pending_, (unsigned)submitted);
+        // E.g. out of memory for the completions, let the owner reap some first.
+        if (!submitted)
+            return S_FALSE;
+    }
+    return S_OK;
+}
+
+HRESULT Uring::Wait() noexcept
+{
+    for (;;)
+    {
+        if (LoadAcquire(cqTail_) != LoadAcquire(cqHead_))
+            return S_OK;
+        if (Enter(fd_, 0, 1, IORING_ENTER_GETEVENTS) >= 0)
+            return S_OK;
+        RETURN_LAST_ERROR_IF(errno != EINTR);
+    }
+}
+
+bool Uring::Pop(io_uring_cqe& cqe) noexcept
+{
+    const unsigned head = *cqHead_;
+    if (head == LoadAcquire(cqTail_))
+        return false;
+
+    cqe = cqes_[head & cqMask_];
+    StoreRelease(cqHead_, head + 1);
+    return true;
+}
+}
+#endif
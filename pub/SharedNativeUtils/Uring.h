@@ -0,0 +1,60 @@
+#pragma once
+#ifndef _WIN32
+#    include "platform.h"
+#    include <cstdint>
+#    include <linux/io_uring.h>
+
+namespace ipc
+{
+// The bare minimum of an io_uring: a submission and a completion queue mapped from the kernel, driven by the raw
+// syscalls so there's no dependency on liburing.
+// Not thread safe: preparing, submitting and popping need to be serialized by the owner. Only Wait() may be called
+// by several threads at once.
+class Uring final
+{
+public:
+    Uring() = default;
+    ~Uring();
+
+    Uring(const Uring&)            = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // Fails if the kernel doesn't support io_uring or it is disabled, e.g. by a seccomp filter.
+    HRESULT Init(unsigned entries) noexcept;
+
+    // Returns a cleared submission entry to fill in, submits what's prepared first if the queue is full.
+    io_uring_sqe* Prepare() noexcept;
+
+    // Hands all prepared entries over to the kernel with a single syscall.
+    HRESULT Submit() noexcept;
+
+    // Blocks until a completion is ready, without popping it.
+    HRESULT Wait() noexcept;
+
+    // Pops the oldest completion, false if none is ready.
+    bool Pop(io_uring_cqe& cqe) noexcept;
+
+private:
+    int    fd_         = -1;
+    void*  sqRing_     = nullptr;
+    size_t sqRingSize_ = 0;
+    void*  cqRing_     = nullptr;
+    size_t cqRingSize_ = 0;
+    void*  sqes_       = nullptr;
+    size_t sqesSize_   = 0;
+
+    unsigned*     sqHead_  = nullptr;
+    unsigned*     sqTail_  = nullptr;
+    unsigned      sqMask_  = 0;
+    unsigned      sqCount_ = 0;
+    unsigned*     sqArray_ = nullptr;
+    unsigned*     cqHead_  = nullptr;
+    unsigned*     cqTail_  = nullptr;
+    unsigned      cqMask_  = 0;
+    io_uring_cqe* cqes_    = nullptr;
+
+    // Prepared but not submitted yet.
+    unsigned pending_ = 0;
+};
+}
+#endif
@@ -1,96 +1,169 @@
 #pragma once
 
-#include <Windows.h>
+#include "platform.h"
+#include <cstdint>
+#include <cstring>
 #include <string>
 #include <string_view>
-#include <guiddef.h>
-#include <objbase.h>
-#include <wil/resource.h>
+#include <type_traits>
+#ifdef _WIN32
+#    include <guiddef.h>
+#    include <objbase.h>
+#    include <wil/resource.h>
+#    include "string_extensions.h"
+#else
+#    include <random>
+#endif
+#if defined(_M_X64) || defined(__SSE2__)
+#    define GUID_SSE2
+#    include <emmintrin.h>
+#endif
 #include <absl/hash/hash.h>
-#include "string_extensions.h"
 
+// Parsed and formatted the same on every platform, Parse() and Format() don't allocate. A literal like Guid {L"{...}"}
+// is parsed at compile time when the Guid is constexpr, other strings with SSE2 where available.
 struct Guid final : GUID
 {
+    // Characters of a formatted Guid, as in "{831532DC-7EFB-4A8C-841B-7BBE21558F8F}".
+    static constexpr size_t Length = 38;
+
     static Guid CreateNew()
     {
-        Guid    newGuid;
-        HRESULT _ = ::CoCreateGuid(&newGuid);
-        return newGuid;
+        return Guid(true);
     }
 
-    Guid(bool createNew = false)
+    constexpr Guid(bool createNew = false) : GUID {}
     {
         if (createNew)
-            (void)::CoCreateGuid(this);
-        else
-            *(GUID*)this = GUID_NULL;
+            Generate();
     }
 
-    Guid(const GUID& guid)
+    constexpr Guid(const GUID& guid) : GUID(guid)
     {
-        *(GUID*)this = guid;
     }
 
-    Guid(std::wstring_view guid)
+    constexpr Guid(std::wstring_view guid) : GUID {}
     {
-        FAIL_FAST_IF_FAILED_MSG(Parse(guid), "Failed to parse guid '%ls'", guid.data());
+        if (FAILED(Parse(guid)))
+            ParseFailed(guid);
     }
 
-    Guid(std::string_view guid)
+    constexpr Guid(std::string_view guid) : GUID {}
     {
-        FAIL_FAST_IF_FAILED_MSG(Parse(guid), "Failed to parse guid '%s'", guid.data());
+        if (FAILED(Parse(guid)))
+            ParseFailed(guid);
     }
 
-    Guid(PCWSTR guid)
+    constexpr Guid(PCWSTR guid) : Guid(std::wstring_view(guid))
     {
-        FAIL_FAST_IF_FAILED_MSG(Parse(guid), "Failed to parse guid '%ls'", guid);
     }
 
-    Guid(PCSTR guid)
+    constexpr Guid(PCSTR guid) : Guid(std::string_view(guid))
     {
-        FAIL_FAST_IF_FAILED_MSG(Parse(guid), "Failed to parse guid '%s'", guid);
     }
 
-    // formatted as "{831532DC-7EFB-4A8C-841B-7BBE21558F8F}"
-    std::wstring ToUtf16() const
+    // Writes Length characters, not zero-terminated.
+    void Format(char* str) const noexcept
     {
-        std::wstring str(38, L'\0');
-        THROW_HR_IF(E_FAIL, 0 == ::StringFromGUID2(*this, str.data(), (int)str.size() + 1));
-        return str;
+        char hex[32];
+        ToHex(hex);
+        Punctuate(hex, str);
     }
-    std::string ToUtf8() const
+
+    // Format() and Parse() as done where there's no SSE2, e.g. to check the SSE2 paths against.
+    void FormatScalar(char* str) const noexcept
     {
-        return Strings::ToUtf8(ToUtf16());
+        char hex[32];
+        ToHexScalar(hex);
+        Punctuate(hex, str);
     }
 
-    HRESULT Parse(const std::wstring_view guid)
+    // Char by char, for constant evaluation as well.
+    template <typename Char>
+    constexpr HRESULT ParseScalar(std::basic_string_view<Char> guid) noexcept
     {
-        CLSID clsid;
-        if (guid.size() == 38)
-        {
-            RETURN_IF_FAILED(::CLSIDFromString(guid.data(), &clsid));
-        }
-        else if (guid.size() == 36)
-        {
-            std::wstring g(L"{");
-            g += guid;
-            g += L"}";
+        if (!Unbrace(guid))
+            return E_INVALIDARG;
 
-            RETURN_IF_FAILED(::CLSIDFromString(g.data(), &clsid));
+        uint8_t bytes[16] {};
+        for (int i = 0; i < 16; ++i)
+        {
+            const int hi = HexValue(guid[HexOffsets[i]]), lo = HexValue(guid[HexOffsets[i] + 1]);
+            if (hi < 0 || lo < 0)
+                return E_INVALIDARG;
+            bytes[i] = (uint8_t)(hi << 4 | lo);
         }
-        *this = *(Guid*)&clsid;
+        FromBytes(bytes);
         return S_OK;
     }
-    HRESULT Parse(const std::string_view guid)
+
+private:
+    // Adds braces and dashes to the 32 hex digits.
+    static void Punctuate(const char (&hex)[32], char* str) noexcept
+    {
+        str[0] = '{';
+        memcpy(str + 1, hex, 8);
+        str[9] = '-';
+        memcpy(str + 10, hex + 8, 4);
+        str[14] = '-';
+        memcpy(str + 15, hex + 12, 4);
+        str[19] = '-';
+        memcpy(str + 20, hex + 16, 4);
+        str[24] = '-';
+        memcpy(str + 25, hex + 20, 12);
+        str[37] = '}';
+    }
+
+public:
+    // formatted as "{831532DC-7EFB-4A8C-841B-7BBE21558F8F}"
+    std::string ToUtf8() const
+    {
+        std::string str(Length, '\0');
+        Format(str.data());
+        return str;
+    }
+    std::wstring ToUtf16() const
+    {
+        char str[Length];
+        Format(str);
+        return std::wstring(str, str + Length);
+    }
+
+    // With or without braces, hex digits in either case.
+    constexpr HRESULT Parse(const std::wstring_view guid) noexcept
+    {
+        if (std::is_constant_evaluated())
+            return ParseScalar(guid);
+
+        // A GUID string is plain ASCII, so narrowing is lossless for any valid input.
+        char g[Length];
+        if (guid.size() > Length)
+            return E_INVALIDARG;
+        for (size_t i = 0; i < guid.size(); ++i)
+            g[i] = (guid[i] > 0 && guid[i] < 0x80) ? (char)guid[i] : '?';
+        return ParseFast(std::string_view(g, guid.size()));
+    }
+    constexpr HRESULT Parse(const std::string_view guid) noexcept
     {
-        return Parse(Strings::ToUtf16(guid));
+        if (std::is_constant_evaluated())
+            return ParseScalar(guid);
+        return ParseFast(guid);
     }
 
-    bool Equals(const Guid& rhs) const
+    constexpr bool Equals(const Guid& rhs) const noexcept
     {
-        return !!::IsEqualGUID(*this, rhs);
+        if (std::is_constant_evaluated())
+        {
+            for (int i = 0; i < 8; ++i)
+            {
+                if (Data4[i] != rhs.Data4[i])
+                    return false;
+            }
+            return Data1 == rhs.Data1 && Data2 == rhs.Data2 && Data3 == rhs.Data3;
+        }
+        return memcmp(this, &rhs, sizeof(GUID)) == 0;
     }
-    bool operator==(const Guid& rhs) const
+    constexpr bool operator==(const Guid& rhs) const noexcept
     {
         return Equals(rhs);
     }
@@ -99,6 +172,190 @@ struct Guid final : GUID
     template <typename H>
     friend H AbslHashValue(H h, const Guid& guid)
     {
-        return H::combine(std::move(h), guid.Data1, guid.Data2, guid.Data3, *(uint64_t*)&guid.Data4[0]);
+        // Data4 isn't aligned for 8 byte loads.
+        uint64_t words[2];
+        memcpy(words, &guid, sizeof(words));
+        return H::combine(std::move(h), words[0], words[1]);
+    }
+
+private:
+    static_assert(sizeof(GUID) == 16);
+
+    void Generate()
+    {
+#ifdef _WIN32
+        (void)::CoCreateGuid(this);
+#else
+        // RFC 4122 version 4 (random) GUID
+        static thread_local std::mt19937_64 rng {std::random_device {}()};
+
+        const uint64_t hi = rng(), lo = rng();
+        Data1             = (uint32_t)(hi >> 32);
+        Data2             = (uint16_t)(hi >> 16);
+        Data3             = (uint16_t)((hi & 0x0FFF) | 0x4000);
+        for (int i = 0; i < 8; ++i)
+            Data4[i] = (uint8_t)(lo >> (56 - 8 * i));
+        Data4[0] = (uint8_t)((Data4[0] & 0x3F) | 0x80);
+#endif
+    }
+
+    // Not constexpr, so a malformed literal of a constexpr Guid fails to compile.
+    template <typename Char>
+    [[noreturn]] static void ParseFailed(std::basic_string_view<Char> guid)
+    {
+        const std::string g(guid.begin(), guid.end());
+        FAIL_FAST_IF_FAILED_MSG(E_INVALIDARG, "Failed to parse guid '%s'", g.c_str());
+        std::abort();
+    }
+
+    // Where the two hex digits of each byte start, without braces.
+    static constexpr uint8_t HexOffsets[16] = {0, 2, 4, 6, 9, 11, 14, 16, 19, 21, 24, 26, 28, 30, 32, 34};
+
+    static constexpr uint32_t Swap32(uint32_t v) noexcept
+    {
+        return v >> 24 | (v >> 8 & 0xFF00) | (v << 8 & 0xFF0000) | v << 24;
+    }
+    static constexpr uint16_t Swap16(uint16_t v) noexcept
+    {
+        return (uint16_t)(v >> 8 | v << 8);
+    }
+
+    // The bytes given in the order they're formatted in, i.e. Data1 to Data3 big endian.
+    constexpr void FromBytes(const uint8_t (&bytes)[16]) noexcept
+    {
+        Data1 = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+        Data2 = (uint16_t)(bytes[4] << 8 | bytes[5]);
+        Data3 = (uint16_t)(bytes[6] << 8 | bytes[7]);
+        for (int i = 0; i < 8; ++i)
+            Data4[i] = bytes[8 + i];
+    }
+
+    template <typename Char>
+    static constexpr int HexValue(Char c) noexcept
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // Strips the braces, false if the rest isn't 36 characters with the dashes in place.
+    template <typename Char>
+    static constexpr bool Unbrace(std::basic_string_view<Char>& guid) noexcept
+    {
+        if (guid.size() == Length)
+        {
+            if (guid.front() != '{' || guid.back() != '}')
+                return false;
+            guid = guid.substr(1, 36);
+        }
+        return guid.size() == 36 && guid[8] == '-' && guid[13] == '-' && guid[18] == '-' && guid[23] == '-';
+    }
+
+    HRESULT ParseFast(std::string_view guid) noexcept
+    {
+#ifdef GUID_SSE2
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, !Unbrace(guid));
+        uint8_t bytes[16];
+        RETURN_HR_IF_EXPECTED(E_INVALIDARG, !FromHex(guid.data(), bytes));
+        FromBytes(bytes);
+        return S_OK;
+#else
+        return ParseScalar(guid);
+#endif
+    }
+
+#ifdef GUID_SSE2
+    static uint64_t Load64(const char* p) noexcept
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static uint64_t Load32(const char* p) noexcept
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    // The 32 hex digits of 36 characters without braces, false if any isn't one.
+    static bool FromHex(const char* guid, uint8_t (&bytes)[16]) noexcept
+    {
+        // Gathered around the dashes in general purpose registers, as vector loads of bytes just copied would stall.
+        const __m128i hex[2] {
+            _mm_set_epi64x((int64_t)(Load32(guid + 9) | Load32(guid + 14) << 32), (int64_t)Load64(guid)),
+            _mm_set_epi64x((int64_t)Load64(guid + 28), (int64_t)(Load32(guid + 19) | Load32(guid + 24) << 32))};
+
+        __m128i pairs[2];
+        for (int i = 0; i < 2; ++i)
+        {
+            const __m128i c     = hex[i];
+            const __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+            const __m128i digit = _mm_and_si128(
+                _mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+            const __m128i alpha = _mm_and_si128(
+                _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+            if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+                return false;
+
+            const __m128i nibbles = _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                _mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+            // The high nibble comes first, i.e. in the low byte of each 16 bit lane.
+            pairs[i] = _mm_or_si128(
+                _mm_and_si128(_mm_slli_epi16(nibbles, 4), _mm_set1_epi16(0xF0)), _mm_srli_epi16(nibbles, 8));
+        }
+        _mm_storeu_si128((__m128i*)bytes, _mm_packus_epi16(pairs[0], pairs[1]));
+        return true;
+    }
+#endif
+
+    // The bytes in the order they're formatted in, Data1 to Data3 big endian.
+    void ToWords(uint64_t (&words)[2]) const noexcept
+    {
+        words[0] = Swap32((uint32_t)Data1) | (uint64_t)Swap16((uint16_t)Data2) << 32 |
+                   (uint64_t)Swap16((uint16_t)Data3) << 48;
+        memcpy(&words[1], Data4, sizeof(Data4));
+    }
+
+    // The 32 hex digits in upper case.
+    void ToHex(char (&hex)[32]) const noexcept
+    {
+#ifdef GUID_SSE2
+        uint64_t words[2];
+        ToWords(words);
+
+        const __m128i b    = _mm_set_epi64x((int64_t)words[1], (int64_t)words[0]);
+        const __m128i mask = _mm_set1_epi8(0x0F);
+        const __m128i hi   = _mm_and_si128(_mm_srli_epi16(b, 4), mask);
+        const __m128i lo   = _mm_and_si128(b, mask);
+        const __m128i nibbles[2] {_mm_unpacklo_epi8(hi, lo), _mm_unpackhi_epi8(hi, lo)};
+        for (int i = 0; i < 2; ++i)
+        {
+            // Letters follow the digits 7 characters later.
+            const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles[i], _mm_set1_epi8(9)), _mm_set1_epi8(7));
+            const __m128i chars   = _mm_add_epi8(_mm_add_epi8(nibbles[i], _mm_set1_epi8('0')), letters);
+            _mm_storeu_si128((__m128i*)(hex + 16 * i), chars);
+        }
+#else
+        ToHexScalar(hex);
+#endif
+    }
+
+    void ToHexScalar(char (&hex)[32]) const noexcept
+    {
+        uint64_t words[2];
+        ToWords(words);
+
+        constexpr char digits[] = "0123456789ABCDEF";
+        for (int i = 0; i < 16; ++i)
+        {
+            const auto byte = (uint8_t)(words[i / 8] >> (i % 8 * 8));
+            hex[2 * i]      = digits[byte >> 4];
+            hex[2 * i + 1]  = digits[byte & 0x0F];
+        }
     }
 };
@@ -1,13 +1,23 @@
 #pragma once
-#include <Windows.h>
+#include "platform.h"
+#include <cstdint>
 #include <functional>
+#include <string>
 #include <string_view>
-#include <format>
 #include <thread>
 #include "guid.h"
 
 namespace ipc
 {
+#ifdef _WIN32
+using Handle               = HANDLE;
+const Handle InvalidHandle = nullptr;
+#else
+// A file descriptor of a pipe or socketpair end.
+using Handle               = int;
+const Handle InvalidHandle = -1;
+#endif
+
 namespace KnownSession
 {
 const DWORD Any {(DWORD)-1};
@@ -15,26 +25,113 @@ const DWORD Any {(DWORD)-1};
 
 namespace KnownService
 {
+// Parsed at compile time, so these take no initialization at load.
 // A module may indicate that it wants to receive messages for all services
-static const Guid All {GUID_NULL};
+inline constexpr Guid All {};
 
-static const Guid Broker {L"{92D627A3-6C62-4C5B-8477-484A34ED3B82}"};
+inline constexpr Guid Broker {L"{92D627A3-6C62-4C5B-8477-484A34ED3B82}"};
 // ipc::ModuleMeta
-static const Guid ModuleMetaConsumer {L"{6E6A094C-839F-4EAF-BD22-08CB9E1A318F}"};
+inline constexpr Guid ModuleMetaConsumer {L"{6E6A094C-839F-4EAF-BD22-08CB9E1A318F}"};
 
 // ipc::HostInitMsg
-static const Guid HostInit {L"{AA810FBD-B33C-4895-8E82-8814EE849E02}"};
-static const Guid ManagedHost {L"{7924FE60-C967-449C-BA5D-2EBAA7D16024}"};
+inline constexpr Guid HostInit {L"{AA810FBD-B33C-4895-8E82-8814EE849E02}"};
+inline constexpr Guid ManagedHost {L"{7924FE60-C967-449C-BA5D-2EBAA7D16024}"};
+
+inline constexpr Guid ShellExec {L"{BEA684E7-697F-4201-844F-98224FA16D2F}"};
+inline constexpr Guid ConfStore {L"{8583CDC9-DB92-45BE-90CE-4D3AA4CD14F5}"};
+inline constexpr Guid ConfConsumer {L"{8ED3A4D7-7C78-4B88-A547-A4D87A9DDC35}"};
+
+// ipc::ServiceIdsMsg
+inline constexpr Guid ServiceIds {L"{3C1D0A52-5E2B-4D6C-9A4F-7B0E61C2D8F3}"};
+}
+
+// Compact id of a service as carried within frames, see ServiceTable.h.
+using ServiceId = uint32_t;
+
+namespace KnownServiceId
+{
+// Ids of the KnownService GUIDs, known to every process without being announced.
+const ServiceId All                = 0;
+const ServiceId Broker             = 1;
+const ServiceId ModuleMetaConsumer = 2;
+const ServiceId HostInit           = 3;
+const ServiceId ManagedHost        = 4;
+const ServiceId ShellExec          = 5;
+const ServiceId ConfStore          = 6;
+const ServiceId ConfConsumer       = 7;
+const ServiceId ServiceIds         = 8;
+// The broker assigns ids from here on.
+const ServiceId FirstAssigned      = 9;
 
-static const Guid ShellExec {L"{BEA684E7-697F-4201-844F-98224FA16D2F}"};
-static const Guid ConfStore {L"{8583CDC9-DB92-45BE-90CE-4D3AA4CD14F5}"};
-static const Guid ConfConsumer {L"{8ED3A4D7-7C78-4B88-A547-A4D87A9DDC35}"};
+// The service has no id (yet), its GUID travels within the frame.
+const ServiceId Unresolved = 0xFFFFFFFF;
+
+// The KnownService GUIDs, indexed by their id.
+inline constexpr const Guid* Guids[] = {&KnownService::All, &KnownService::Broker, &KnownService::ModuleMetaConsumer,
+    &KnownService::HostInit, &KnownService::ManagedHost, &KnownService::ShellExec, &KnownService::ConfStore,
+    &KnownService::ConfConsumer, &KnownService::ServiceIds};
+static_assert(std::size(Guids) == FirstAssigned);
+
+// Id of service if it's one of the KnownService GUIDs, Unresolved otherwise.
+constexpr ServiceId Of(const Guid& service) noexcept
+{
+    for (ServiceId id = 0; id < FirstAssigned; ++id)
+    {
+        if (*Guids[id] == service)
+            return id;
+    }
+    return Unresolved;
+}
 }
 
+// What the msg bytes of a frame are.
+enum class PayloadType : uint8_t
+{
+    Json,
+    Binary
+};
+
+// Control msgs, e.g. commands to a host, overtake bulk msgs queued for or received by the same process.
+enum class MsgPriority : uint8_t
+{
+    Bulk,
+    Control
+};
+
+// Microseconds since the Unix epoch.
+uint64_t TimestampNow() noexcept;
+
+// A new MsgMeta::Id.
+uint64_t NextMsgId() noexcept;
+
+// Properties of a message other than where it goes, carried by frames from FrameVersion::V1 on.
+struct MsgMeta final
+{
+    // Unique per message, 0 if unknown. The sending process id is in the upper half.
+    uint64_t    Id       = 0;
+    // When the message was sent by its originator, see TimestampNow(). 0 if unknown.
+    uint64_t    Sent     = 0;
+    PayloadType Payload  = PayloadType::Json;
+    // Sent from FrameVersion::V4 on, received as Bulk from older senders.
+    MsgPriority Priority = MsgPriority::Bulk;
+
+    // Microseconds since the message was sent, -1 if unknown.
+    int64_t Age() const noexcept
+    {
+        return Sent ? (int64_t)(TimestampNow() - Sent) : -1;
+    }
+};
+
 struct Target final
 {
-    Guid  Service;
-    DWORD Session = KnownSession::Any;
+    Guid      Service;
+    DWORD     Session = KnownSession::Any;
+    // Id of Service if known. Set for received messages and KnownService GUIDs, resolved from Service when sending
+    // otherwise.
+    ServiceId Id = KnownServiceId::Unresolved;
+    // Set for received messages, assigned when sending otherwise. Passing a received target on keeps it, so e.g. a
+    // message forwarded by the broker has the id and timestamp of its originator.
+    MsgMeta   Meta;
 
     Target() = default;
 
@@ -44,11 +141,12 @@ struct Target final
     {
         Service = service;
         Session = session;
+        Id      = KnownServiceId::Of(service);
     }
 
     std::wstring ToString() const
     {
-        return std::format(L"{} @ {}", Service.ToUtf16(), (int)Session);
+        return Service.ToUtf16() + L" @ " + std::to_wstring((int)Session);
     }
 
     bool Equals(const Target& rhs) const
@@ -61,24 +159,117 @@ struct Target final
     }
 };
 
-// Usually be used with host
-HRESULT Send(const std::string_view msg, const Target& target) noexcept;
+// Layouts of frames. Readers accept any of them, a sender uses the highest its peer announced in the HostInit
+// handshake: the broker offers HostInitMsg::FrameVersion, the host answers with HostInitAckMsg.
+namespace FrameVersion
+{
+const uint8_t Legacy = 0;
+const uint8_t V1     = 1;
+// Same layout as V1, the payload may be compressed, see FrameFlags::Lz4.
+const uint8_t V2     = 2;
+// Large msgs may be sent in chunks, see FrameFlags::Chunk.
+const uint8_t V3     = 3;
+// Control msgs are flagged, see FrameFlags::Control.
+const uint8_t V4     = 4;
+// Commands to a host are binary, see HostCmdHeader.
+const uint8_t V5     = 5;
+const uint8_t Latest = V5;
+}
+
+namespace FrameFlags
+{
+const uint16_t None    = 0;
+// The msg bytes are an LZ4 block which decompresses to FrameHeaderV1::RawSize bytes, the zero-term is not compressed.
+const uint16_t Lz4     = 1 << 0;
+// The msg bytes are a part of a larger msg, a FrameChunk follows FrameHeaderV1. Chunks of a msg share its MsgId.
+// A compressed msg is compressed as a whole and then split, all its chunks are flagged Lz4.
+const uint16_t Chunk   = 1 << 1;
+// MsgPriority::Control, a reader dispatches these before the bulk frames it has read along with them.
+const uint16_t Control = 1 << 2;
+// A frame with flags beyond these is skipped, it can't be interpreted.
+const uint16_t Known   = Lz4 | Chunk | Control;
+}
 
-// Usually be used with broker
-HRESULT Send(HANDLE out, const std::string_view msg, const Target& target) noexcept;
+// Wire layout of a message:
+//      [FrameHeader][service GUID, only if FrameHeader::Service is KnownServiceId::Unresolved][msg bytes][zero-term]
+// FrameHeader::Size counts all bytes following the length prefix.
+struct FrameHeader final
+{
+    DWORD     Size;
+    ServiceId Service;
+    DWORD     Session;
+};
+static_assert(sizeof(FrameHeader) == 12);
+
+// Where FrameHeader has the service id, which never gets that large.
+const uint16_t FrameMagic = 0xFED7;
+
+// Wire layout of a message from FrameVersion::V1 on, the same as above but with FrameHeaderV1.
+// HeaderSize lets later versions append fields, readers skip what they don't know.
+struct FrameHeaderV1 final
+{
+    DWORD     Size;
+    uint16_t  Flags;
+    uint16_t  Magic;
+    uint8_t   Version;
+    uint8_t   Payload;
+    uint16_t  HeaderSize;
+    ServiceId Service;
+    DWORD     Session;
+    // Size of the msg before compression, 0 if not compressed.
+    DWORD     RawSize;
+    uint64_t  MsgId;
+    uint64_t  Sent;
+};
+static_assert(sizeof(FrameHeaderV1) == 40);
+
+// Follows FrameHeaderV1 in a frame flagged FrameFlags::Chunk, counted by its HeaderSize.
+// Chunks of a msg are sent in order, but may be interleaved with frames of other msgs.
+struct FrameChunk final
+{
+    // Where the chunk's bytes go within the msg bytes, which are Total bytes in all.
+    DWORD Offset;
+    DWORD Total;
+};
+static_assert(sizeof(FrameChunk) == 8);
+
+// Messages passed are views into the reader's receive buffer, zero-terminated and only valid for the duration of
+// the call. Return true to stop reading.
+using OnMessage = std::function<bool(const std::string_view msg, const Target& target)>;
+
+// Chunks of a msg as they arrive, bytes belong at offset within the total msg bytes. The complete msg is handed to
+// OnMessage afterwards anyhow. Compressed msgs can't be consumed in chunks and only go to OnMessage.
+using OnChunk = std::function<void(const std::string_view bytes, DWORD offset, DWORD total, const Target& target)>;
+
+// Host side of the connection to the broker, see Transport.h for the broker side.
+
+// Sends via the host transport, stdout unless SetHostTransport() was called.
+HRESULT Send(const std::string_view msg, const Target& target) noexcept;
 
 HRESULT SendDiagMsg(const std::string_view msg) noexcept;
 
-// Usually be used with host
-HRESULT StartRead(
-    std::jthread& reader, std::function<bool(const std::string_view msg, const Target& target)> onRead) noexcept;
+// Reads messages from stdin.
+HRESULT StartRead(std::jthread& reader, OnMessage onRead) noexcept;
+
+class Transport;
 
-// Usually be used with broker
-HRESULT StartRead(HANDLE in, std::jthread& reader,
-    std::function<bool(const std::string_view msg, const Target& target)> onRead, DWORD pid) noexcept;
+// Routes Send() and SendDiagMsg() through another transport, which the caller keeps alive until switching back.
+// Pass nullptr to switch back to stdio.
+void SetHostTransport(Transport* transport) noexcept;
 
 // Message sender passed to InitModule() in a module DLL so that it may send messages to its host.
 typedef HRESULT(CALLBACK* SendMsg)(void* mod, PCSTR msg, const Guid* service, DWORD session);
+// Like SendMsg, but fails with E_PENDING instead of waiting while the host has no credit to send, see
+// HostInitMsg::SendWindow. Passed to InitFlowControl() of a module DLL exporting it.
+typedef HRESULT(CALLBACK* TrySendMsg)(void* mod, PCSTR msg, const Guid* service, DWORD session);
 // Diagnostic output a spdlog logger within a module will use
 typedef HRESULT(CALLBACK* SendDiag)(void* mod, PCSTR msg);
+
+// A message handed to OnMessages() of a module DLL exporting it, Msg isn't zero-terminated.
+struct MsgSpan final
+{
+    PCSTR              Msg;
+    DWORD              Size;
+    const ipc::Target* Target;
+};
 }
@@ -0,0 +1,90 @@
+#pragma once
+
+// The IPC core (framing, transports, Guid) is also built on POSIX systems so that the broker/host protocol can be
+// load-tested on Linux. On Windows this just pulls in the usual headers. Elsewhere it provides the few Win32 types
+// and a minimal subset of the wil error handling macros used by those sources.
+
+#ifdef _WIN32
+#    include <Windows.h>
+#    include <wil/result.h>
+#else
+#    include <cerrno>
+#    include <cstdint>
+#    include <cstdlib>
+#    include <cstdio>
+#    include <stdexcept>
+
+using DWORD   = uint32_t;
+using BOOL    = int;
+using HRESULT = int32_t;
+using PCSTR   = const char*;
+using PCWSTR  = const wchar_t*;
+
+struct GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t  Data4[8];
+};
+inline constexpr GUID GUID_NULL {};
+
+#    define CALLBACK
+
+#    define S_OK ((HRESULT)0L)
+#    define S_FALSE ((HRESULT)1L)
+#    define E_FAIL ((HRESULT)0x80004005L)
+#    define E_NOTIMPL ((HRESULT)0x80004001L)
+#    define E_INVALIDARG ((HRESULT)0x80070057L)
+#    define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#    define E_UNEXPECTED ((HRESULT)0x8000FFFFL)
+#    define E_NOT_VALID_STATE ((HRESULT)0x8007139FL)
+#    define E_PENDING ((HRESULT)0x8000000AL)
+#    define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#    define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+// errno values are mapped into the FACILITY_WIN32 range, like HRESULT_FROM_WIN32 does for GetLastError().
+#    define HRESULT_FROM_ERRNO(e) ((HRESULT)(((e)&0x0000FFFF) | 0x80070000))
+
+#    define RETURN_HR(hr) return (hr)
+#    define RETURN_IF_FAILED(hr)                                                                                       \
+        do                                                                                                             \
+        {                                                                                                              \
+            const HRESULT __hrRet = (hr);                                                                              \
+            if (FAILED(__hrRet))                                                                                       \
+                return __hrRet;                                                                                        \
+        } while (0)
+#    define RETURN_HR_IF(hr, cond)                                                                                     \
+        do                                                                                                             \
+        {                                                                                                              \
+            if (cond)                                                                                                  \
+                return (hr);                                                                                           \
+        } while (0)
+#    define RETURN_HR_IF_MSG(hr, cond, fmt, ...) RETURN_HR_IF(hr, cond)
+#    define RETURN_HR_IF_EXPECTED(hr, cond) RETURN_HR_IF(hr, cond)
+#    define RETURN_IF_FAILED_EXPECTED(hr) RETURN_IF_FAILED(hr)
+#    define RETURN_HR_IF_NULL(hr, ptr) RETURN_HR_IF(hr, (ptr) == nullptr)
+#    define RETURN_LAST_ERROR_IF(cond) RETURN_HR_IF(HRESULT_FROM_ERRNO(errno), cond)
+#    define LOG_IF_FAILED(hr) (hr)
+#    define LOG_HR_MSG(hr, fmt, ...) ((void)(hr))
+#    define CATCH_RETURN()                                                                                             \
+        catch (...)                                                                                                    \
+        {                                                                                                              \
+            return E_FAIL;                                                                                             \
+        }
+#    define THROW_HR_IF(hr, cond)                                                                                      \
+        do                                                                                                             \
+        {                                                                                                              \
+            if (cond)                                                                                                  \
+                throw std::runtime_error("HRESULT failure");                                                           \
+        } while (0)
+#    define FAIL_FAST_IF(cond)                                                                                         \
+        do                                                                                                             \
+        {                                                                                                              \
+            if (cond)                                                                                                  \
+                std::abort();                                                                                          \
+        } while (0)
+#    define FAIL_FAST_IF_MSG(cond, fmt, ...) FAIL_FAST_IF(cond)
+#    define FAIL_FAST_IF_FAILED(hr) FAIL_FAST_IF(FAILED(hr))
+#    define FAIL_FAST_IF_FAILED_MSG(hr, fmt, ...) FAIL_FAST_IF(FAILED(hr))
+#endif
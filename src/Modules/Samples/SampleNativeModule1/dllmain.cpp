@@ -10,6 +10,12 @@ extern "C" __declspec(dllexport) HRESULT InitModule(void* mod, ipc::SendMsg send
     return S_OK;
 }
 
+extern "C" __declspec(dllexport) HRESULT InitFlowControl(ipc::TrySendMsg trySendMsg)
+{
+    RETURN_IF_FAILED(g_module.InitFlowControl(trySendMsg));
+    return S_OK;
+}
+
 extern "C" __declspec(dllexport) HRESULT TermModule()
 {
     RETURN_IF_FAILED(g_module.Terminate());
@@ -22,6 +28,17 @@ extern "C" __declspec(dllexport) HRESULT OnMessage(PCSTR msg, const ipc::Target*
     return S_OK;
 }
 
+extern "C" __declspec(dllexport) HRESULT OnMessages(const ipc::MsgSpan* msgs, DWORD count)
+{
+    return g_module.HandleMessages(msgs, count);
+}
+
+extern "C" __declspec(dllexport) HRESULT OnMessageChunk(
+    PCSTR chunk, DWORD size, DWORD offset, DWORD total, const ipc::Target* target)
+{
+    return g_module.HandleChunk(std::string_view(chunk, size), offset, total, *target);
+}
+
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved)
 {
     switch (ul_reason_for_call)
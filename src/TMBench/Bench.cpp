@@ -0,0 +1,147 @@
+#include "pch.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "Bench.h"
+#ifndef _WIN32
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+namespace Bench
+{
+namespace
+{
+// Rounds of a full measurement, after one to warm up. The median is reported, so an outlier doesn't skew it.
+const size_t Rounds = 7;
+}
+
+size_t Ops(const Options& options, size_t full)
+{
+    return options.Quick ? std::max<size_t>(full / 100, 10) : full;
+}
+
+bool Check(bool ok, const char* what)
+{
+    if (!ok)
+        printf("  CHECK FAILED: %s\n", what);
+    return ok;
+}
+
+void Measure(
+    const Options& options, std::string_view name, size_t ops, const std::function<void()>& round, size_t bytesPerOp)
+{
+    if (!options.Quick)
+        round();
+
+    std::vector<double> nanos;
+    for (size_t n = 0; n < (options.Quick ? 1 : Rounds); ++n)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        round();
+        const std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+        nanos.push_back(took.count() / (double)ops);
+    }
+    std::sort(nanos.begin(), nanos.end());
+
+    const double median = nanos[nanos.size() / 2];
+    printf("  %-36.*s %10.1f ns/op %9.3f Mop/s", (int)name.size(), name.data(), median, 1e3 / median);
+    if (bytesPerOp)
+        printf(" %9.1f MB/s", (double)bytesPerOp * 1e3 / median);
+    printf("   [%.1f .. %.1f]\n", nanos.front(), nanos.back());
+    fflush(stdout);
+}
+
+void Section(std::string_view title)
+{
+    printf("%.*s\n", (int)title.size(), title.data());
+}
+
+HRESULT CreatePipe(ipc::Handle& read, ipc::Handle& write) noexcept
+{
+#ifdef _WIN32
+    RETURN_IF_WIN32_BOOL_FALSE(::CreatePipe(&read, &write, nullptr, 0));
+#else
+    int fds[2];
+    RETURN_LAST_ERROR_IF(::pipe2(fds, O_CLOEXEC) != 0);
+    read  = fds[0];
+    write = fds[1];
+#endif
+    return S_OK;
+}
+
+void ClosePipe(ipc::Handle handle) noexcept
+{
+#ifdef _WIN32
+    ::CloseHandle(handle);
+#else
+    ::close(handle);
+#endif
+}
+
+HRESULT WriteAll(ipc::Handle out, const void* data, size_t size) noexcept
+{
+    auto next = static_cast<const uint8_t*>(data);
+    while (size)
+    {
+#ifdef _WIN32
+        DWORD written = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(::WriteFile(out, next, (DWORD)size, &written, nullptr));
+#else
+        const ssize_t written = ::write(out, next, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        RETURN_LAST_ERROR_IF(written <= 0);
+#endif
+        next += written;
+        size -= (size_t)written;
+    }
+    return S_OK;
+}
+
+HRESULT Connection::Open(std::shared_ptr<ipc::Transport> sender, std::shared_ptr<ipc::Transport> receiver)
+{
+    sender_   = std::move(sender);
+    receiver_ = std::move(receiver);
+    sender_->SetFrameVersion(ipc::FrameVersion::Latest);
+    return receiver_->StartRead(
+        reader_,
+        [this](const std::string_view msg, const ipc::Target& target) {
+            if (collect_.load(std::memory_order_relaxed))
+                collected_.push_back({std::string(msg), target});
+            received_.fetch_add(1, std::memory_order_release);
+            return false;
+        },
+        0);
+}
+
+Connection::~Connection()
+{
+    if (sender_)
+        sender_->Close();
+}
+
+void Connection::WaitFor(size_t count)
+{
+    waitedFor_ += count;
+    while (received_.load(std::memory_order_acquire) < waitedFor_)
+    {
+        std::this_thread::yield();
+    }
+}
+
+std::string MakeMsg(size_t size, unsigned seed)
+{
+    std::mt19937                       random(seed);
+    std::uniform_int_distribution<int> printable('0', 'z');
+
+    std::string msg(size, ' ');
+    for (auto& c : msg)
+    {
+        c = (char)printable(random);
+    }
+    return msg;
+}
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "platform.h"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "ipc.h"
+#include "Transport.h"
+
+// Helpers shared by the benches of TMBench, see TMBench.cpp.
+namespace Bench
+{
+struct Options
+{
+    // Runs the checks and a single short round of each measurement, e.g. for ctest.
+    bool Quick = false;
+};
+
+// Operations per round of a measurement, a small fraction of full in a quick run.
+size_t Ops(const Options& options, size_t full);
+
+// Prints what failed unless ok. Returns ok.
+bool Check(bool ok, const char* what);
+
+// Calls round() a few times, each doing ops operations, and prints the median time per operation.
+// With bytesPerOp the throughput is printed as well.
+void Measure(const Options& options, std::string_view name, size_t ops, const std::function<void()>& round,
+    size_t bytesPerOp = 0);
+
+// Prints a heading for the measurements following.
+void Section(std::string_view title);
+
+// An anonymous pipe, on Windows neither end is opened for overlapped I/O.
+HRESULT CreatePipe(ipc::Handle& read, ipc::Handle& write) noexcept;
+void    ClosePipe(ipc::Handle handle) noexcept;
+// Blocks until all of data is written.
+HRESULT WriteAll(ipc::Handle out, const void* data, size_t size) noexcept;
+
+// Two ends of a transport, the receiving one is read by a thread of its own which counts what arrives.
+class Connection final
+{
+public:
+    // Sends with the latest frame version.
+    HRESULT Open(std::shared_ptr<ipc::Transport> sender, std::shared_ptr<ipc::Transport> receiver);
+    ~Connection();
+
+    ipc::Transport& Sender()
+    {
+        return *sender_;
+    }
+
+    // Waits until count msgs more than before arrived.
+    void WaitFor(size_t count);
+
+    // Msgs received from now on are kept, see Collected().
+    void Collect(bool collect)
+    {
+        collect_.store(collect, std::memory_order_relaxed);
+    }
+
+    struct Msg
+    {
+        std::string Bytes;
+        ipc::Target Target;
+    };
+    // Only valid once WaitFor() returned.
+    std::vector<Msg>& Collected()
+    {
+        return collected_;
+    }
+
+private:
+    std::shared_ptr<ipc::Transport> sender_;
+    std::shared_ptr<ipc::Transport> receiver_;
+    std::jthread                    reader_;
+    std::atomic<size_t>             received_ {0};
+    size_t                          waitedFor_ = 0;
+    std::atomic<bool>               collect_ {false};
+    std::vector<Msg>                collected_;
+};
+
+// A message of size bytes of printable characters, the same for every run.
+std::string MakeMsg(size_t size, unsigned seed = 1);
+
+// The benches, each returns false if one of its checks failed.
+bool Framing(const Options& options);
+bool FrameReading(const Options& options);
+bool SharedMemory(const Options& options);
+bool Routing(const Options& options);
+bool ServiceIds(const Options& options);
+bool Dispatching(const Options& options);
+bool ManagedBridging(const Options& options);
+bool Guids(const Options& options);
+bool EventLoops(const Options& options);
+bool Urings(const Options& options);
+bool JsonPeeks(const Options& options);
+}
@@ -0,0 +1,140 @@
+#include "pch.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "Bench.h"
+#include "ManagedBridge.h"
+
+namespace Bench
+{
+namespace
+{
+// Sizes of the msgs delivered to the managed modules.
+const size_t Sizes[] = {100, 1000, 10'000};
+
+const size_t Msgs = 2'000'000;
+
+// What the stub delegates standing in for SharedManagedUtils.Ipc.MessageFromHostToModule got last.
+struct Delivered
+{
+    const char* Msg     = nullptr;
+    size_t      Size    = 0;
+    GUID        Service = {};
+    int32_t     Session = 0;
+    size_t      Calls   = 0;
+} delivered;
+
+int CORECLR_DELEGATE_CALLTYPE ToModule(const char* msg, int32_t size, const GUID* service, int32_t session)
+{
+    delivered = {msg, (size_t)size, *service, session, delivered.Calls + 1};
+    return 0;
+}
+
+// The signature of MessageFromHostToModule before, zero-terminated UTF-16 strings.
+int CORECLR_DELEGATE_CALLTYPE ToModuleBefore(const wchar_t* msg, const wchar_t* service, int32_t session)
+{
+    delivered.Size += wcslen(msg) + (size_t)service[1] + (size_t)session;
+    ++delivered.Calls;
+    return 0;
+}
+
+// What ManagedHost::Deliver did before each call to the managed module: transcode the msg to UTF-16.
+std::wstring ToUtf16(const std::string_view utf8)
+{
+#ifdef _WIN32
+    return Strings::ToUtf16(utf8);
+#else
+    // Decodes by hand for lack of MultiByteToWideChar, the msgs are valid UTF-8. wchar_t is 32 bits wide here.
+    std::wstring utf16;
+    utf16.reserve(utf8.size());
+    for (size_t n = 0; n < utf8.size();)
+    {
+        const auto lead   = (uint8_t)utf8[n];
+        const int  length = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+
+        uint32_t c = length == 1 ? lead : lead & (0x7F >> length);
+        for (int i = 1; i < length && n + i < utf8.size(); ++i)
+        {
+            c = (c << 6) | ((uint8_t)utf8[n + i] & 0x3F);
+        }
+        utf16.push_back((wchar_t)c);
+        n += (size_t)length;
+    }
+    return utf16;
+#endif
+}
+
+// A JSON msg of about size bytes, with some characters beyond ASCII.
+std::string MakeJson(size_t size)
+{
+    std::string msg = "{\"Key\":\"";
+    while (msg.size() < size - 2)
+    {
+        msg += "abc\xc3\xa4xyz";
+    }
+    return msg + "\"}";
+}
+}
+
+bool ManagedBridging(const Options& options)
+{
+    Guid service;
+    (void)service.Parse("{8583CDC9-DB92-45BE-90CE-4D3AA4CD14F5}");
+    const ipc::Target target(service, 7);
+
+    // The managed side gets the bytes of the msg, not a copy, and the binary GUID.
+    bool       ok  = true;
+    const auto msg = MakeJson(1000);
+    ok &= Check(ManagedBridge::Deliver(ToModule, msg, target) == 0, "Deliver()");
+    ok &= Check(delivered.Msg == msg.data() && delivered.Size == msg.size(), "msg delivered in place");
+    ok &= Check(memcmp(&delivered.Service, &service, sizeof(GUID)) == 0 && delivered.Session == 7, "target delivered");
+
+    // What a module sends comes back as sent, invalid arguments are rejected.
+    std::string_view message;
+    ipc::Target      received;
+    const HRESULT    hr = ManagedBridge::FromModule(msg.data(), (int32_t)msg.size(), &service, 7, message, received);
+    ok &= Check(SUCCEEDED(hr) && message == msg && received == target, "FromModule() round trip");
+    ok &= Check(SUCCEEDED(ManagedBridge::FromModule(nullptr, 0, &service, 7, message, received)) && message.empty(),
+        "FromModule() empty msg");
+    ok &= Check(ManagedBridge::FromModule(msg.data(), 1, nullptr, 7, message, received) == E_INVALIDARG,
+        "FromModule() rejects no service");
+    ok &= Check(ManagedBridge::FromModule(msg.data(), -1, &service, 7, message, received) == E_INVALIDARG,
+        "FromModule() rejects a negative size");
+    ok &= Check(ManagedBridge::FromModule(nullptr, 1, &service, 7, message, received) == E_INVALIDARG,
+        "FromModule() rejects no msg with a size");
+
+    // The baseline transcodes what the managed side decodes again.
+    ok &= Check(ToUtf16(MakeJson(20)) == L"{\"Key\":\"abc\u00e4xyzabc\u00e4xyz\"}", "ToUtf16()");
+    if (!ok)
+        return false;
+
+    // Called through a pointer the compiler can't see through, like the delegate of the runtime.
+    ManagedBridge::ToModule volatile   toModule       = ToModule;
+    decltype(&ToModuleBefore) volatile toModuleBefore = ToModuleBefore;
+    for (const size_t size : Sizes)
+    {
+        const auto   json  = MakeJson(size);
+        const size_t count = Ops(options, Msgs / (size / 100));
+        char         name[64];
+
+        snprintf(name, sizeof(name), "%zu B, UTF-8 span", json.size());
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                (void)ManagedBridge::Deliver(toModule, json, target);
+            }
+        });
+
+        snprintf(name, sizeof(name), "%zu B, UTF-16 strings (before)", json.size());
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                const std::wstring m = ToUtf16(json);
+                const std::wstring s = target.Service.ToUtf16();
+                (void)toModuleBefore(m.c_str(), s.c_str(), (int32_t)target.Session);
+            }
+        });
+    }
+    return Check(delivered.Calls != 0, "msgs delivered");
+}
+}
@@ -0,0 +1,278 @@
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Bench.h"
+#include "Dispatcher.h"
+#include "FrameReader.h"
+#include "OutboundQueue.h"
+#include "ServiceTable.h"
+#include "Transport.h"
+
+namespace Bench
+{
+namespace
+{
+// A single busy host sends msgs of that size to that many services, each of which has that many recipients.
+const size_t MsgSize    = 1024;
+const size_t Services   = 64;
+const size_t Recipients = 16;
+
+const size_t Msgs = 100'000;
+
+// Thread counts the dispatcher runs with, 0 for routing inline on the reader thread.
+const size_t Threads[] = {0, 1, 2, 4, Dispatcher::MaxThreads};
+
+// Of the dispatcher held up while checking how it holds off the sender.
+const size_t Capacity = 16;
+
+// Stands in for the connection to a host, counts what its OutboundQueue writes. Checks that msgs to the same
+// service arrive in the order sent, their session is the sequence number.
+class Sink final : public ipc::Transport
+{
+public:
+    HRESULT Send(const std::string_view, const ipc::Target&) noexcept override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT SendFrame(const ipc::Frame& frame) noexcept override
+    {
+        if (check_)
+        {
+            std::string_view msg;
+            ipc::Target      target;
+            ipc::ChunkInfo   chunk;
+            if (!ipc::DecodeFrame(frame.Data(), frame.Size(), msg, target, chunk) || msg.size() != MsgSize ||
+                target.Id >= last_.size() || (last_[target.Id] != Unseen && target.Session <= last_[target.Id]))
+                ordered_ = false;
+            else
+                last_[target.Id] = target.Session;
+        }
+        received_.fetch_add(1, std::memory_order_release);
+        return S_OK;
+    }
+
+    HRESULT SendDiag(const std::string_view) noexcept override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT StartRead(std::jthread&, ipc::OnMessage, DWORD) noexcept override
+    {
+        return E_NOTIMPL;
+    }
+
+    HRESULT StartReadDiag(std::jthread&, ipc::OnDiag, DWORD) noexcept override
+    {
+        return E_NOTIMPL;
+    }
+
+    void Close() noexcept override
+    {
+    }
+
+    // Only to be called before the first frame is written.
+    void Check(size_t services)
+    {
+        check_ = true;
+        last_.assign(services, Unseen);
+    }
+
+    size_t Received() const
+    {
+        return received_.load(std::memory_order_acquire);
+    }
+
+    // Only valid once all frames were received.
+    bool Ordered() const
+    {
+        return ordered_;
+    }
+
+private:
+    static constexpr DWORD Unseen = ~DWORD(0);
+
+    std::atomic<size_t> received_ {0};
+    bool                check_   = false;
+    bool                ordered_ = true;
+    std::vector<DWORD>  last_;
+};
+
+// What Orchestrator does with a msg of a host once it's clear it isn't for the broker itself: frame it once and queue
+// it to every recipient.
+class Router final
+{
+public:
+    explicit Router(bool check)
+    {
+        for (size_t n = 0; n < Recipients; ++n)
+        {
+            auto sink = std::make_shared<Sink>();
+            auto out  = std::make_shared<OutboundQueue>(
+                OutboundQueue::DefaultCapacity, OutboundQueue::OverflowPolicy::Block);
+            // Ids up to the highest one used, whether or not interned by this bench.
+            if (check)
+                sink->Check(ipc::Services().Count());
+            (void)out->Start(sink, (DWORD)n);
+            sinks_.push_back(std::move(sink));
+            queues_.push_back(std::move(out));
+        }
+    }
+
+    ~Router()
+    {
+        for (const auto& out : queues_)
+        {
+            out->Close();
+        }
+    }
+
+    void Route(const std::string_view msg, const ipc::Target& target)
+    {
+        const ipc::Frame frame(msg, target, ipc::FrameVersion::Latest);
+        for (const auto& out : queues_)
+        {
+            (void)out->Push(frame);
+        }
+    }
+
+    // Waits until each recipient got count msgs more than before.
+    void WaitFor(size_t count)
+    {
+        waitedFor_ += count;
+        for (const auto& sink : sinks_)
+        {
+            while (sink->Received() < waitedFor_)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool Ordered() const
+    {
+        return std::all_of(sinks_.begin(), sinks_.end(), [](const auto& sink) { return sink->Ordered(); });
+    }
+
+private:
+    std::vector<std::shared_ptr<Sink>>          sinks_;
+    std::vector<std::shared_ptr<OutboundQueue>> queues_;
+    size_t                                      waitedFor_ = 0;
+};
+
+// Sends count msgs through router, inline or on a dispatcher with that many threads.
+bool Send(
+    Router& router, size_t threads, const std::vector<ipc::Target>& targets, const std::string& msg, size_t count)
+{
+    Dispatcher dispatcher;
+    if (threads)
+    {
+        const HRESULT hr = dispatcher.Start(
+            [&](const Dispatcher::Item& item) { router.Route(item.Msg, item.Target); }, threads);
+        if (!Check(SUCCEEDED(hr), "Dispatcher::Start()"))
+            return false;
+    }
+
+    for (size_t n = 0; n < count; ++n)
+    {
+        auto target    = targets[n % targets.size()];
+        target.Session = (DWORD)n;
+        if (threads)
+            (void)dispatcher.Post({msg, target, nullptr, nullptr});
+        else
+            router.Route(msg, target);
+    }
+    router.WaitFor(count);
+    return true;
+}
+
+// Posted with resume, as an event loop thread does, nothing blocks: past the capacity the sender is told to hold off
+// and resumed once the thread took what's queued.
+bool HoldOff(const ipc::Target& target)
+{
+    std::atomic<bool>   held {true};
+    std::atomic<size_t> handling {0};
+    std::atomic<size_t> handled {0};
+    std::atomic<size_t> resumed {0};
+    Dispatcher          dispatcher;
+    const HRESULT       hr = dispatcher.Start(
+        [&](const Dispatcher::Item&) {
+            handling.fetch_add(1, std::memory_order_release);
+            while (held.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            handled.fetch_add(1, std::memory_order_release);
+        },
+        1, Capacity);
+    if (!Check(SUCCEEDED(hr), "Dispatcher::Start()"))
+        return false;
+
+    // The thread is stuck with the first, the lane fills up behind it.
+    bool ok = Check(SUCCEEDED(dispatcher.Post({"", target, nullptr, nullptr})), "Post()");
+    while (!handling.load(std::memory_order_acquire))
+    {
+        std::this_thread::yield();
+    }
+
+    size_t full = 0;
+    for (size_t n = 0; n < 2 * Capacity; ++n)
+    {
+        const HRESULT posted = dispatcher.Post({"", target, nullptr, nullptr}, [&] { resumed.fetch_add(1); });
+        ok &= Check(SUCCEEDED(posted), "Post() with resume");
+        full += posted == S_FALSE;
+    }
+    ok &= Check(full == Capacity && resumed.load() == 0, "sender held off while full");
+
+    held.store(false, std::memory_order_release);
+    while (handled.load(std::memory_order_acquire) < 2 * Capacity + 1)
+    {
+        std::this_thread::yield();
+    }
+    ok &= Check(resumed.load() == full, "sender resumed once per hold off");
+    return ok;
+}
+}
+
+bool Dispatching(const Options& options)
+{
+    std::vector<ipc::Target> targets;
+    for (size_t n = 0; n < Services; ++n)
+    {
+        targets.emplace_back(Guid::CreateNew());
+        targets.back().Id = ipc::Services().Intern(targets.back().Service);
+    }
+    const auto msg = MakeMsg(MsgSize);
+
+    // Every recipient gets every msg, those to a service in order.
+    bool ok = true;
+    for (const size_t threads : Threads)
+    {
+        Router router(true);
+        ok &= Send(router, threads, targets, msg, Services * 20);
+        ok &= Check(router.Ordered(), "msgs to a service in order");
+    }
+    ok &= HoldOff(targets.front());
+    if (!ok)
+        return false;
+
+    printf("  %-36s %10u\n", "cores", std::thread::hardware_concurrency());
+    for (const size_t threads : Threads)
+    {
+        const size_t count = Ops(options, Msgs);
+        char         name[64];
+        Router       router(false);
+
+        if (threads)
+            snprintf(name, sizeof(name), "dispatched, %zu threads", threads);
+        else
+            snprintf(name, sizeof(name), "inline");
+        Measure(options, name, count, [&] { ok &= Send(router, threads, targets, msg, count); }, MsgSize);
+    }
+    return ok;
+}
+}
@@ -0,0 +1,412 @@
+#include "pch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "EventLoop.h"
+#include "ServiceTable.h"
+#include "Transport.h"
+#ifndef _WIN32
+#    include <dirent.h>
+#    include <poll.h>
+#    include <unistd.h>
+#    include <sys/syscall.h>
+#    include <sys/wait.h>
+#endif
+
+namespace Bench
+{
+namespace
+{
+// Hosts read at once, each sends that many msgs of that size, logs a line and exits.
+const size_t Hosts   = 50;
+const size_t MsgSize = 256;
+
+const size_t Msgs = 2'000;
+
+// How long a paused stream has to stay unread, and how long anything may take to arrive before a check fails.
+const auto PauseFor = std::chrono::milliseconds(50);
+const auto Timeout  = std::chrono::seconds(30);
+
+// A host as the broker sees it: frames on stdout, diag on stderr and its exit. A child process on POSIX, on Windows a
+// thread writing to pipes and then setting an event stands in, which saves a host executable.
+struct Host
+{
+    std::shared_ptr<ipc::PipeTransport> Transport;
+    // A pidfd or the event, see EventLoop::WatchExit().
+    ipc::Handle                         Exit = ipc::InvalidHandle;
+#ifdef _WIN32
+    std::thread                         Writer;
+#else
+    pid_t                               Pid  = 0;
+#endif
+};
+
+// What arrived of a host.
+struct Received
+{
+    std::atomic<size_t> Msgs {0};
+    // Only touched by the single read in flight of each stream.
+    bool                Ordered = true;
+    std::string         Diag;
+    std::atomic<int>    Exits {0};
+};
+
+#ifdef _WIN32
+// As the broker creates them for a host, see ChildProcessInstance.cpp.
+HRESULT CreateOverlappedPipe(ipc::Handle& read, ipc::Handle& write) noexcept
+{
+    static std::atomic<uint32_t> serial;
+    const auto name = std::format(L"\\\\.\\pipe\\TMBench-{}-{}", ::GetCurrentProcessId(), ++serial);
+
+    wil::unique_hfile server(::CreateNamedPipeW(name.c_str(),
+        PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, 0, 0, nullptr));
+    RETURN_LAST_ERROR_IF(!server);
+
+    wil::unique_hfile client(
+        ::CreateFileW(name.c_str(), GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    RETURN_LAST_ERROR_IF(!client);
+
+    read  = server.release();
+    write = client.release();
+    return S_OK;
+}
+#else
+// Blocking write for a forked child, nothing which isn't async-signal-safe.
+void WriteRaw(int out, const char* data, size_t size) noexcept
+{
+    while (size)
+    {
+        const ssize_t written = ::write(out, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        data += written;
+        size -= (size_t)written;
+    }
+}
+
+// Threads of this process named by an EventLoop, see SetLoopThreadName().
+size_t LoopThreads()
+{
+    DIR* tasks = ::opendir("/proc/self/task");
+    if (!tasks)
+        return 0;
+
+    size_t count = 0;
+    while (const dirent* task = ::readdir(tasks))
+    {
+        if (task->d_name[0] == '.')
+            continue;
+
+        char path[64], name[32] = {};
+        snprintf(path, sizeof(path), "/proc/self/task/%s/comm", task->d_name);
+        if (FILE* comm = fopen(path, "r"))
+        {
+            count += fgets(name, sizeof(name), comm) && strncmp(name, "TM-Loop-", 8) == 0;
+            fclose(comm);
+        }
+    }
+    ::closedir(tasks);
+    return count;
+}
+#endif
+
+// Starts a host writing frames to stdout and diag to stderr, then exiting. overlapped as the EventLoop needs it.
+HRESULT Spawn(Host& host, const std::string& frames, const std::string& diag, bool overlapped)
+{
+    ipc::Handle outRead, outWrite, errRead, errWrite;
+#ifdef _WIN32
+    RETURN_IF_FAILED(overlapped ? CreateOverlappedPipe(outRead, outWrite) : CreatePipe(outRead, outWrite));
+    RETURN_IF_FAILED(overlapped ? CreateOverlappedPipe(errRead, errWrite) : CreatePipe(errRead, errWrite));
+    host.Exit = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    RETURN_LAST_ERROR_IF_NULL(host.Exit);
+
+    host.Writer = std::thread([&frames, &diag, outWrite, errWrite, exit = host.Exit] {
+        (void)WriteAll(outWrite, frames.data(), frames.size());
+        (void)WriteAll(errWrite, diag.data(), diag.size());
+        ClosePipe(outWrite);
+        ClosePipe(errWrite);
+        ::SetEvent(exit);
+    });
+#else
+    RETURN_IF_FAILED(CreatePipe(outRead, outWrite));
+    RETURN_IF_FAILED(CreatePipe(errRead, errWrite));
+
+    const pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        // The parent has threads, only what's async-signal-safe from here on.
+        WriteRaw(outWrite, frames.data(), frames.size());
+        WriteRaw(errWrite, diag.data(), diag.size());
+        ::_exit(0);
+    }
+    ClosePipe(outWrite);
+    ClosePipe(errWrite);
+    RETURN_LAST_ERROR_IF(pid < 0);
+
+    host.Pid  = pid;
+    host.Exit = (int)::syscall(SYS_pidfd_open, pid, 0);
+    RETURN_LAST_ERROR_IF(host.Exit < 0);
+#endif
+
+    host.Transport = std::make_shared<ipc::PipeTransport>(outRead, ipc::InvalidHandle, errRead);
+    return S_OK;
+}
+
+// Blocks until host exited, then closes its exit handle.
+void WaitExit(ipc::Handle exit)
+{
+#ifdef _WIN32
+    ::WaitForSingleObject(exit, INFINITE);
+    ::CloseHandle(exit);
+#else
+    pollfd fd {exit, POLLIN, 0};
+    while (::poll(&fd, 1, -1) < 0 && errno == EINTR)
+    {
+    }
+    ::close(exit);
+#endif
+}
+
+void Reap(Host& host)
+{
+#ifdef _WIN32
+    if (host.Writer.joinable())
+        host.Writer.join();
+#else
+    if (host.Pid > 0)
+        (void)::waitpid(host.Pid, nullptr, 0);
+#endif
+}
+
+// Waits until done, false if that takes too long.
+bool WaitUntil(const std::function<bool()>& done)
+{
+    const auto deadline = std::chrono::steady_clock::now() + Timeout;
+    while (!done())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+// A frame of each of count msgs, their session is the sequence number.
+std::string EncodeFrames(size_t count)
+{
+    ipc::Target target(Guid::CreateNew());
+    target.Id = ipc::Services().Intern(target.Service);
+
+    const auto  msg = MakeMsg(MsgSize);
+    std::string frames;
+    for (size_t n = 0; n < count; ++n)
+    {
+        target.Session = (DWORD)n;
+        const ipc::Frame frame(msg, target, ipc::FrameVersion::Latest);
+        frames.append((const char*)frame.Data(), frame.Size());
+    }
+    return frames;
+}
+
+std::string DiagOf(size_t host)
+{
+    char line[32];
+    snprintf(line, sizeof(line), "[INF] host %zu done\n", host);
+    return line;
+}
+
+// Spawns Hosts sending the msgs of frames and reads them as the broker does, on loop, or with a reader thread per
+// pipe and a thread waiting for each exit as before there was one. If threads, the ids of those which delivered
+// anything are added.
+bool FanIn(ipc::EventLoop* loop, const std::string& frames, size_t count, std::set<std::thread::id>* threads = nullptr)
+{
+    std::vector<Host>         hosts(Hosts);
+    std::vector<Received>     received(Hosts);
+    std::vector<std::jthread> readers;
+    std::mutex                lock;
+    // Msgs complete, diag complete and exited, for each host.
+    std::atomic<size_t>       pending {Hosts * 3};
+    readers.reserve(Hosts * 3);
+
+    const auto seen = [&] {
+        if (threads)
+        {
+            std::scoped_lock guard(lock);
+            threads->insert(std::this_thread::get_id());
+        }
+    };
+
+    bool ok = true;
+    for (size_t h = 0; h < Hosts; ++h)
+    {
+        auto&      host = hosts[h];
+        auto&      got  = received[h];
+        const auto diag = DiagOf(h);
+        ok &= Check(SUCCEEDED(Spawn(host, frames, diag, loop != nullptr)), "host spawned");
+        if (!host.Transport)
+            break;
+
+        auto onMessage = [&, count](const std::string_view msg, const ipc::Target& target) {
+            seen();
+            const size_t n = got.Msgs.load(std::memory_order_relaxed);
+            got.Ordered &= msg.size() == MsgSize && target.Session == (DWORD)n;
+            got.Msgs.store(n + 1, std::memory_order_release);
+            if (n + 1 == count)
+                pending.fetch_sub(1, std::memory_order_release);
+            return false;
+        };
+        auto onDiag = [&, size = diag.size()](const std::string_view output) {
+            seen();
+            got.Diag.append(output);
+            if (got.Diag.size() == size)
+                pending.fetch_sub(1, std::memory_order_release);
+        };
+        auto onExit = [&] {
+            seen();
+            if (got.Exits.fetch_add(1) == 0)
+                pending.fetch_sub(1, std::memory_order_release);
+        };
+
+        if (loop)
+        {
+            ok &= Check(SUCCEEDED(host.Transport->StartRead(*loop, onMessage)), "stdout read by the loop");
+            ok &= Check(SUCCEEDED(host.Transport->StartReadDiag(*loop, onDiag)), "stderr read by the loop");
+            ok &= Check(SUCCEEDED(loop->WatchExit(host.Exit, onExit)), "exit watched by the loop");
+        }
+        else
+        {
+            ok &= Check(SUCCEEDED(host.Transport->StartRead(readers.emplace_back(), onMessage, 0)), "stdout read");
+            ok &= Check(SUCCEEDED(host.Transport->StartReadDiag(readers.emplace_back(), onDiag, 0)), "stderr read");
+            readers.emplace_back([exit = host.Exit, onExit] {
+                WaitExit(exit);
+                onExit();
+            });
+        }
+    }
+
+    ok &= Check(ok && WaitUntil([&] { return !pending.load(std::memory_order_acquire); }),
+        "all read and exits seen in time");
+    for (size_t h = 0; ok && h < Hosts; ++h)
+    {
+        const auto& got = received[h];
+        ok &= Check(got.Msgs.load() == count && got.Ordered, "msgs of each host complete and in order");
+        ok &= Check(got.Diag == DiagOf(h), "diag of each host complete");
+        ok &= Check(got.Exits.load() == 1, "exit of each host seen once");
+    }
+
+    for (auto& host : hosts)
+    {
+        Reap(host);
+    }
+    // The reader threads end as the hosts closed their pipes.
+    readers.clear();
+    return ok;
+}
+
+// A stream paused while handling a msg isn't read until resumed, one still paused is released by Stop().
+bool PauseResume(bool uring)
+{
+    ipc::EventLoop loop(uring);
+    if (!Check(SUCCEEDED(loop.Start(2)), "EventLoop::Start()"))
+        return false;
+
+    ipc::Handle read, write;
+#ifdef _WIN32
+    if (!Check(SUCCEEDED(CreateOverlappedPipe(read, write)), "pipe created"))
+        return false;
+#else
+    if (!Check(SUCCEEDED(CreatePipe(read, write)), "pipe created"))
+        return false;
+#endif
+    auto                transport = std::make_shared<ipc::PipeTransport>(read, ipc::InvalidHandle, ipc::InvalidHandle);
+    std::atomic<size_t> received {0};
+    std::atomic<size_t> paused {0};
+
+    // Pauses on the first and the third msg. Not owned, the stream owns the transport.
+    bool ok = Check(SUCCEEDED(transport->StartRead(loop,
+                        [&, self = transport.get()](const std::string_view, const ipc::Target&) {
+                            const size_t n = received.load(std::memory_order_relaxed);
+                            if ((n == 0 || n == 2) && self->PauseRead())
+                                paused.fetch_add(1, std::memory_order_relaxed);
+                            received.store(n + 1, std::memory_order_release);
+                            return false;
+                        })),
+        "read by the loop");
+
+    const auto frames   = EncodeFrames(3);
+    const auto size     = frames.size() / 3;
+    const auto readUpTo = [&](size_t n) {
+        return WaitUntil([&] { return received.load(std::memory_order_acquire) == n; });
+    };
+
+    ok &= Check(SUCCEEDED(WriteAll(write, frames.data(), size)) && readUpTo(1), "msg read");
+    ok &= Check(paused.load() == 1, "PauseRead() while read by the loop");
+
+    ok &= Check(SUCCEEDED(WriteAll(write, frames.data() + size, size)), "msg written");
+    std::this_thread::sleep_for(PauseFor);
+    ok &= Check(received.load() == 1, "nothing read while paused");
+
+    transport->ResumeRead();
+    ok &= Check(readUpTo(2), "read on once resumed");
+
+    // Paused once more, then the loop stops.
+    ok &= Check(SUCCEEDED(WriteAll(write, frames.data() + 2 * size, size)) && readUpTo(3) && paused.load() == 2,
+        "paused again");
+    const std::weak_ptr<ipc::PipeTransport> weak = transport;
+    transport.reset();
+    loop.Stop();
+    ok &= Check(weak.expired(), "paused stream released by Stop()");
+
+    ClosePipe(write);
+    return ok;
+}
+}
+
+bool EventLoops(const Options& options)
+{
+    const size_t count  = Ops(options, Msgs);
+    const auto   frames = EncodeFrames(count);
+
+    // With io_uring, where available, and with epoll, as the broker runs either.
+    bool ok = true;
+    for (const bool uring : {true, false})
+    {
+        ipc::EventLoop loop(uring);
+        ok &= Check(SUCCEEDED(loop.Start()), "EventLoop::Start()");
+#ifndef _WIN32
+        // Once they named themselves.
+        ok &= Check(WaitUntil([] { return LoopThreads() == ipc::EventLoop::DefaultThreads(); }),
+            "loop threads as many as picked by default");
+#endif
+        std::set<std::thread::id> threads;
+        ok &= FanIn(&loop, frames, count, &threads);
+        ok &= Check(threads.size() <= ipc::EventLoop::DefaultThreads(), "read and exits seen by the loop threads only");
+        ok &= PauseResume(uring);
+    }
+    if (!ok)
+        return false;
+
+    printf("  %-36s %10zu\n", "hosts", Hosts);
+    printf("  %-36s %10zu\n", "loop threads", ipc::EventLoop::DefaultThreads());
+
+    ipc::EventLoop loop;
+    ok &= Check(SUCCEEDED(loop.Start()), "EventLoop::Start()");
+    Measure(options, loop.UsesUring() ? "EventLoop (io_uring)" : "EventLoop", Hosts * count,
+        [&] { ok &= FanIn(&loop, frames, count); }, MsgSize);
+    Measure(options, "reader threads (before)", Hosts * count, [&] { ok &= FanIn(nullptr, frames, count); }, MsgSize);
+    return ok;
+}
+}
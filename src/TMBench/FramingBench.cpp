@@ -0,0 +1,266 @@
+#include "pch.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "FrameReader.h"
+#include "Transport.h"
+
+namespace Bench
+{
+namespace
+{
+// Sizes of the msgs sent and how many of them per round. The largest is sent in chunks.
+struct Load
+{
+    size_t Size;
+    size_t Count;
+};
+const Load Loads[] = {{64, 200'000}, {1024, 100'000}, {16 * 1024, 20'000}, {256 * 1024, 1'000}};
+
+// What ipc::Send did before it wrote gather lists: the msg copied behind the header into a buffer of its own.
+HRESULT SendCopy(ipc::Transport& transport, const std::string_view msg, const ipc::Target& target) noexcept
+try
+{
+    return transport.SendFrame(ipc::Frame(msg, target, transport.GetFrameVersion()));
+}
+CATCH_RETURN();
+
+// Msg sizes read and how many frames of them per round.
+const Load ReadLoads[] = {{64, 500'000}, {1024, 200'000}, {16 * 1024, 20'000}};
+
+// What ipc::StartRead did before FrameReader: the length prefix and then the rest of a frame read on their own, into
+// a vector allocated per frame. Chunked frames aren't put together.
+class FrameByFrame final
+{
+public:
+    HRESULT ReadFrame(ipc::Handle in, const ipc::OnMessage& onMessage)
+    {
+        DWORD size = 0;
+        RETURN_HR_IF(S_FALSE, !ReadExact(in, &size, sizeof(size)));
+
+        std::vector<uint8_t> frame(sizeof(size) + size);
+        memcpy(frame.data(), &size, sizeof(size));
+        RETURN_HR_IF(E_FAIL, !ReadExact(in, frame.data() + sizeof(size), size));
+
+        std::string_view msg;
+        ipc::Target      target;
+        ipc::ChunkInfo   chunk;
+        RETURN_HR_IF(E_FAIL, !ipc::DecodeFrame(frame.data(), frame.size(), msg, target, chunk));
+        return onMessage(msg, target) ? S_FALSE : S_OK;
+    }
+
+    uint64_t Reads() const
+    {
+        return reads_;
+    }
+
+private:
+    bool ReadExact(ipc::Handle in, void* buf, size_t size)
+    {
+        for (auto next = static_cast<uint8_t*>(buf); size;)
+        {
+            const long read = ipc::ReadSome(in, next, size);
+            ++reads_;
+            if (read <= 0)
+                return false;
+            next += read;
+            size -= (size_t)read;
+        }
+        return true;
+    }
+
+    uint64_t reads_ = 0;
+};
+
+// Writes the frames of msgs to a pipe on a thread of its own, count times over, while the caller reads them.
+class FrameSource final
+{
+public:
+    FrameSource(const std::vector<ipc::Frame>& frames, size_t count)
+    {
+        if (FAILED(CreatePipe(in_, out_)))
+            return;
+
+        writer_ = std::jthread([this, &frames, count] {
+            // A batch of frames per write, like a busy sender.
+            std::vector<uint8_t> batch;
+            for (size_t n = 0; n < count;)
+            {
+                batch.clear();
+                for (; n < count && batch.size() < 64 * 1024; ++n)
+                {
+                    const auto& frame = frames[n % frames.size()];
+                    batch.insert(batch.end(), frame.Data(), frame.Data() + frame.Size());
+                }
+                if (FAILED(WriteAll(out_, batch.data(), batch.size())))
+                    break;
+            }
+            ClosePipe(out_);
+        });
+    }
+
+    ~FrameSource()
+    {
+        if (writer_.joinable())
+            writer_.join();
+        if (in_ != ipc::InvalidHandle)
+            ClosePipe(in_);
+    }
+
+    ipc::Handle In() const
+    {
+        return in_;
+    }
+
+private:
+    ipc::Handle  in_  = ipc::InvalidHandle;
+    ipc::Handle  out_ = ipc::InvalidHandle;
+    std::jthread writer_;
+};
+}
+
+bool Framing(const Options& options)
+{
+    std::shared_ptr<ipc::PipeTransport> sender;
+    std::shared_ptr<ipc::PipeTransport> receiver;
+    Connection                          connection;
+    if (!Check(SUCCEEDED(ipc::PipeTransport::CreatePair(sender, receiver)), "PipeTransport::CreatePair()") ||
+        !Check(SUCCEEDED(connection.Open(sender, receiver)), "connection.Open()"))
+        return false;
+
+    const ipc::Target target(ipc::KnownService::ConfStore, 1);
+
+    // Both send the same msgs.
+    bool ok = true;
+    connection.Collect(true);
+    for (const auto& load : Loads)
+    {
+        const auto msg = MakeMsg(load.Size);
+        ok &= Check(SUCCEEDED(connection.Sender().Send(msg, target)), "Send()");
+        ok &= Check(SUCCEEDED(SendCopy(connection.Sender(), msg, target)), "SendCopy()");
+        connection.WaitFor(2);
+
+        for (const auto& received : connection.Collected())
+        {
+            ok &= Check(received.Bytes == msg, "msg received as sent");
+            ok &= Check(received.Target == target, "target received as sent");
+        }
+        connection.Collected().clear();
+    }
+    connection.Collect(false);
+    if (!ok)
+        return false;
+
+    for (const auto& load : Loads)
+    {
+        const auto   msg   = MakeMsg(load.Size);
+        const size_t count = Ops(options, load.Count);
+        char         name[64];
+
+        snprintf(name, sizeof(name), "%zu B, gather", load.Size);
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                (void)connection.Sender().Send(msg, target);
+            }
+            connection.WaitFor(count);
+        }, load.Size);
+
+        snprintf(name, sizeof(name), "%zu B, copy (before)", load.Size);
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                (void)SendCopy(connection.Sender(), msg, target);
+            }
+            connection.WaitFor(count);
+        }, load.Size);
+    }
+    return true;
+}
+
+bool FrameReading(const Options& options)
+{
+    const ipc::Target target(ipc::KnownService::ConfStore, 1);
+
+    // Legacy and V2 frames of each msg. V2 doesn't chunk, so the largest msg takes the oversized path of FrameReader.
+    std::vector<std::string> msgs;
+    std::vector<ipc::Frame>  frames;
+    for (const size_t size : {1, 100, 5000, 70'000, 64})
+    {
+        msgs.push_back(MakeMsg(size, (unsigned)size));
+        frames.emplace_back(msgs.back(), target, ipc::FrameVersion::V2);
+        frames.emplace_back(msgs.back(), target, ipc::FrameVersion::Legacy);
+    }
+
+    // Both read the same msgs, in the order sent.
+    bool ok = true;
+    for (const bool chunked : {true, false})
+    {
+        FrameSource source(frames, frames.size() * 3);
+        ok &= Check(source.In() != ipc::InvalidHandle, "CreatePipe()");
+
+        size_t     received = 0;
+        const auto verify   = [&](const std::string_view msg, const ipc::Target& receivedTarget) {
+            ok &= Check(msg == msgs[(received % frames.size()) / 2], "msg read as sent");
+            ok &= Check(msg.data()[msg.size()] == 0, "msg zero-terminated");
+            ok &= Check(receivedTarget == target, "target read as sent");
+            return ++received == frames.size() * 3;
+        };
+
+        if (chunked)
+        {
+            ipc::FrameReader reader;
+            ok &= Check(SUCCEEDED(reader.Init()), "FrameReader::Init()");
+            while (reader.ReadChunk(source.In(), verify) == S_OK)
+            {
+            }
+        }
+        else
+        {
+            FrameByFrame reader;
+            while (reader.ReadFrame(source.In(), verify) == S_OK)
+            {
+            }
+        }
+        ok &= Check(received == frames.size() * 3, "all frames read");
+    }
+    if (!ok)
+        return false;
+
+    for (const auto& load : ReadLoads)
+    {
+        const std::vector<ipc::Frame> frame {ipc::Frame(MakeMsg(load.Size), target, ipc::FrameVersion::Latest)};
+        const size_t                  count = Ops(options, load.Count);
+        char                          name[64];
+        double                        readsPerFrame[2] {};
+
+        snprintf(name, sizeof(name), "%zu B, chunked", load.Size);
+        Measure(options, name, count, [&] {
+            FrameSource      source(frame, count);
+            ipc::FrameReader reader;
+            (void)reader.Init();
+            while (reader.ReadChunk(source.In(), [](auto, auto&) { return false; }) == S_OK)
+            {
+            }
+            readsPerFrame[0] = (double)reader.GetStats().Reads / (double)reader.GetStats().Frames;
+        }, load.Size);
+
+        snprintf(name, sizeof(name), "%zu B, frame by frame (before)", load.Size);
+        Measure(options, name, count, [&] {
+            FrameSource  source(frame, count);
+            FrameByFrame reader;
+            while (reader.ReadFrame(source.In(), [](auto, auto&) { return false; }) == S_OK)
+            {
+            }
+            readsPerFrame[1] = (double)reader.Reads() / (double)count;
+        }, load.Size);
+
+        printf("  %-36s %10.3f vs. %.3f\n", "reads per frame", readsPerFrame[0], readsPerFrame[1]);
+    }
+    return true;
+}
+}
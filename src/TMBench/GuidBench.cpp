@@ -0,0 +1,221 @@
+#include "pch.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include <absl/hash/hash.h>
+#include "Bench.h"
+#include "guid.h"
+
+namespace Bench
+{
+namespace
+{
+// GUIDs parsed and formatted, besides the two with all bits clear or set.
+const size_t Random = 1000;
+
+const size_t Conversions = 2'000'000;
+
+// Where the dashes are in a formatted GUID.
+const size_t DashAt[] = {9, 14, 19, 24};
+
+// How ToUtf8() formatted before, where there's no StringFromGUID2.
+std::string FormatPrintf(const Guid& guid)
+{
+    char str[Guid::Length + 1];
+    snprintf(str, sizeof(str), "{%08X-%04X-%04X-%02X%02X-%02X%02X%02X%02X%02X%02X}", guid.Data1, guid.Data2,
+        guid.Data3, guid.Data4[0], guid.Data4[1], guid.Data4[2], guid.Data4[3], guid.Data4[4], guid.Data4[5],
+        guid.Data4[6], guid.Data4[7]);
+    return std::string(str, Guid::Length);
+}
+
+int HexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// How Parse() worked before, where there's no CLSIDFromString: the dashes checked on the way.
+HRESULT ParseLoop(Guid& guid, std::string_view str) noexcept
+{
+    if (str.size() == Guid::Length)
+    {
+        RETURN_HR_IF(E_INVALIDARG, str.front() != '{' || str.back() != '}');
+        str = str.substr(1, 36);
+    }
+    RETURN_HR_IF(E_INVALIDARG, str.size() != 36);
+
+    uint8_t bytes[16];
+    size_t  pos = 0;
+    for (auto& b : bytes)
+    {
+        if (pos == 8 || pos == 13 || pos == 18 || pos == 23)
+        {
+            RETURN_HR_IF(E_INVALIDARG, str[pos] != '-');
+            ++pos;
+        }
+        const int hi = HexValue(str[pos]), lo = HexValue(str[pos + 1]);
+        RETURN_HR_IF(E_INVALIDARG, hi < 0 || lo < 0);
+        b = (uint8_t)(hi << 4 | lo);
+        pos += 2;
+    }
+
+    guid.Data1 = (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+    guid.Data2 = (uint16_t)(bytes[4] << 8 | bytes[5]);
+    guid.Data3 = (uint16_t)(bytes[6] << 8 | bytes[7]);
+    memcpy(guid.Data4, bytes + 8, sizeof(guid.Data4));
+    return S_OK;
+}
+
+// Whether str, formatted GUID but for the character at pos, is still a valid one.
+bool IsValid(const std::string_view str, size_t pos)
+{
+    const char c = str[pos];
+    if (pos == 0)
+        return c == '{';
+    if (pos == Guid::Length - 1)
+        return c == '}';
+    if (std::find(std::begin(DashAt), std::end(DashAt), pos) != std::end(DashAt))
+        return c == '-';
+    return HexValue(c) >= 0;
+}
+
+// Parse() and ParseScalar() both, they have to agree on whether str is valid and on what it holds.
+bool ParseBoth(const std::string_view str, Guid& parsed)
+{
+    Guid          scalar;
+    const HRESULT hr = parsed.Parse(str);
+    return hr == scalar.ParseScalar(str) && (FAILED(hr) || parsed == scalar);
+}
+}
+
+bool Guids(const Options& options)
+{
+    // Random ones and those with all bits clear or set, the digits 0 and F.
+    std::vector<Guid> guids;
+    for (size_t n = 0; n < Random; ++n)
+    {
+        guids.push_back(Guid::CreateNew());
+    }
+    guids.emplace_back();
+    memset((void*)&guids.emplace_back(), 0xFF, sizeof(Guid));
+
+    // Formats as before, SSE2 or not, and parses back in any of the notations accepted.
+    bool            ok = true;
+    std::mt19937_64 random(3);
+    for (const auto& guid : guids)
+    {
+        const std::string str = guid.ToUtf8();
+        char              scalar[Guid::Length];
+        guid.FormatScalar(scalar);
+        ok &= Check(str == FormatPrintf(guid), "ToUtf8() as before");
+        ok &= Check(str == std::string_view(scalar, Guid::Length), "Format() as FormatScalar()");
+
+        std::string lower = str;
+        for (auto& c : lower)
+        {
+            c = (char)tolower((unsigned char)c);
+        }
+        Guid parsed;
+        ok &= Check(ParseBoth(str, parsed) && parsed == guid, "Parse() round trip");
+        ok &= Check(ParseBoth(str.substr(1, 36), parsed) && parsed == guid, "Parse() without braces");
+        ok &= Check(ParseBoth(lower, parsed) && parsed == guid, "Parse() lower case");
+        ok &= Check(SUCCEEDED(parsed.Parse(guid.ToUtf16())) && parsed == guid, "Parse() UTF-16");
+        ok &= Check(absl::Hash<Guid> {}(parsed) == absl::Hash<Guid> {}(guid), "same hash");
+
+        // Any character replaced by any byte is rejected unless it's still valid.
+        for (size_t pos = 0; pos < str.size(); ++pos)
+        {
+            std::string corrupt = str;
+            corrupt[pos]        = (char)(random() % 256);
+            ok &= Check(ParseBoth(corrupt, parsed), "Parse() as ParseScalar() if corrupt");
+            ok &= Check(SUCCEEDED(parsed.Parse(corrupt)) == IsValid(corrupt, pos), "corrupt rejected");
+        }
+    }
+
+    for (const std::string_view bad : {"", "{}", "831532DC-7EFB-4A8C-841B-7BBE21558F8",
+             "{831532DC-7EFB-4A8C-841B-7BBE21558F8F}x", "831532DC7EFB-4A8C-841B-7BBE21558F8F0",
+             "(831532DC-7EFB-4A8C-841B-7BBE21558F8F)"})
+    {
+        Guid parsed;
+        ok &= Check(ParseBoth(bad, parsed) && FAILED(parsed.Parse(bad)), "wrong length or braces rejected");
+    }
+    Guid parsed;
+    ok &= Check(FAILED(parsed.Parse(std::wstring_view(L"{831532DC-7EFB-4A8C-841B-7BBE21558F8\u0146}"))),
+        "non-ASCII rejected");
+    if (!ok)
+        return false;
+
+    std::vector<std::string> strs;
+    for (const auto& guid : guids)
+    {
+        strs.push_back(guid.ToUtf8());
+    }
+    const size_t count = Ops(options, Conversions);
+    size_t       sum   = 0;
+
+    Measure(options, "Parse()", count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            Guid guid;
+            sum += SUCCEEDED(guid.Parse(strs[n % strs.size()])) + guid.Data1;
+        }
+    });
+
+    Measure(options, "ParseScalar()", count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            Guid guid;
+            sum += SUCCEEDED(guid.ParseScalar(std::string_view(strs[n % strs.size()]))) + guid.Data1;
+        }
+    });
+
+    Measure(options, "Parse() (before)", count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            Guid guid;
+            sum += SUCCEEDED(ParseLoop(guid, strs[n % strs.size()])) + guid.Data1;
+        }
+    });
+
+    char str[Guid::Length];
+    Measure(options, "Format()", count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            guids[n % guids.size()].Format(str);
+            sum += (size_t)str[n % Guid::Length];
+        }
+    });
+
+    Measure(options, "FormatScalar()", count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            guids[n % guids.size()].FormatScalar(str);
+            sum += (size_t)str[n % Guid::Length];
+        }
+    });
+
+    Measure(options, "ToUtf8()", count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            sum += guids[n % guids.size()].ToUtf8()[n % Guid::Length];
+        }
+    });
+
+    Measure(options, "ToUtf8() (before)", count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            sum += FormatPrintf(guids[n % guids.size()])[n % Guid::Length];
+        }
+    });
+    return Check(sum != 0, "GUIDs parsed and formatted");
+}
+}
@@ -0,0 +1,219 @@
+#include "pch.h"
+#include <cstdio>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "Bench.h"
+#include "JsonPeek.h"
+
+using json = nlohmann::json;
+
+namespace Bench
+{
+namespace
+{
+// Random documents checked against json::parse().
+const size_t Documents = 500;
+
+// Top level keys of the large config, each with a service's worth of settings.
+const size_t ConfigKeys = 2'000;
+
+const size_t Peeks = 2'000;
+
+// Characters strings are made of, JSON needs those besides the letters escaped or they're multi-byte in UTF-8.
+const std::string_view Alphabet[] = {"a", "b", "Z", "0", " ", "\"", "\\", "/", "\n", "\t", "\x01", "\u00e9", "\u20ac",
+    "\U0001F600", "{", "}", "[", "]", ",", ":"};
+
+std::string RandomString(std::mt19937& random)
+{
+    std::string str;
+    for (size_t n = random() % 8; n > 0; --n)
+    {
+        str += Alphabet[random() % std::size(Alphabet)];
+    }
+    return str;
+}
+
+// Any kind of value, containers nested up to depth.
+json RandomValue(std::mt19937& random, size_t depth)
+{
+    switch (random() % (depth ? 8 : 6))
+    {
+        case 0:
+            return nullptr;
+        case 1:
+            return random() % 2 == 0;
+        case 2:
+            return (int64_t)random() - INT32_MAX;
+        case 3:
+            return (double)random() / 7;
+        case 4:
+        case 5:
+            return RandomString(random);
+        case 6:
+        {
+            auto array = json::array();
+            for (size_t n = random() % 4; n > 0; --n)
+            {
+                array.push_back(RandomValue(random, depth - 1));
+            }
+            return array;
+        }
+        default:
+        {
+            auto object = json::object();
+            for (size_t n = random() % 4; n > 0; --n)
+            {
+                object[RandomString(random)] = RandomValue(random, depth - 1);
+            }
+            return object;
+        }
+    }
+}
+
+// json spaced out the way a person might have written it.
+std::string Spaced(const json& doc, std::mt19937& random)
+{
+    return random() % 2 ? doc.dump() : doc.dump((int)(random() % 5));
+}
+
+// Each key of doc peeked at within its text is the value json::parse() has for it, a key doc doesn't have is empty.
+bool AgreesWithParse(const json& doc, const std::string& text)
+{
+    bool ok = true;
+    for (const auto& [key, expected] : doc.items())
+    {
+        std::string_view value;
+        ok &= SUCCEEDED(ipc::PeekJson(text, key, value)) && json::parse(value) == expected;
+    }
+    std::string_view value;
+    ok &= SUCCEEDED(ipc::PeekJson(text, "not a key of any", value)) && value.empty();
+    return ok;
+}
+
+// The value PeekJson() has for key, "failed" if it fails and "missing" if key isn't there.
+std::string Peek(std::string_view text, std::string_view key)
+{
+    std::string_view value;
+    if (FAILED(ipc::PeekJson(text, key, value)))
+        return "failed";
+    return value.empty() ? "missing" : std::string(value);
+}
+
+// A config as the broker gets them, the key looked at by routing missing or last.
+std::string MakeConfig(bool withBroker)
+{
+    auto config = json::object();
+    for (size_t n = 0; n < ConfigKeys; ++n)
+    {
+        config["Service" + std::to_string(n)] = {{"Module", "Module" + std::to_string(n) + ".dll"},
+            {"Args", {"--verbose", "--name=\"quoted\"", "C:\\Program Files\\TM"}},
+            {"Limits", {{"Memory", 1 << 20}, {"Threads", 4}, {"Ratio", 0.75}}}, {"Enabled", true},
+            {"Description", MakeMsg(300, (unsigned)n)}};
+    }
+    std::string text = config.dump(4);
+    if (withBroker)
+        text.insert(text.rfind('}'), ",\n    \"Broker\": {\"DispatchThreads\": 4}\n");
+    return text;
+}
+}
+
+bool JsonPeeks(const Options& options)
+{
+    // Documents json::parse() reads the same as PeekJson(), any value at the top and nested.
+    bool         ok = true;
+    std::mt19937 random(7);
+    for (size_t n = 0; n < Documents; ++n)
+    {
+        auto doc = json::object();
+        for (size_t k = random() % 12; k > 0; --k)
+        {
+            doc[RandomString(random)] = RandomValue(random, 4);
+        }
+        ok &= Check(AgreesWithParse(doc, Spaced(doc, random)), "PeekJson() as json::parse()");
+    }
+
+    // Keys escaped in any way JSON allows are the same key, their values are returned as written.
+    const std::string_view escaped =
+        R"({"Bro\u006ber": {"a": "\"}"}, "\"q\\\/\b\f\n\r\t": 1, "\u00e9\ud83d\ude00": 2})";
+    ok &= Check(Peek(escaped, "Broker") == R"({"a": "\"}"})", "escaped key");
+    ok &= Check(Peek(escaped, "\"q\\/\b\f\n\r\t") == "1", "key of escapes");
+    ok &= Check(Peek(escaped, "\u00e9\U0001F600") == "2", "key of \\u escapes beyond ASCII");
+    ok &= Check(Peek(escaped, "Bro\\u006ber") == "missing", "key not compared as written");
+    ok &= Check(AgreesWithParse(json::parse(escaped), std::string(escaped)), "escapes as json::parse()");
+
+    // Of duplicate keys the last one counts, as with json::parse().
+    const std::string duplicates = R"({"a": 1, "b": [2], "a": {"c": 3}, "\u0061": "last"})";
+    ok &= Check(Peek(duplicates, "a") == R"("last")", "last of duplicate keys");
+    ok &= Check(Peek(duplicates, "b") == "[2]", "key amid duplicates");
+    ok &= Check(AgreesWithParse(json::parse(duplicates), duplicates), "duplicates as json::parse()");
+
+    // Nothing but the top level is looked at, nested keys aren't found.
+    ok &= Check(Peek(R"({"a": {"b": 1}, "c": [{"b": 2}]})", "b") == "missing", "nested keys not at the top");
+    ok &= Check(Peek(" \r\n\t{ } \n", "a") == "missing", "empty object");
+
+    for (const std::string_view malformed : {"", " ", "[]", "\"a\"", "1", "{", "}", "{\"a\"}", "{\"a\" 1}",
+             "{\"a\": }", "{\"a\": 1,}", "{\"a\": 1 \"b\": 2}", "{a: 1}", "{\"a: 1}", "{\"a\": \"1}", "{\"a\": [1}",
+             "{\"a\": {\"b\": 1}", "{\"a\": [1]]}", "{\"a\": 1}}", "{\"a\": 1} x", "{} {}", "{\"\\x\": 1}",
+             "{\"\\u12\": 1}", "{\"\\ud83d\": 1}", "{\"\\ude00\": 1}", "{\"\\ud83d\\u0041\": 1}", "{\"\\\": 1}"})
+    {
+        ok &= Check(Peek(malformed, "a") == "failed", "malformed rejected");
+        ok &= Check(!json::accept(malformed) || !json::parse(malformed).is_object(),
+            "no object for json::parse() either");
+    }
+
+    // Cut anywhere the rest is missing, up to trailing space.
+    const std::string whole = json::parse(escaped).dump(2);
+    for (size_t size = 0; size < whole.size(); ++size)
+    {
+        ok &= Check(Peek(std::string_view(whole).substr(0, size), "Broker") == "failed", "truncated rejected");
+    }
+
+    // PeekStrings() reads arrays of plain strings as json::parse() does, those with escapes it leaves to it.
+    const json                    names    = {"Broker", "Host A", "{}", "", "\u00e9"};
+    const std::string             services = json {{"Services", names}}.dump(1);
+    std::string_view              array;
+    std::vector<std::string_view> strings;
+    ok &= Check(SUCCEEDED(ipc::PeekJson(services, "Services", array)) &&
+                    SUCCEEDED(ipc::PeekStrings(array, strings)) &&
+                    json(std::vector<std::string>(strings.begin(), strings.end())) == names,
+        "PeekStrings() as json::parse()");
+    for (const std::string_view bad : {"[\"a\\\"\"]", "[1]", "[\"a\",]", "[\"a\"", "{}"})
+    {
+        ok &= Check(FAILED(ipc::PeekStrings(bad, strings)), "PeekStrings() of other than plain strings rejected");
+    }
+    if (!ok)
+        return false;
+
+    // How Orchestrator looks for the Broker settings of a config, once they'd been parsed as a whole.
+    size_t     sum   = 0;
+    const auto count = Ops(options, Peeks);
+    for (const bool withBroker : {false, true})
+    {
+        const std::string config = MakeConfig(withBroker);
+        Section(withBroker ? "config with Broker last" : "config without Broker");
+        printf("  %-36s %10zu\n", "bytes", config.size());
+        ok &= Check(AgreesWithParse(json::parse(config), config), "PeekJson() as json::parse() for the config");
+
+        Measure(options, "PeekJson()", count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                std::string_view value;
+                sum += SUCCEEDED(ipc::PeekJson(config, "Broker", value)) + value.size();
+            }
+        }, config.size());
+
+        const size_t parses = Ops(options, Peeks / 20);
+        Measure(options, "json::parse() (before)", parses, [&] {
+            for (size_t n = 0; n < parses; ++n)
+            {
+                const auto doc = json::parse(config);
+                sum += doc.contains("Broker") + doc.size();
+            }
+        }, config.size());
+    }
+    return Check(ok && sum != 0, "configs peeked at and parsed");
+}
+}
@@ -0,0 +1,294 @@
+#include "pch.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+#include <absl/container/flat_hash_map.h>
+#include <absl/hash/hash.h>
+#include "Bench.h"
+#include "FrameReader.h"
+#include "guid.h"
+#include "RoutingIndex.h"
+#include "ServiceTable.h"
+
+// RoutingIndex only holds on to processes, the broker's class is not needed to route to them.
+class ChildProcessInstance final
+{
+public:
+    // What routing probed before RoutingIndex, the services announced by the process.
+    std::unordered_set<Guid, absl::Hash<Guid>> Services;
+};
+
+namespace Bench
+{
+namespace
+{
+// Hosts running and services provided by all of them together.
+struct Load
+{
+    size_t Processes;
+    size_t Services;
+};
+const Load Loads[] = {{10, 200}, {300, 5000}};
+
+// Services announced per process, and how many of the processes subscribe to any service (KnownService::All).
+const size_t ServicesPerProcess = 17;
+const size_t SubscribedToAll    = 2;
+
+const size_t Msgs = 2'000'000;
+
+// Frames carried the GUID of the service before ids were assigned to services.
+struct GuidFrameHeader
+{
+    DWORD Size;
+    Guid  Service;
+    DWORD Session;
+};
+static_assert(sizeof(GuidFrameHeader) == 24);
+
+std::vector<uint8_t> EncodeGuidFrame(const std::string_view msg, const ipc::Target& target)
+{
+    const GuidFrameHeader header {
+        (DWORD)(sizeof(GuidFrameHeader) + msg.size() + 1 - 4), target.Service, target.Session};
+
+    std::vector<uint8_t> frame(sizeof(header) + msg.size() + 1);
+    memcpy(frame.data(), &header, sizeof(header));
+    memcpy(frame.data() + sizeof(header), msg.data(), msg.size());
+    return frame;
+}
+
+bool DecodeGuidFrame(const std::vector<uint8_t>& frame, std::string_view& msg, ipc::Target& target)
+{
+    GuidFrameHeader header;
+    if (frame.size() < sizeof(header) + 1 || frame.back() != 0)
+        return false;
+
+    memcpy(&header, frame.data(), sizeof(header));
+    target.Service = header.Service;
+    target.Session = header.Session;
+    msg            = std::string_view((const char*)frame.data() + sizeof(header), frame.size() - sizeof(header) - 1);
+    return true;
+}
+
+// Processes with their services registered both in an index and in the processes, like before the index.
+class Broker final
+{
+public:
+    explicit Broker(const Load& load)
+    {
+        for (size_t n = 0; n < load.Services; ++n)
+        {
+            services_.push_back(Guid::CreateNew());
+            ids_.push_back(ipc::Services().Intern(services_.back()));
+        }
+
+        for (size_t p = 0; p < load.Processes; ++p)
+        {
+            auto process = std::make_shared<ChildProcessInstance>();
+            routing_.Insert(process);
+
+            std::vector<ipc::ServiceId> ids;
+            for (size_t n = 0; n < ServicesPerProcess; ++n)
+            {
+                const size_t service = (p * ServicesPerProcess + n) % load.Services;
+                process->Services.insert(services_[service]);
+                ids.push_back(ids_[service]);
+                if (p >= SubscribedToAll)
+                    byGuid_[services_[service]].push_back(process.get());
+            }
+            if (p < SubscribedToAll)
+            {
+                process->Services.insert(ipc::KnownService::All);
+                ids.push_back(ipc::KnownServiceId::All);
+                all_.push_back(process.get());
+            }
+            routing_.Add(process.get(), ids);
+            processes_.push_back(std::move(process));
+        }
+    }
+
+    // Targets of the msgs routed, spread over all services.
+    std::vector<ipc::Target> Targets() const
+    {
+        std::vector<ipc::Target> targets;
+        for (size_t n = 0; n < services_.size(); ++n)
+        {
+            targets.emplace_back(services_[(n * 7919) % services_.size()]);
+            targets.back().Id = ids_[(n * 7919) % services_.size()];
+        }
+        return targets;
+    }
+
+    const RoutingIndex& Routing() const
+    {
+        return routing_;
+    }
+
+    // How Orchestrator routed before RoutingIndex: every process probed for both services.
+    template <typename F>
+    void ForEachSubscriberScanning(const Guid& service, F&& f) const
+    {
+        for (const auto& process : processes_)
+        {
+            if (process->Services.contains(ipc::KnownService::All) || process->Services.contains(service))
+                f(process.get());
+        }
+    }
+
+    // How RoutingIndex looked up subscribers before ids were assigned to services.
+    template <typename F>
+    void ForEachSubscriberByGuid(const Guid& service, F&& f) const
+    {
+        Epoch::Guard guard;
+
+        for (const auto process : all_)
+            f(process);
+
+        if (auto subscribers = byGuid_.find(service); subscribers != byGuid_.end())
+        {
+            for (const auto process : subscribers->second)
+                f(process);
+        }
+    }
+
+private:
+    std::vector<Guid>                                  services_;
+    std::vector<ipc::ServiceId>                        ids_;
+    std::vector<std::shared_ptr<ChildProcessInstance>> processes_;
+    RoutingIndex                                       routing_;
+
+    std::vector<ChildProcessInstance*>                                                all_;
+    absl::flat_hash_map<Guid, std::vector<ChildProcessInstance*>, absl::Hash<Guid>> byGuid_;
+};
+}
+
+bool Routing(const Options& options)
+{
+    bool ok = true;
+    for (const auto& load : Loads)
+    {
+        const Broker broker(load);
+        const auto   targets = broker.Targets();
+
+        // Both find the same recipients, each of them once.
+        for (const auto& target : targets)
+        {
+            std::vector<ChildProcessInstance*> indexed;
+            std::vector<ChildProcessInstance*> scanned;
+            broker.Routing().ForEachSubscriber(target.Id, [&](ChildProcessInstance* process) {
+                indexed.push_back(process);
+            });
+            broker.ForEachSubscriberScanning(target.Service, [&](ChildProcessInstance* process) {
+                scanned.push_back(process);
+            });
+
+            std::sort(indexed.begin(), indexed.end());
+            std::sort(scanned.begin(), scanned.end());
+            ok &= Check(!scanned.empty() && indexed == scanned, "same recipients");
+        }
+        if (!ok)
+            return false;
+
+        const size_t count = Ops(options, Msgs);
+        char         name[64];
+        size_t       recipients = 0;
+
+        snprintf(name, sizeof(name), "%zu processes, index", load.Processes);
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                broker.Routing().ForEachSubscriber(
+                    targets[n % targets.size()].Id, [&](ChildProcessInstance*) { ++recipients; });
+            }
+        });
+
+        snprintf(name, sizeof(name), "%zu processes, scan (before)", load.Processes);
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                broker.ForEachSubscriberScanning(
+                    targets[n % targets.size()].Service, [&](ChildProcessInstance*) { ++recipients; });
+            }
+        });
+        ok &= Check(recipients != 0, "msgs routed");
+    }
+    return ok;
+}
+bool ServiceIds(const Options& options)
+{
+    const Broker broker(Loads[std::size(Loads) - 1]);
+    const auto   msg = "{}";
+
+    // Frames of msgs to every service, as a host sends them to the broker.
+    std::vector<ipc::Target>          targets = broker.Targets();
+    std::vector<ipc::Frame>           frames;
+    std::vector<std::vector<uint8_t>> guidFrames;
+    for (auto& target : targets)
+    {
+        target.Session = 1;
+        frames.emplace_back(msg, target, ipc::FrameVersion::Legacy);
+        guidFrames.push_back(EncodeGuidFrame(msg, target));
+    }
+
+    // Both decode the same msg and target and route it to the same recipients.
+    bool ok = true;
+    for (size_t n = 0; n < targets.size(); ++n)
+    {
+        std::string_view msgById;
+        std::string_view msgByGuid;
+        ipc::Target      byId;
+        ipc::Target      byGuid;
+        ipc::ChunkInfo   chunk;
+        ok &= Check(ipc::DecodeFrame(frames[n].Data(), frames[n].Size(), msgById, byId, chunk), "DecodeFrame()");
+        ok &= Check(DecodeGuidFrame(guidFrames[n], msgByGuid, byGuid), "DecodeGuidFrame()");
+        ok &= Check(msgById == msg && msgByGuid == msg, "msg decoded");
+        ok &= Check(byId == targets[n] && byGuid == targets[n] && byId.Id == targets[n].Id, "target decoded");
+
+        std::vector<ChildProcessInstance*> indexed;
+        std::vector<ChildProcessInstance*> hashed;
+        broker.Routing().ForEachSubscriber(byId.Id, [&](ChildProcessInstance* process) {
+            indexed.push_back(process);
+        });
+        broker.ForEachSubscriberByGuid(byGuid.Service, [&](ChildProcessInstance* process) {
+            hashed.push_back(process);
+        });
+
+        std::sort(indexed.begin(), indexed.end());
+        std::sort(hashed.begin(), hashed.end());
+        ok &= Check(!hashed.empty() && indexed == hashed, "same recipients");
+    }
+    if (!ok)
+        return false;
+
+    const size_t count = Ops(options, Msgs);
+    char         name[64];
+    size_t       recipients = 0;
+
+    snprintf(name, sizeof(name), "%zu B frames, id", frames[0].Size());
+    Measure(options, name, count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            const auto&      frame = frames[n % frames.size()];
+            std::string_view received;
+            ipc::Target      target;
+            ipc::ChunkInfo   chunk;
+            if (ipc::DecodeFrame(frame.Data(), frame.Size(), received, target, chunk))
+                broker.Routing().ForEachSubscriber(target.Id, [&](ChildProcessInstance*) { ++recipients; });
+        }
+    });
+
+    snprintf(name, sizeof(name), "%zu B frames, GUID (before)", guidFrames[0].size());
+    Measure(options, name, count, [&] {
+        for (size_t n = 0; n < count; ++n)
+        {
+            std::string_view received;
+            ipc::Target      target;
+            if (DecodeGuidFrame(guidFrames[n % guidFrames.size()], received, target))
+                broker.ForEachSubscriberByGuid(target.Service, [&](ChildProcessInstance*) { ++recipients; });
+        }
+    });
+    return Check(recipients != 0, "msgs routed");
+}
+}
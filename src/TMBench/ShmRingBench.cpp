@@ -0,0 +1,103 @@
+#include "pch.h"
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "Bench.h"
+#include "ShmRing.h"
+#include "Transport.h"
+
+namespace Bench
+{
+namespace
+{
+// Sizes of the msgs sent and how many of them per round. The largest doesn't fit into the ring at once.
+struct Load
+{
+    size_t Size;
+    size_t Count;
+};
+const Load Loads[] = {{64, 200'000}, {1024, 100'000}, {16 * 1024, 20'000}, {512 * 1024, 500}};
+
+// Both ends of a channel live in this process, the handles the broker passes to a host are valid here as well.
+HRESULT CreateShm(std::shared_ptr<ipc::ShmChannel>& broker, std::shared_ptr<ipc::ShmChannel>& host) noexcept
+try
+{
+    broker = std::make_shared<ipc::ShmChannel>(nullptr);
+    RETURN_IF_FAILED(broker->Create());
+
+    host = std::make_shared<ipc::ShmChannel>(nullptr);
+    RETURN_IF_FAILED(host->Open(broker->Describe()));
+    return S_OK;
+}
+CATCH_RETURN();
+}
+
+bool SharedMemory(const Options& options)
+{
+    std::shared_ptr<ipc::ShmChannel>    broker;
+    std::shared_ptr<ipc::ShmChannel>    host;
+    std::shared_ptr<ipc::PipeTransport> sender;
+    std::shared_ptr<ipc::PipeTransport> receiver;
+    Connection                          shm;
+    Connection                          pipe;
+    if (!Check(SUCCEEDED(CreateShm(broker, host)), "CreateShm()") ||
+        !Check(SUCCEEDED(shm.Open(broker, host)), "shm.Open()") ||
+        !Check(SUCCEEDED(ipc::PipeTransport::CreatePair(sender, receiver)), "PipeTransport::CreatePair()") ||
+        !Check(SUCCEEDED(pipe.Open(sender, receiver)), "pipe.Open()"))
+        return false;
+
+    const ipc::Target target(ipc::KnownService::ConfStore, 1);
+
+    // Both deliver the same msgs, whether sent as msg or as frame.
+    bool ok = true;
+    for (auto* connection : {&shm, &pipe})
+    {
+        connection->Collect(true);
+        for (const auto& load : Loads)
+        {
+            const auto msg = MakeMsg(load.Size, (unsigned)load.Size);
+            ok &= Check(SUCCEEDED(connection->Sender().Send(msg, target)), "Send()");
+            ok &= Check(SUCCEEDED(connection->Sender().SendFrame(
+                            ipc::Frame(msg, target, connection->Sender().GetFrameVersion()))),
+                "SendFrame()");
+            connection->WaitFor(2);
+
+            for (const auto& received : connection->Collected())
+            {
+                ok &= Check(received.Bytes == msg, "msg received as sent");
+                ok &= Check(received.Target == target, "target received as sent");
+            }
+            connection->Collected().clear();
+        }
+        connection->Collect(false);
+    }
+    if (!ok)
+        return false;
+
+    for (const auto& load : Loads)
+    {
+        const auto   msg   = MakeMsg(load.Size);
+        const size_t count = Ops(options, load.Count);
+        char         name[64];
+
+        snprintf(name, sizeof(name), "%zu B, shared memory", load.Size);
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                (void)shm.Sender().Send(msg, target);
+            }
+            shm.WaitFor(count);
+        }, load.Size);
+
+        snprintf(name, sizeof(name), "%zu B, pipe (before)", load.Size);
+        Measure(options, name, count, [&] {
+            for (size_t n = 0; n < count; ++n)
+            {
+                (void)pipe.Sender().Send(msg, target);
+            }
+            pipe.WaitFor(count);
+        }, load.Size);
+    }
+    return true;
+}
+}
@@ -0,0 +1,75 @@
+#include "pch.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include "Bench.h"
+
+// Measures hot paths of broker and hosts against the implementation they replaced, kept here as the baseline.
+// Every bench checks that both produce the same results before timing them.
+//
+//  TMBench [--quick] [bench...]
+//
+// Runs all benches unless some are named. --quick only does the checks and a short round of each measurement.
+namespace
+{
+struct Entry
+{
+    const char* Name;
+    const char* Description;
+    bool (*Run)(const Bench::Options& options);
+};
+
+const Entry Benches[] = {
+    {"framing", "ipc::Send gather writes vs. copying each msg into a frame of its own", Bench::Framing},
+    {"reader", "FrameReader reading chunks into a ring vs. reading frame by frame", Bench::FrameReading},
+    {"shm", "ShmChannel rings in shared memory vs. pipes", Bench::SharedMemory},
+    {"routing", "RoutingIndex vs. probing every process for the service of a msg", Bench::Routing},
+    {"ids", "Decoding and routing frames carrying service ids vs. GUIDs", Bench::ServiceIds},
+    {"dispatch", "Routing msgs of a host on Dispatcher threads vs. inline on its reader thread", Bench::Dispatching},
+    {"bridge", "ManagedBridge passing UTF-8 spans to managed modules vs. UTF-16 strings", Bench::ManagedBridging},
+    {"guid", "Guid parsing and formatting, SSE2 vs. scalar vs. snprintf and a char loop", Bench::Guids},
+    {"loop", "EventLoop reading 50 hosts on a few threads vs. threads per host", Bench::EventLoops},
+    {"uring", "EventLoop on io_uring vs. epoll reading frames, WriteAll() vs. a write() per pipe for fan-out",
+        Bench::Urings},
+    {"json", "PeekJson() finding a key of a large config vs. json::parse() of all of it", Bench::JsonPeeks},
+};
+}
+
+int main(int argc, char** argv)
+{
+    Bench::Options                options;
+    std::vector<std::string_view> names;
+    for (int n = 1; n < argc; ++n)
+    {
+        if (strcmp(argv[n], "--quick") == 0)
+            options.Quick = true;
+        else
+            names.push_back(argv[n]);
+    }
+
+    for (const auto name : names)
+    {
+        if (std::none_of(std::begin(Benches), std::end(Benches), [&](const Entry& entry) { return name == entry.Name; }))
+        {
+            printf("Unknown bench '%.*s', one of:\n", (int)name.size(), name.data());
+            for (const auto& entry : Benches)
+            {
+                printf("  %-12s %s\n", entry.Name, entry.Description);
+            }
+            return 2;
+        }
+    }
+
+    bool ok = true;
+    for (const auto& entry : Benches)
+    {
+        if (!names.empty() && std::find(names.begin(), names.end(), entry.Name) == names.end())
+            continue;
+
+        printf("[%s] %s\n", entry.Name, entry.Description);
+        ok &= entry.Run(options);
+    }
+    return ok ? 0 : 1;
+}
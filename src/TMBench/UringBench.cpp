@@ -0,0 +1,278 @@
+#include "pch.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "EventLoop.h"
+#include "ServiceTable.h"
+#include "Transport.h"
+
+namespace Bench
+{
+namespace
+{
+// Pipes to as many hosts, each gets that many msgs of that size.
+const size_t Pipes   = 50;
+const size_t MsgSize = 1024;
+
+const size_t Msgs = 2'000;
+
+// A msg in several chunk frames and more than a pipe holds, so writing it takes several completions.
+const size_t LargeSize = 256 * 1024;
+
+// Broadcasts WriteAll() may have in flight before waiting for the oldest to be written.
+const size_t Window = 64;
+
+const auto Timeout = std::chrono::seconds(30);
+
+// Frames of count msgs, their session is the sequence number. The one at large is LargeSize.
+std::vector<ipc::Frame> MakeFrames(size_t count, size_t large = SIZE_MAX)
+{
+    ipc::Target target(Guid::CreateNew());
+    target.Id = ipc::Services().Intern(target.Service);
+
+    const auto              msg = MakeMsg(MsgSize);
+    std::vector<ipc::Frame> frames;
+    for (size_t n = 0; n < count; ++n)
+    {
+        target.Session = (DWORD)n;
+        frames.emplace_back(n == large ? MakeMsg(LargeSize) : msg, target, ipc::FrameVersion::Latest);
+    }
+    return frames;
+}
+
+// Pipes as the broker has them to its hosts, written by one side and read as frames by an EventLoop.
+class Hosts final
+{
+public:
+    // sizes are those of the msgs each pipe is to receive, in order.
+    HRESULT Open(ipc::EventLoop& loop, const std::vector<size_t>& sizes)
+    {
+        for (size_t p = 0; p < Pipes; ++p)
+        {
+            ipc::Handle read, write;
+            RETURN_IF_FAILED(CreatePipe(read, write));
+            outs_.push_back(write);
+
+            // Shared with the stream, which may outlive this on failure.
+            auto got = received_.emplace_back(std::make_shared<Received>());
+            auto in  = std::make_shared<ipc::PipeTransport>(read, ipc::InvalidHandle, ipc::InvalidHandle);
+            RETURN_IF_FAILED(in->StartRead(loop, [got, sizes](const std::string_view msg, const ipc::Target& target) {
+                const size_t n = got->Msgs.load(std::memory_order_relaxed);
+                got->Ordered &= n < sizes.size() && msg.size() == sizes[n] && target.Session == (DWORD)n;
+                got->Msgs.store(n + 1, std::memory_order_release);
+                return false;
+            }));
+        }
+        count_ = sizes.size();
+        return S_OK;
+    }
+
+    ~Hosts()
+    {
+        for (const auto out : outs_)
+        {
+            ClosePipe(out);
+        }
+    }
+
+    const std::vector<ipc::Handle>& Outs() const
+    {
+        return outs_;
+    }
+
+    // Waits until each pipe got all its msgs, false if that takes too long or one arrived out of order.
+    bool WaitAll() const
+    {
+        const auto deadline = std::chrono::steady_clock::now() + Timeout;
+        for (const auto& got : received_)
+        {
+            while (got->Msgs.load(std::memory_order_acquire) < count_)
+            {
+                if (std::chrono::steady_clock::now() > deadline)
+                    return false;
+                std::this_thread::yield();
+            }
+            if (!got->Ordered)
+                return false;
+        }
+        return received_.size() == Pipes;
+    }
+
+private:
+    struct Received
+    {
+        std::atomic<size_t> Msgs {0};
+        // Only touched by the single read in flight.
+        bool                Ordered = true;
+    };
+
+    std::vector<ipc::Handle>               outs_;
+    std::vector<std::shared_ptr<Received>> received_;
+    size_t                                 count_ = 0;
+};
+
+std::vector<size_t> SizesOf(const std::vector<ipc::Frame>& frames, size_t large = SIZE_MAX)
+{
+    std::vector<size_t> sizes(frames.size(), MsgSize);
+    if (large < sizes.size())
+        sizes[large] = LargeSize;
+    return sizes;
+}
+
+// Each of frames written to every pipe, a write() at a time, and read by loop.
+bool FanIn(ipc::EventLoop& loop, const std::vector<ipc::Frame>& frames)
+{
+    Hosts hosts;
+    if (!Check(SUCCEEDED(hosts.Open(loop, SizesOf(frames))), "pipes read by the loop"))
+        return false;
+
+    bool ok = true;
+    for (const auto& frame : frames)
+    {
+        for (const auto out : hosts.Outs())
+        {
+            ok &= SUCCEEDED(WriteAll(out, frame.Data(), frame.Size()));
+        }
+    }
+    return Check(ok && hosts.WaitAll(), "msgs of each pipe complete and in order");
+}
+
+// Each of frames written to every pipe, by WriteAll() of writer if any, otherwise a write() per pipe. The pipes are
+// read by an epoll loop either way.
+bool FanOut(ipc::EventLoop* writer, const std::vector<ipc::Frame>& frames, size_t large = SIZE_MAX)
+{
+    ipc::EventLoop readers(false);
+    Hosts          hosts;
+    if (!Check(SUCCEEDED(readers.Start()) && SUCCEEDED(hosts.Open(readers, SizesOf(frames, large))),
+            "pipes read by the loop"))
+        return false;
+
+    bool                ok = true;
+    std::atomic<size_t> written {0};
+    std::atomic<size_t> failed {0};
+    for (size_t n = 0; n < frames.size(); ++n)
+    {
+        if (!writer)
+        {
+            for (const auto out : hosts.Outs())
+            {
+                ok &= SUCCEEDED(WriteAll(out, frames[n].Data(), frames[n].Size()));
+            }
+            continue;
+        }
+
+        while (n >= Window && written.load(std::memory_order_acquire) < (n - Window) * Pipes)
+        {
+            std::this_thread::yield();
+        }
+        ok &= Check(SUCCEEDED(writer->WriteAll(hosts.Outs(), frames[n], [&](ipc::Handle, HRESULT hr) {
+            failed.fetch_add(FAILED(hr), std::memory_order_relaxed);
+            written.fetch_add(1, std::memory_order_release);
+        })),
+            "WriteAll()");
+    }
+
+    ok &= Check(hosts.WaitAll(), "msgs of each pipe complete and in order");
+    if (writer)
+    {
+        // The last completion may still be on its way after the reader got the msg.
+        const auto deadline = std::chrono::steady_clock::now() + Timeout;
+        while (written.load(std::memory_order_acquire) < frames.size() * Pipes &&
+               std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::yield();
+        }
+        ok &= Check(written.load() == frames.size() * Pipes && !failed.load(), "each write reported done once");
+    }
+    return ok;
+}
+
+// Writes to a pipe nobody reads don't keep Stop() from returning, nor are they reported afterwards.
+bool StopWhileWriting()
+{
+    ipc::Handle read, write;
+    if (!Check(SUCCEEDED(CreatePipe(read, write)), "pipe created"))
+        return false;
+
+    // More than the pipe holds, the first is left half written and the others wait for it.
+    const auto          frames = MakeFrames(4, 0);
+    std::atomic<size_t> written {0};
+    bool                ok = true;
+    {
+        ipc::EventLoop loop;
+        ok &= Check(SUCCEEDED(loop.Start()), "EventLoop::Start()");
+        for (const auto& frame : frames)
+        {
+            ok &= Check(SUCCEEDED(loop.WriteAll({&write, 1}, frame, [&](ipc::Handle, HRESULT) { ++written; })),
+                "WriteAll()");
+        }
+        loop.Stop();
+    }
+    ok &= Check(written.load() == 0, "nothing reported once stopped");
+
+    ClosePipe(read);
+    ClosePipe(write);
+    return ok;
+}
+}
+
+bool Urings(const Options& options)
+{
+    {
+        ipc::EventLoop loop;
+        if (!Check(SUCCEEDED(loop.Start()), "EventLoop::Start()"))
+            return false;
+        if (!loop.UsesUring())
+        {
+            printf("  io_uring not available, nothing to compare\n");
+            const auto frames = MakeFrames(1);
+            return Check(loop.WriteAll({}, frames[0], {}) == E_NOTIMPL, "WriteAll() only with io_uring");
+        }
+    }
+
+    // Frames as the broker reads and writes them, the same whichever way. A large one amid the small ones takes
+    // several writes, as does a frame written to a pipe the reader didn't drain yet.
+    const size_t count  = Ops(options, Msgs);
+    const size_t large  = count / 2;
+    const auto   frames = MakeFrames(count);
+
+    bool ok = true;
+    for (const bool uring : {true, false})
+    {
+        ipc::EventLoop loop(uring);
+        ok &= Check(SUCCEEDED(loop.Start()) && loop.UsesUring() == uring, "EventLoop::Start()");
+        ok &= FanIn(loop, frames);
+    }
+    {
+        ipc::EventLoop writer;
+        ok &= Check(SUCCEEDED(writer.Start()), "EventLoop::Start()");
+        ok &= FanOut(&writer, MakeFrames(count, large), large);
+    }
+    ok &= FanOut(nullptr, MakeFrames(count, large), large);
+    ok &= StopWhileWriting();
+    if (!ok)
+        return false;
+
+    printf("  %-36s %10zu\n", "pipes", Pipes);
+    for (const bool uring : {true, false})
+    {
+        ipc::EventLoop loop(uring);
+        ok &= Check(SUCCEEDED(loop.Start()), "EventLoop::Start()");
+        Measure(options, uring ? "fan-in, io_uring" : "fan-in, epoll (before)", Pipes * count,
+            [&] { ok &= FanIn(loop, frames); }, MsgSize);
+    }
+
+    ipc::EventLoop writer;
+    ok &= Check(SUCCEEDED(writer.Start()), "EventLoop::Start()");
+    Measure(options, "fan-out, WriteAll()", Pipes * count, [&] { ok &= FanOut(&writer, frames); }, MsgSize);
+    Measure(options, "fan-out, write() per pipe (before)", Pipes * count, [&] { ok &= FanOut(nullptr, frames); },
+        MsgSize);
+    return ok;
+}
+}
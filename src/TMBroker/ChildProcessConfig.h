@@ -1,13 +1,29 @@
 #pragma once
 #include <string>
 #include <vector>
+#include "OutboundQueue.h"
 
 struct ChildProcessConfig final
 {
+    // Bytes of messages a host may have sent which aren't written to all their recipients yet.
+    static constexpr size_t DefaultSendWindow = 16 * 1024 * 1024;
+
+    // How broker and host exchange messages, the host's stderr is always used for diagnostic output.
+    enum class TransportKind
+    {
+        Pipe,        // stdin/stdout
+        SharedMemory // ipc::ShmChannel
+    };
+
     bool                            AllUsers;
     bool                            Wow64;
     bool                            HigherIntegrityLevel;
     bool                            Ui;
+    TransportKind                   Transport;
+    size_t                          OutboundCapacity;
+    OutboundQueue::OverflowPolicy   Overflow;
+    // 0 for no limit, see HostInitMsg::SendWindow.
+    size_t                          SendWindow;
     const std::string               GroupName;
     const std::vector<std::wstring> Modules;
 };
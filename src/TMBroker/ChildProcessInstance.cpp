@@ -3,11 +3,48 @@
 #include "ipc.h"
 #include "TMProcess.h"
 #include "HostMsg.h"
+#include "ShmRing.h"
 #include "Orchestrator.h"
 #include "ChildProcessConfig.h"
 
 namespace
 {
+// Commands to the host itself overtake the msgs queued for its modules.
+ipc::Target Control(ipc::Target target)
+{
+    target.Meta.Priority = ipc::MsgPriority::Control;
+    return target;
+}
+
+// A command to the host, binary for hosts reading FrameVersion::V5 and JSON for older ones.
+ipc::Frame HostCmd(const ipc::Target& host, uint8_t version, ipc::HostCmdMsg::Cmd cmd)
+{
+    if (version >= ipc::FrameVersion::V5)
+    {
+        auto target         = Control(host);
+        target.Meta.Payload = ipc::PayloadType::Binary;
+        return ipc::Frame(ipc::ToBinary(cmd), target, version);
+    }
+
+    const json msg = ipc::HostCmdMsg {cmd, ""};
+    return ipc::Frame(msg.dump(), Control(host), version);
+}
+
+template <class Args>
+ipc::Frame HostCmd(const ipc::Target& host, uint8_t version, const Args& args)
+{
+    if (version >= ipc::FrameVersion::V5)
+    {
+        auto target         = Control(host);
+        target.Meta.Payload = ipc::PayloadType::Binary;
+        return ipc::Frame(ipc::ToBinary(args), target, version);
+    }
+
+    const json j   = args;
+    const json msg = ipc::HostCmdMsg {Args::ForCmd, j.dump()};
+    return ipc::Frame(msg.dump(), Control(host), version);
+}
+
 void DumpPipeInfos(HANDLE pipe)
 {
     // https://docs.microsoft.com/en-us/windows/win32/api/namedpipeapi/nf-namedpipeapi-getnamedpipeinfo
@@ -16,6 +53,27 @@ void DumpPipeInfos(HANDLE pipe)
 
     spdlog::info(L"flags:{} outSize:{} inSize:{} instances:{}", flags, outBufferSize, inBufferSize, maxInstances);
 }
+
+// Like CreatePipe(), but the read end is opened for overlapped I/O so the event loop can read it.
+// A single instance which is connected right away, so no other process can connect to it.
+HRESULT CreateOverlappedPipe(wil::unique_handle& read, wil::unique_handle& write, SECURITY_ATTRIBUTES* saWrite)
+{
+    static std::atomic<uint32_t> serial;
+    const auto name = std::format(L"\\\\.\\pipe\\TMBroker-{}-{}", ::GetCurrentProcessId(), ++serial);
+
+    wil::unique_hfile server(::CreateNamedPipeW(name.c_str(),
+        PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+        PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, 0, 0, 0, nullptr));
+    RETURN_LAST_ERROR_IF(!server);
+
+    wil::unique_hfile client(
+        ::CreateFileW(name.c_str(), GENERIC_WRITE, 0, saWrite, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr));
+    RETURN_LAST_ERROR_IF(!client);
+
+    read.reset(server.release());
+    write.reset(client.release());
+    return S_OK;
+}
 }
 
 HRESULT ChildProcessInstance::Launch(LaunchReason launchReason) noexcept
@@ -27,16 +85,25 @@ try
     // Cleanup, in case Launch() was run before
     if (launchReason == LaunchReason::Restart)
     {
-        outRead_.reset();
-        errRead_.reset();
-        inWrite_.reset();
+        // Modules announce their services again once loaded.
+        orchestrator_->routing_.Reset(this);
+
+        // Dispatcher and writer threads may still hold the queue of the dead process, pushing to it now fails.
+        if (const auto outbound = outbound_.exchange(nullptr))
+            outbound->Close();
+        if (transport_)
+            transport_->Close();
+        processId_.store(0);
         processInfo_.reset();
-        if (stderrForwarder_.joinable())
-            stderrForwarder_.join();
+
+        // Whatever the loop still reads from the dead process is dropped, wait for a message being handled.
+        reading_.request_stop();
+        {
+            std::unique_lock lock(readLock_);
+        }
         if (reader_.joinable())
             reader_.join();
-        if (keepAlive_.joinable())
-            keepAlive_.join();
+        transport_.reset();
     }
     else if (launchReason == LaunchReason::ApplyConfig)
     {
@@ -64,17 +131,39 @@ try
     // Create pipes for the child process's STDOUT,STDERR,STDIN.
     // https://stackoverflow.com/questions/60645/overlapped-i-o-on-anonymous-pipe
     // Buffer size defaults to 4096
-    RETURN_IF_WIN32_BOOL_FALSE(::CreatePipe(&outRead_, &outWrite_, &saAttr, 0));
-    RETURN_IF_WIN32_BOOL_FALSE(::CreatePipe(&errRead_, &errWrite_, &saAttr, 0));
-    RETURN_IF_WIN32_BOOL_FALSE(::CreatePipe(&inRead_, &inWrite_, &saAttr, 0));
-
-    // DumpPipeInfos(outRead_.get());
-    // DumpPipeInfos(errRead_.get());
+    // STDOUT and STDERR are read by the orchestrator's event loop and thus need to support overlapped reads.
+    wil::unique_handle outRead, errRead, inWrite;
+    RETURN_IF_FAILED(CreateOverlappedPipe(outRead, outWrite_, &saAttr));
+    RETURN_IF_FAILED(CreateOverlappedPipe(errRead, errWrite_, &saAttr));
+    RETURN_IF_WIN32_BOOL_FALSE(::CreatePipe(&inRead_, &inWrite, &saAttr, 0));
+
+    // DumpPipeInfos(outRead.get());
+    // DumpPipeInfos(errRead.get());
     // DumpPipeInfos(inRead_.get());
 
     // DumpPipeInfos(outWrite_.get());
     // DumpPipeInfos(errWrite_.get());
-    // DumpPipeInfos(inWrite_.get());
+    // DumpPipeInfos(inWrite.get());
+
+    auto pipe  = std::make_shared<ipc::PipeTransport>(outRead.release(), inWrite.release(), errRead.release());
+    transport_ = pipe;
+
+    std::shared_ptr<ipc::ShmChannel> shm;
+    if (childProcessConfig_->Transport == ChildProcessConfig::TransportKind::SharedMemory)
+    {
+        // Messages flow through shared memory rings, stdin only carries the HostInitMsg announcing them.
+        shm = std::make_shared<ipc::ShmChannel>(pipe);
+        RETURN_IF_FAILED(shm->Create());
+        transport_ = shm;
+    }
+
+    // Anything sent to the host is queued until the HostInitMsg went out.
+    const auto outbound =
+        std::make_shared<OutboundQueue>(childProcessConfig_->OutboundCapacity, childProcessConfig_->Overflow);
+    outbound_.store(outbound);
+
+    // A new host process only knows the ids of the KnownService GUIDs.
+    knownServiceIds_ = ipc::KnownServiceId::FirstAssigned;
 
 #pragma region Init process thread attributes
     // https://docs.microsoft.com/en-us/windows/win32/api/processthreadsapi/nf-processthreadsapi-updateprocthreadattribute
@@ -110,9 +199,14 @@ try
 
     // Ensure only these handles are inherited.
     // We may launch multiple child processes and w/o this call each would inherit all pipe handles created so far.
-    HANDLE handlesToInherit[] = {inRead_.get(), outWrite_.get(), errWrite_.get()};
-    RETURN_IF_WIN32_BOOL_FALSE(::UpdateProcThreadAttribute(
-        attrList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST, &handlesToInherit, sizeof(handlesToInherit), nullptr, nullptr));
+    std::vector<HANDLE> handlesToInherit {inRead_.get(), outWrite_.get(), errWrite_.get()};
+    if (shm)
+    {
+        auto shmHandles = shm->InheritableHandles();
+        handlesToInherit.insert(handlesToInherit.end(), shmHandles.begin(), shmHandles.end());
+    }
+    RETURN_IF_WIN32_BOOL_FALSE(::UpdateProcThreadAttribute(attrList, 0, PROC_THREAD_ATTRIBUTE_HANDLE_LIST,
+        handlesToInherit.data(), handlesToInherit.size() * sizeof(HANDLE), nullptr, nullptr));
 
     // clang-format off
     DWORD64 policy[2] =
@@ -144,18 +238,37 @@ try
 
 #pragma endregion
 
+    // A new stop state per launch, so a stale read of the previous process never sees the current one.
+    reading_   = std::stop_source();
+    keepAlive_ = std::stop_source();
+
     // Handler for messages from child process.
     // clang-format off
-    auto onMessage = [&](const std::string_view msg, const ipc::Target& target)
+    auto onMessage = [weak = weak_from_this(), stop = reading_.get_token(),
+        gate = std::make_shared<ReadGate>(transport_)](const std::string_view msg, const ipc::Target& target)
     {
-        if (spdlog::should_log(spdlog::level::trace))
+        auto self = weak.lock();
+        if (!self || stop.stop_requested())
+            return true;
+
         {
-            std::string m = msg.data();
-            std::erase_if(m, [](char c) { return c=='\r'||c=='\n'; });
-            spdlog::trace("RX-B: {} for {}", m, Strings::ToUtf8(target.ToString()));
+            std::shared_lock lock(self->readLock_);
+            if (stop.stop_requested())
+                return true;
+
+            if (spdlog::should_log(spdlog::level::trace))
+            {
+                std::string m = msg.data();
+                std::erase_if(m, [](char c) { return c=='\r'||c=='\n'; });
+                spdlog::trace("RX-B: {} for {} after {}us", m, Strings::ToUtf8(target.ToString()), target.Meta.Age());
+            }
+
+            if (self->orchestrator_->OnMessage(self.get(), msg, target, gate) == S_FALSE)
+                return true;
         }
-                        
-        return orchestrator_->OnMessage(this, msg, target) == S_FALSE;
+
+        // Not while holding readLock_, a relaunch waits for it.
+        return !gate->WaitOpen(stop);
     };
     // clang-format on
 
@@ -278,48 +391,87 @@ try
         orchestrator_->AssignProcessToJobObject(this);
     }
 
+    processId_.store(processInfo_.dwProcessId);
+
     if (WI_IsFlagSet(creationFlags, CREATE_SUSPENDED))
     {
         ::ResumeThread(processInfo_.hThread);
     }
 
     // If the host process writes to stdout it is a message to some service/session.
-    ipc::StartRead(outRead_.get(), reader_, onMessage, processInfo_.dwProcessId);
+    // Pipes are read by the orchestrator's event loop, a shared memory channel needs a thread of its own.
+    HRESULT hr = transport_->StartRead(orchestrator_->loop_, onMessage);
+    if (hr == E_NOTIMPL)
+        hr = transport_->StartRead(reader_, onMessage, processInfo_.dwProcessId);
+    RETURN_IF_FAILED(hr);
 
     // If the host process writes to stderr it is logging output.
     // This will be forwarded to a specific spdlog logger.
     StartForwardStderr();
 
     // If the host process terminates unexpectedly we try to re-launch it.
-    keepAlive_ = std::jthread([this](std::stop_token stoken) {
-        Process::SetThreadName(std::format(L"UMB-KeepAlive-{}", processInfo_.dwProcessId).c_str());
-        if (WAIT_OBJECT_0 == ::WaitForSingleObject(processInfo_.hProcess, INFINITE) &&
-            !orchestrator_->IsShuttingDown() && !stoken.stop_requested())
-        {
+    if (processInfo_.hProcess)
+    {
+        wil::unique_handle process;
+        RETURN_IF_WIN32_BOOL_FALSE(::DuplicateHandle(::GetCurrentProcess(), processInfo_.hProcess,
+            ::GetCurrentProcess(), &process, SYNCHRONIZE, FALSE, 0));
+
+        RETURN_IF_FAILED(orchestrator_->loop_.WatchExit(
+            process.release(), [weak = weak_from_this(), stop = keepAlive_.get_token()] {
+                auto self = weak.lock();
+                if (!self || stop.stop_requested() || self->orchestrator_->IsShuttingDown())
+                    return;
+
+                // Relaunching blocks, so not on the event loop.
+                auto launcher = std::thread([self, stop] {
+                    Process::SetThreadName(
+                        std::format(L"UMB-KeepAliveRelaunch-{}", self->processId_.load()).c_str());
 #ifdef DEBUG
-            // In case we've a console attached and just closed it, we'll get terminated soon
-            // by the default console control handler. Wait some time to be sure we're
-            // not in the process of shutting down.
-            // This only helps when running e.g. 1 child process as it takes some time for the child
-            // to process the Ctrl-C. As long as not every child has completed processing the broker wont be
-            // terminated.
-
-            ::Sleep(1000);
+                    // In case we've a console attached and just closed it, we'll get terminated soon
+                    // by the default console control handler. Wait some time to be sure we're
+                    // not in the process of shutting down.
+                    // This only helps when running e.g. 1 child process as it takes some time for the child
+                    // to process the Ctrl-C. As long as not every child has completed processing the broker wont be
+                    // terminated.
+
+                    ::Sleep(1000);
 #endif
-            // run in another thread so that keepAlive_ can be joined
-            auto launcher = std::thread([this] {
-                Process::SetThreadName(std::format(L"UMB-KeepAliveRelaunch-{}", processInfo_.dwProcessId).c_str());
-                Launch(LaunchReason::Restart);
-                LoadModules();
-            });
-            launcher.detach();
-        }
-    });
+                    // Terminated in the meantime, e.g. as a new config no longer wants this process.
+                    std::scoped_lock lock(self->orchestrator_->lifecycleLock_);
+                    if (stop.stop_requested() || self->orchestrator_->IsShuttingDown())
+                        return;
+
+                    self->Launch(LaunchReason::Restart);
+                    self->LoadModules();
+                });
+                launcher.detach();
+            }));
+    }
 
     // Tell the host his Service GUID. This is used to talk to the host as such to e.g. load modules.
     // Modules hosted within the host process have their own one or multiple service GUIDs.
-    json msg = ipc::HostInitMsg {target_.Service, childProcessConfig_->GroupName};
-    RETURN_IF_FAILED(SendMsg(msg.dump(), ipc::Target(ipc::KnownService::HostInit)));
+    ipc::HostInitMsg init {target_.Service, childProcessConfig_->GroupName};
+    if (shm)
+        init.SharedMemory = shm->Describe();
+    // Framed the legacy way until the host acknowledged a newer version.
+    init.FrameVersion  = ipc::FrameVersion::Latest;
+    init.CompressAbove = ipc::GetCompressAbove();
+    init.MaxReassembly = ipc::GetMaxReassembly();
+    init.SendWindow    = childProcessConfig_->SendWindow;
+    frameVersion_.store(ipc::FrameVersion::Legacy);
+    // Credit taken for msgs of the previous process isn't granted to this one.
+    sendWindow_.store(0);
+    returned_.store(0);
+    ++launches_;
+
+    // Always via stdin, the host only learns about a shared memory channel by this message.
+    json msg = init;
+    RETURN_IF_FAILED(pipe->Send(msg.dump(), ipc::Target(ipc::KnownService::HostInit)));
+
+    // Incl. the id of the host's own service.
+    RETURN_IF_FAILED(AnnounceServiceIds(ipc::Services().Count()));
+
+    RETURN_IF_FAILED(outbound->Start(transport_, processInfo_.dwProcessId));
 
     return S_OK;
 }
@@ -330,20 +482,21 @@ try
 {
     // Ensure a stopped proc wont trigger a relaunch.
     keepAlive_.request_stop();
-    // diag reader thread should stop
-    stderrForwarder_.request_stop();
-    // Message reader thread should stop
+    // Messages still read are ignored, reading ends as the process closes its end.
+    reading_.request_stop();
+    // A shared memory reader thread should stop.
     reader_.request_stop();
     // Should run free, so that in dtor it doesn't throw a deadlock assertion.
     // These lines here may run from within the reader thread!
-    reader_.detach();
+    if (reader_.joinable())
+        reader_.detach();
 
     // Tell the child proc to terminate itself.
-    json msg = ipc::HostCmdMsg {ipc::HostCmdMsg::Cmd::Terminate, ""};
-
-    RETURN_IF_FAILED(ipc::Send(inWrite_.get(), msg.dump(), target_));
-    // This ensures the stdin read loop within the child proc exits.
-    inWrite_.reset();
+    const auto outbound = outbound_.load();
+    RETURN_HR_IF_NULL(E_NOT_VALID_STATE, outbound);
+    RETURN_IF_FAILED(outbound->Push(HostCmd(target_, frameVersion_.load(), ipc::HostCmdMsg::Cmd::Terminate), false));
+    // Once the queue is written the transport gets closed, which ensures the read loop within the child proc exits.
+    outbound->Close();
 
     return S_OK;
 }
@@ -352,15 +505,16 @@ CATCH_RETURN();
 HRESULT ChildProcessInstance::LoadModules() noexcept
 try
 {
+    const auto outbound = outbound_.load();
+    RETURN_HR_IF_NULL(E_NOT_VALID_STATE, outbound);
+
     for (auto& mod : childProcessConfig_->Modules)
     {
         if (orchestrator_->IsShuttingDown())
             return S_OK;
 
-        json args = ipc::HostCtrlModuleArgs {ipc::HostCtrlModuleArgs::Cmd::Load, ToUtf8(mod)};
-        json msg  = ipc::HostCmdMsg {ipc::HostCmdMsg::Cmd::CtrlModule, args.dump()};
-
-        RETURN_IF_FAILED(ipc::Send(inWrite_.get(), msg.dump(), target_));
+        const ipc::HostCtrlModuleArgs args {ipc::HostCtrlModuleArgs::Cmd::Load, ToUtf8(mod)};
+        RETURN_IF_FAILED(outbound->Push(HostCmd(target_, frameVersion_.load(), args), false));
     }
     return S_OK;
 }
@@ -405,38 +559,28 @@ spdlog::level::level_enum LevelFromMsg(PCSTR msg)
 void ChildProcessInstance::StartForwardStderr() noexcept
 {
     // Host process is writing UTF8.
-    // This may be multiple messages separated by \r\n
+    // This may be multiple messages separated by \r\n, each followed by a zero-term
     // => split and process one-by-one.
-    // Messages maybe aren't read by a single ReadFile(), e.g. if writing into stderr is faster than reading here.
+    // Messages maybe aren't read at once, e.g. if writing into stderr is faster than reading here.
     // Thus we need to find line endings (\r\n) and accumulate until then.
-    stderrForwarder_ = std::jthread([&](std::stop_token stoken) {
-        Process::SetThreadName(std::format(L"UMB-ForwardStderr-{}", processInfo_.dwProcessId).c_str());
-        const size_t bufSize = 4096;
-
-        std::string msg;
-        char        buf[bufSize] = {};
-        DWORD       read         = 0;
-        while (
-            !stoken.stop_requested() && ::ReadFile(errRead_.get(), buf, bufSize - 1, &read, nullptr) && read < bufSize)
-        {
-            buf[read] = 0; // so we can do str ops
-
-            char* pos = buf;
-            while (*pos)
+    (void)transport_->StartReadDiag(
+        orchestrator_->loop_,
+        [msg = std::string()](std::string_view output) mutable {
+            while (!output.empty())
             {
-                char* end = strchr(pos, '\r');
-                if (!end)
+                const size_t end = output.find('\r');
+                if (end == std::string_view::npos)
                 {
-                    msg.append(pos);
+                    msg.append(output);
                     break;
                 }
 
-                *end++ = 0;
-                if (*end == '\n')
-                    *end++ = 0;
-
-                msg.append(pos);
+                msg.append(output.substr(0, end));
+                output.remove_prefix(end + 1);
+                if (!output.empty() && output.front() == '\n')
+                    output.remove_prefix(1);
 
+                std::erase(msg, '\0');
                 auto level = LevelFromMsg(msg.c_str());
                 if (level != spdlog::level::off)
                 {
@@ -445,25 +589,128 @@ void ChildProcessInstance::StartForwardStderr() noexcept
                     g_loggerStdErr->flush();
                 }
                 msg.clear();
-                pos = end;
             }
-        }
-    });
+        });
+}
+
+void ChildProcessInstance::ReadGate::Close() noexcept
+{
+    std::scoped_lock lock(lock_);
+    if (++held_ == 1)
+        if (const auto transport = transport_.lock())
+            byLoop_ = transport->PauseRead();
+}
+
+void ChildProcessInstance::ReadGate::Open() noexcept
+{
+    {
+        std::scoped_lock lock(lock_);
+        if (--held_ != 0)
+            return;
+
+        if (byLoop_)
+            if (const auto transport = transport_.lock())
+                transport->ResumeRead();
+        byLoop_ = false;
+    }
+    opened_.notify_all();
 }
 
-HRESULT ChildProcessInstance::SendMsg(const std::string_view msg, const ipc::Target& target)
+bool ChildProcessInstance::ReadGate::WaitOpen(std::stop_token stop) noexcept
+{
+    std::unique_lock lock(lock_);
+    return opened_.wait(lock, stop, [&] { return held_ <= 0 || byLoop_; });
+}
+
+HRESULT ChildProcessInstance::SendMsg(
+    const ipc::Frame& frame, const ipc::Target& target, const std::shared_ptr<void>& credit)
 {
     if (target.Session != ipc::KnownSession::Any)
     {
         // Only send to a single session
         DWORD session = ipc::KnownSession::Any;
-        if (!::ProcessIdToSessionId(processInfo_.dwProcessId, &session) || session != target.Session)
+        if (!::ProcessIdToSessionId(processId_.load(), &session) || session != target.Session)
             return S_FALSE;
     }
-    RETURN_IF_FAILED(ipc::Send(inWrite_.get(), msg, target));
+    // Loaded once, a relaunch may replace it meanwhile.
+    const auto outbound = outbound_.load();
+    RETURN_HR_IF_NULL(E_NOT_VALID_STATE, outbound);
+
+    if (target.Id != ipc::KnownServiceId::Unresolved)
+        RETURN_IF_FAILED(AnnounceServiceIds(target.Id + 1));
+
+    // Only blocks if the host doesn't keep up and its queue is configured to do so.
+    return outbound->Push(frame, true, credit);
+}
 
+std::shared_ptr<void> ChildProcessInstance::TakeCredit(size_t size) noexcept
+{
+    if (!sendWindow_.load())
+        return {};
+
+    const uint32_t launch = launches_.load();
+    try
+    {
+        // Owns nothing, it's just the release which matters.
+        return std::shared_ptr<void>(nullptr, [self = weak_from_this(), launch, size](void*) {
+            if (const auto process = self.lock())
+                process->ReturnCredit(launch, size);
+        });
+    }
+    catch (...)
+    {
+        // Rather let the msg go without flow control than the host lose the credit for good.
+        LOG_CAUGHT_EXCEPTION();
+        ReturnCredit(launch, size);
+        return {};
+    }
+}
+
+void ChildProcessInstance::ReturnCredit(uint32_t launch, size_t size) noexcept
+try
+{
+    const size_t window = sendWindow_.load();
+    if (!window || launch != launches_.load())
+        return;
+
+    // A batch is a fraction of the window, so the host rarely runs dry while a grant is on its way.
+    const size_t returned = returned_.fetch_add(size) + size;
+    if (returned < window / 8)
+        return;
+
+    const size_t grant = returned_.exchange(0);
+    if (!grant)
+        return;
+
+    if (const auto outbound = outbound_.load())
+        LOG_IF_FAILED(outbound->Push(HostCmd(target_, frameVersion_.load(), ipc::HostCreditArgs {grant}), false));
+}
+CATCH_LOG();
+
+HRESULT ChildProcessInstance::AnnounceServiceIds(ipc::ServiceId upTo) noexcept
+try
+{
+    if (knownServiceIds_.load(std::memory_order_acquire) >= upTo)
+        return S_OK;
+
+    std::scoped_lock lock(announceLock_);
+    const auto       known = knownServiceIds_.load(std::memory_order_relaxed);
+    if (known >= upTo)
+        return S_OK;
+
+    // Everything assigned by now, so the host is rarely told more than once.
+    const auto count = ipc::Services().Count();
+    json       msg   = ipc::ServiceIdsMsg {known, ipc::Services().Range(known, count)};
+    ipc::Frame frame(msg.dump(), Control(ipc::Target(ipc::KnownService::ServiceIds)), frameVersion_.load());
+    const auto outbound = outbound_.load();
+    RETURN_HR_IF_NULL(E_NOT_VALID_STATE, outbound);
+    RETURN_IF_FAILED(outbound->Push(frame, false));
+
+    // Queued ahead of any frame pushed after others see the ids as known.
+    knownServiceIds_.store(count, std::memory_order_release);
     return S_OK;
 }
+CATCH_RETURN();
 
 // If we're running as service (=session 0) and the to be launched process will run in another session (!=0)
 // we have to use another job object since processes grouped in a job shall all run in the same session.
@@ -485,6 +732,10 @@ bool ChildProcessInstance::operator==(const ChildProcessInstance& rhs) const
         childProcessConfig_->Wow64 != rhs.childProcessConfig_->Wow64 ||
         childProcessConfig_->HigherIntegrityLevel != rhs.childProcessConfig_->HigherIntegrityLevel ||
         childProcessConfig_->Ui != rhs.childProcessConfig_->Ui ||
+        childProcessConfig_->Transport != rhs.childProcessConfig_->Transport ||
+        childProcessConfig_->OutboundCapacity != rhs.childProcessConfig_->OutboundCapacity ||
+        childProcessConfig_->Overflow != rhs.childProcessConfig_->Overflow ||
+        childProcessConfig_->SendWindow != rhs.childProcessConfig_->SendWindow ||
         childProcessConfig_->GroupName != rhs.childProcessConfig_->GroupName ||
         childProcessConfig_->AllUsers != rhs.childProcessConfig_->AllUsers)
         return false;
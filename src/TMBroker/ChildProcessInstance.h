@@ -1,15 +1,20 @@
 #pragma once
 #include <Windows.h>
-#include <unordered_set>
+#include <condition_variable>
+#include <shared_mutex>
+#include <stop_token>
 #include <wil/resource.h>
 #include <nlohmann/json.hpp>
 using json = nlohmann::json;
 #include "ipc.h"
+#include "ServiceTable.h"
+#include "Transport.h"
+#include "OutboundQueue.h"
 
 class Orchestrator;
 struct ChildProcessConfig;
 
-class ChildProcessInstance final
+class ChildProcessInstance final : public std::enable_shared_from_this<ChildProcessInstance>
 {
     friend Orchestrator;
 
@@ -18,6 +23,7 @@ public:
         DWORD session = ipc::KnownSession::Any)
         : orchestrator_(orchestrator), childProcessConfig_(childProcessConfig), target_(Guid(true), session)
     {
+        target_.Id = ipc::Services().Intern(target_.Service);
     }
 
     enum class LaunchReason
@@ -31,27 +37,82 @@ public:
     HRESULT LoadModules() noexcept;
     HRESULT UnloadModules() noexcept;
 
-    HRESULT SendMsg(const std::string_view msg, const ipc::Target& target);
+    // The frame is queued as is, see Orchestrator::SendToAllChildren(). credit is held until the frame is written.
+    HRESULT SendMsg(const ipc::Frame& frame, const ipc::Target& target, const std::shared_ptr<void>& credit = {});
+
+    // Credit for a message of size bytes this host sent, held by everything referring to the message. Once the last
+    // reference is released, i.e. the message was written to all recipients or dropped, the host gets the credit
+    // back. Empty if the host doesn't do flow control, see HostInitMsg::SendWindow.
+    std::shared_ptr<void> TakeCredit(size_t size) noexcept;
+
+    // Ensures the host knows all service ids below upTo, so it can decode frames carrying them.
+    HRESULT AnnounceServiceIds(ipc::ServiceId upTo) noexcept;
 
 private:
+    // Holds off reading from the host while msgs it sent wait for the dispatcher, see Dispatcher::Post(). The event
+    // loop just stops reading from it, a reader thread of its own waits. One per launch.
+    class ReadGate final
+    {
+    public:
+        explicit ReadGate(std::weak_ptr<ipc::Transport> transport) : transport_(std::move(transport))
+        {
+        }
+
+        // From within onMessage, once per Open() to come.
+        void Close() noexcept;
+        // From any thread, even before the Close() it matches.
+        void Open() noexcept;
+        // Reader thread only, after onMessage. Returns false if stop is requested meanwhile.
+        bool WaitOpen(std::stop_token stop) noexcept;
+
+    private:
+        std::weak_ptr<ipc::Transport> transport_;
+        std::mutex                    lock_;
+        std::condition_variable_any   opened_;
+        // Close() minus Open() calls, the gate is closed while positive.
+        int                           held_   = 0;
+        // The event loop holds off reading, nobody needs to wait.
+        bool                          byLoop_ = false;
+    };
+
     void StartForwardStderr() noexcept;
 
     bool ShouldBreakAwayFromJob() const;
 
+    // Grants credit back in batches, unless the host was relaunched since it was taken.
+    void ReturnCredit(uint32_t launch, size_t size) noexcept;
+
     bool operator==(const ChildProcessInstance& rhs) const;
 
-    Orchestrator*                              orchestrator_;
-    std::shared_ptr<ChildProcessConfig>        childProcessConfig_;
-    ipc::Target                                target_;
-    wil::unique_process_information            processInfo_;
-    wil::unique_handle                         inRead_;
-    wil::unique_handle                         inWrite_;
-    wil::unique_handle                         outRead_;
-    wil::unique_handle                         outWrite_;
-    wil::unique_handle                         errRead_;
-    wil::unique_handle                         errWrite_;
-    std::jthread                               stderrForwarder_;
-    std::jthread                               reader_;
-    std::jthread                               keepAlive_;
-    std::unordered_set<Guid, absl::Hash<Guid>> services_;
+    Orchestrator*                               orchestrator_;
+    std::shared_ptr<ChildProcessConfig>         childProcessConfig_;
+    ipc::Target                                 target_;
+    // Only touched while launching or terminating, others use processId_.
+    wil::unique_process_information             processInfo_;
+    // Of the running process, 0 while there's none.
+    std::atomic<DWORD>                          processId_ {0};
+    // Child process ends of its stdin/stdout/stderr pipes, only open until the process is created.
+    wil::unique_handle                          inRead_;
+    wil::unique_handle                          outWrite_;
+    wil::unique_handle                          errWrite_;
+    std::shared_ptr<ipc::Transport>             transport_;
+    // Replaced on relaunch while dispatcher and writer threads read it, load it once.
+    std::atomic<std::shared_ptr<OutboundQueue>> outbound_;
+    // Service ids below are known to the host.
+    std::atomic<ipc::ServiceId>                 knownServiceIds_ {ipc::KnownServiceId::FirstAssigned};
+    std::mutex                                  announceLock_;
+    // Of frames to the host, as acknowledged by it.
+    std::atomic<uint8_t>                        frameVersion_ {ipc::FrameVersion::Legacy};
+    // Of the host as acknowledged by it, 0 if it doesn't do flow control.
+    std::atomic<size_t>                         sendWindow_ {0};
+    // Credit returned but not granted to the host yet.
+    std::atomic<size_t>                         returned_ {0};
+    std::atomic<uint32_t>                       launches_ {0};
+    // Stdout and stderr are read and the process exit is observed by the orchestrator's event loop.
+    // Stopped once the launched process is done with, held shared while handling a message read from it.
+    std::stop_source                            reading_;
+    std::shared_mutex                           readLock_;
+    std::stop_source                            keepAlive_;
+    // Only for a shared memory channel, which can't be read by the event loop.
+    std::jthread                                reader_;
 };
@@ -0,0 +1,131 @@
+#include "pch.h"
+#include "Dispatcher.h"
+#ifdef _WIN32
+#    include "TMProcess.h"
+#else
+#    include <pthread.h>
+#endif
+
+namespace
+{
+#ifdef _WIN32
+void SetDispatchThreadName(size_t n)
+{
+    Process::SetThreadName(std::format(L"TM-Dispatch-{}", n).c_str());
+}
+#else
+void SetDispatchThreadName(size_t n)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "TM-Dispatch-%zu", n);
+    (void)::pthread_setname_np(::pthread_self(), name);
+}
+#endif
+}
+
+HRESULT Dispatcher::Start(Handler handler, size_t threads, size_t capacity) noexcept
+try
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, !lanes_.empty());
+
+    if (!threads)
+        threads = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, MaxThreads);
+
+    handler_  = std::move(handler);
+    capacity_ = capacity ? capacity : 1;
+
+    for (size_t i = 0; i < threads; ++i)
+    {
+        lanes_.push_back(std::make_unique<Lane>());
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        auto& lane  = *lanes_[i];
+        lane.Worker = std::thread([this, &lane, i] {
+            SetDispatchThreadName(i);
+            Run(lane);
+        });
+    }
+    return S_OK;
+}
+CATCH_RETURN();
+
+void Dispatcher::Stop() noexcept
+{
+    for (auto& lane : lanes_)
+    {
+        {
+            std::scoped_lock lock(lane->Lock);
+            lane->Stopped = true;
+        }
+        lane->DataAvailable.notify_all();
+        lane->SpaceAvailable.notify_all();
+    }
+    for (auto& lane : lanes_)
+    {
+        if (lane->Worker.joinable())
+            lane->Worker.join();
+    }
+}
+
+HRESULT Dispatcher::Post(Item&& item, std::function<void()> resume) noexcept
+try
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, lanes_.empty());
+
+    auto& lane = *lanes_[item.Target.Id % lanes_.size()];
+
+    std::unique_lock lock(lane.Lock);
+    // Back pressure to the sender as if it was handled inline.
+    if (!resume)
+        lane.SpaceAvailable.wait(lock, [&] { return lane.Items.size() < capacity_ || lane.Stopped; });
+    RETURN_HR_IF(E_NOT_VALID_STATE, lane.Stopped);
+
+    // Beyond the capacity by what the sender posts until it's held off.
+    const bool full = lane.Items.size() >= capacity_;
+    if (full)
+        lane.Resume.push_back(std::move(resume));
+
+    // The worker only waits once it drained the lane.
+    const bool wasEmpty = lane.Items.empty();
+    lane.Items.push_back(std::move(item));
+
+    lock.unlock();
+    if (wasEmpty)
+        lane.DataAvailable.notify_one();
+    return full ? S_FALSE : S_OK;
+}
+CATCH_RETURN();
+
+void Dispatcher::Run(Lane& lane) noexcept
+{
+    std::deque<Item>                   items;
+    std::vector<std::function<void()>> resume;
+    for (;;)
+    {
+        {
+            std::unique_lock lock(lane.Lock);
+            lane.DataAvailable.wait(lock, [&] { return !lane.Items.empty() || lane.Stopped; });
+            if (lane.Items.empty())
+                return;
+
+            // Take all at once, a busy sender then costs a lock round trip per batch instead of per message.
+            items.swap(lane.Items);
+            resume.swap(lane.Resume);
+        }
+        lane.SpaceAvailable.notify_all();
+
+        // Senders held off may go on while the batch is handled.
+        for (const auto& f : resume)
+        {
+            f();
+        }
+        resume.clear();
+
+        for (const auto& item : items)
+        {
+            handler_(item);
+        }
+        items.clear();
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "platform.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ipc.h"
+
+class ChildProcessInstance;
+
+// Routes messages received from hosts on a small pool of threads instead of the event loop thread which read them.
+// Routing may block, e.g. on the full outbound queue of a host or while a config is applied, the loop threads read
+// all hosts and never may. It also lets the fan-out of a single busy sender spread across cores.
+// Messages are partitioned by target service: those to the same service are handled in order by the same thread,
+// messages to different services may overtake each other.
+class Dispatcher final
+{
+public:
+    struct Item
+    {
+        std::string                           Msg;
+        ipc::Target                           Target;
+        std::shared_ptr<ChildProcessInstance> Sender;
+        // See ChildProcessInstance::TakeCredit().
+        std::shared_ptr<void>                 Credit;
+    };
+
+    using Handler = std::function<void(const Item& item)>;
+
+    // Items per thread waiting to be handled before Post() holds off the sender.
+    static constexpr size_t DefaultCapacity = 1024;
+
+    // One thread per core, but not more than that many.
+    static constexpr size_t MaxThreads = 8;
+
+    Dispatcher()                             = default;
+    Dispatcher(const Dispatcher&)            = delete;
+    Dispatcher& operator=(const Dispatcher&) = delete;
+    ~Dispatcher()
+    {
+        Stop();
+    }
+
+    // threads == 0 picks one per core up to MaxThreads.
+    HRESULT Start(Handler handler, size_t threads = 0, size_t capacity = DefaultCapacity) noexcept;
+
+    // Lets the threads handle what's queued and waits for them. Items posted afterwards are rejected.
+    void Stop() noexcept;
+
+    // Queues item for the thread of item.Target.Id. While that one is full Post() blocks, unless there's resume: then
+    // item is queued anyway, S_FALSE returned and resume called once the thread took what's queued. Meanwhile the
+    // caller should hold off the sender, e.g. not read from it.
+    HRESULT Post(Item&& item, std::function<void()> resume = {}) noexcept;
+
+private:
+    // Own cache line each, as the lanes are hit by different readers and workers.
+    struct alignas(64) Lane
+    {
+        std::mutex                         Lock;
+        std::condition_variable            DataAvailable;
+        std::condition_variable            SpaceAvailable;
+        std::deque<Item>                   Items;
+        // Of items posted while full.
+        std::vector<std::function<void()>> Resume;
+        bool                               Stopped = false;
+        std::thread                        Worker;
+    };
+
+    void Run(Lane& lane) noexcept;
+
+    Handler                            handler_;
+    size_t                             capacity_ = DefaultCapacity;
+    std::vector<std::unique_ptr<Lane>> lanes_;
+};
@@ -0,0 +1,133 @@
+#include "pch.h"
+#include "Epoch.h"
+
+namespace Epoch
+{
+namespace
+{
+const uint64_t Idle = 0;
+
+struct alignas(64) Slot
+{
+    std::atomic<uint64_t> Pinned {Idle};
+    std::atomic<bool>     InUse {false};
+};
+
+struct RetiredEntry
+{
+    uint64_t              Epoch;
+    std::function<void()> Deleter;
+};
+
+struct Domain
+{
+    std::atomic<uint64_t>     Current {1};
+    // Guards growing Slots and Retired, only taken by writers and by a thread's first Guard.
+    std::mutex                Lock;
+    std::deque<Slot>          Slots;
+    std::vector<RetiredEntry> Retired;
+};
+
+// Never freed, detached threads may still unpin while the process exits.
+Domain& TheDomain()
+{
+    static Domain* domain = new Domain();
+    return *domain;
+}
+
+Slot* AcquireSlot()
+{
+    auto&            domain = TheDomain();
+    std::scoped_lock lock(domain.Lock);
+
+    for (auto& slot : domain.Slots)
+    {
+        bool inUse = false;
+        if (slot.InUse.compare_exchange_strong(inUse, true))
+            return &slot;
+    }
+
+    auto& slot = domain.Slots.emplace_back();
+    slot.InUse = true;
+    return &slot;
+}
+
+// A thread's slot is handed to another thread once it exits.
+struct ThreadState
+{
+    Slot*  PinSlot = nullptr;
+    size_t Depth   = 0;
+
+    ~ThreadState()
+    {
+        if (!PinSlot)
+            return;
+
+        PinSlot->Pinned.store(Idle, std::memory_order_release);
+        PinSlot->InUse.store(false, std::memory_order_release);
+    }
+};
+
+thread_local ThreadState t_state;
+}
+
+Guard::Guard() noexcept
+{
+    if (t_state.Depth++ > 0)
+        return;
+
+    if (!t_state.PinSlot)
+        t_state.PinSlot = AcquireSlot();
+
+    t_state.PinSlot->Pinned.store(TheDomain().Current.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+}
+
+Guard::~Guard()
+{
+    if (--t_state.Depth > 0)
+        return;
+
+    t_state.PinSlot->Pinned.store(Idle, std::memory_order_release);
+}
+
+void Retire(std::function<void()> deleter)
+{
+    auto& domain = TheDomain();
+
+    // Readers pinning from now on see whatever replaced the retired data.
+    const uint64_t epoch = domain.Current.fetch_add(1, std::memory_order_seq_cst);
+    {
+        std::scoped_lock lock(domain.Lock);
+        domain.Retired.push_back({epoch, std::move(deleter)});
+    }
+    Reclaim();
+}
+
+void Reclaim()
+{
+    auto& domain = TheDomain();
+
+    std::vector<RetiredEntry> ready;
+    {
+        std::scoped_lock lock(domain.Lock);
+
+        uint64_t oldest = UINT64_MAX;
+        for (const auto& slot : domain.Slots)
+        {
+            const uint64_t pinned = slot.Pinned.load(std::memory_order_seq_cst);
+            if (pinned != Idle)
+                oldest = std::min(oldest, pinned);
+        }
+
+        // A reader which pinned epoch n may still see anything retired at epoch n or later.
+        auto stillVisible = std::partition(domain.Retired.begin(), domain.Retired.end(),
+            [oldest](const RetiredEntry& retired) { return retired.Epoch < oldest; });
+        ready.assign(std::make_move_iterator(domain.Retired.begin()), std::make_move_iterator(stillVisible));
+        domain.Retired.erase(domain.Retired.begin(), stillVisible);
+    }
+
+    // Outside the lock, as deleting may e.g. release the last reference to a child process.
+    for (auto& retired : ready)
+        retired.Deleter();
+}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Epoch based reclamation for data which is read without taking locks.
+// A reader pins the current epoch while it accesses shared data. Data unlinked by a writer is retired and deleted
+// once every reader which might still see it has unpinned, so readers never wait for writers or vice versa.
+namespace Epoch
+{
+// Pins the current epoch for the lifetime of the guard. May be nested.
+class Guard final
+{
+public:
+    Guard() noexcept;
+    ~Guard();
+
+    Guard(const Guard&)            = delete;
+    Guard& operator=(const Guard&) = delete;
+};
+
+// Runs deleter once all readers which pinned an epoch before this call have left.
+void Retire(std::function<void()> deleter);
+
+// Deletes whatever can be deleted by now.
+void Reclaim();
+}
+
+// An immutable snapshot of T which readers access without locks while writers replace it as a whole.
+template <typename T>
+class Snapshot final
+{
+public:
+    Snapshot() : current_(new T())
+    {
+    }
+    ~Snapshot()
+    {
+        delete current_.load();
+    }
+
+    Snapshot(const Snapshot&)            = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    // The returned snapshot stays valid as long as the caller holds an Epoch::Guard, or the caller is the writer.
+    const T& Get() const noexcept
+    {
+        return *current_.load(std::memory_order_seq_cst);
+    }
+
+    // Writers need to be serialized by the caller.
+    void Publish(std::unique_ptr<const T> next)
+    {
+        const T* previous = current_.exchange(next.release(), std::memory_order_seq_cst);
+        Epoch::Retire([previous] { delete previous; });
+    }
+
+private:
+    std::atomic<const T*> current_;
+};
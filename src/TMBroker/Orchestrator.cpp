@@ -14,6 +14,9 @@ using namespace Strings;
 
 #include "ModuleMeta.h"
 #include "ConfStore.h"
+#include "HostMsg.h"
+#include "Compression.h"
+#include "JsonPeek.h"
 
 Orchestrator::Orchestrator()
 {
@@ -33,6 +36,12 @@ try
 
     AssignProcessToJobObject(::GetCurrentProcess(), session_);
 
+    // Before the loop, which hands it all it reads.
+    RETURN_IF_FAILED(dispatcher_.Start([this](const Dispatcher::Item& item) {
+        LOG_IF_FAILED(Route(item.Msg, item.Target, item.Sender.get(), item.Credit));
+    }));
+    RETURN_IF_FAILED(loop_.Start());
+
     // Bootstrap-config by launching the ConfStore module in some process.
     auto conf = R"(
 {
@@ -75,14 +84,28 @@ CATCH_RETURN();
 HRESULT Orchestrator::UpdateChildProcessConfig(const json& conf) noexcept
 try
 {
+    std::scoped_lock lock(lifecycleLock_);
     childProcessesConfigs_.clear();
 
+    // Broker wide as a broadcast is compressed once for all hosts. Hosts launched from now on use it too.
+    ipc::SetCompressAbove(conf["Broker"].value("CompressAbove", ipc::DefaultCompressAbove));
+    ipc::SetMaxReassembly(conf["Broker"].value("MaxReassembly", ipc::DefaultMaxReassembly));
+
     for (auto& p : conf["Broker"]["ChildProcesses"])
     {
         bool        allUsers             = p["Session"] == -1;
         bool        wow64                = (sizeof(void*) == 8) && p.contains("Wow64") && p["Wow64"];
         bool        higherIntegrityLevel = p.contains("IntegrityLevel") && p["IntegrityLevel"] == "Higher";
         bool        ui                   = p.contains("Ui") && p["Ui"];
+        auto        transport            = p.contains("Transport") && p["Transport"] == "SharedMemory"
+                                               ? ChildProcessConfig::TransportKind::SharedMemory
+                                               : ChildProcessConfig::TransportKind::Pipe;
+        size_t      outboundCapacity     = p.value("OutboundCapacity", OutboundQueue::DefaultCapacity);
+        std::string overflowName         = p.value("Overflow", "Block");
+        auto        overflow             = overflowName == "DropOldest"   ? OutboundQueue::OverflowPolicy::DropOldest
+                                           : overflowName == "DropNewest" ? OutboundQueue::OverflowPolicy::DropNewest
+                                                                          : OutboundQueue::OverflowPolicy::Block;
+        size_t      sendWindow           = p.value("SendWindow", ChildProcessConfig::DefaultSendWindow);
         std::string groupName            = p["GroupName"];
         std::vector<std::wstring> modules;
 
@@ -90,7 +113,8 @@ try
         {
             modules.push_back(ToUtf16(m));
         }
-        auto cp = std::make_shared<ChildProcessConfig>(allUsers, wow64, higherIntegrityLevel, ui, groupName, modules);
+        auto cp = std::make_shared<ChildProcessConfig>(allUsers, wow64, higherIntegrityLevel, ui, transport,
+            outboundCapacity, overflow, sendWindow, groupName, modules);
         childProcessesConfigs_.push_back(cp);
     }
     return S_OK;
@@ -104,9 +128,11 @@ CATCH_RETURN();
 HRESULT Orchestrator::LaunchChildProcesses() noexcept
 try
 {
+    std::scoped_lock lock(lifecycleLock_);
+
     // Collect the desired collection of child processes.
     // There shall be no duplicate configs.
-    std::vector<std::unique_ptr<ChildProcessInstance>> desiredChildProcesses;
+    std::vector<std::shared_ptr<ChildProcessInstance>> desiredChildProcesses;
 
     for (auto process : childProcessesConfigs_)
     {
@@ -129,18 +155,18 @@ try
                 if (si->SessionId == 0)
                     continue;
 
-                auto cp = std::make_unique<ChildProcessInstance>(this, process, si->SessionId);
+                auto cp = std::make_shared<ChildProcessInstance>(this, process, si->SessionId);
                 desiredChildProcesses.push_back(std::move(cp));
             }
         }
         else
         {
-            auto cp = std::make_unique<ChildProcessInstance>(this, process);
+            auto cp = std::make_shared<ChildProcessInstance>(this, process);
             desiredChildProcesses.push_back(std::move(cp));
         }
     }
 
-    std::vector<std::unique_ptr<ChildProcessInstance>> processesToTerminate;
+    std::vector<std::shared_ptr<ChildProcessInstance>> processesToTerminate;
     // Check whether running processes match desired set of processes.
     // Terminate any non-desired.
     for (auto pi = childProcesses_.begin(); pi != childProcesses_.end();)
@@ -166,6 +192,7 @@ try
         else
         {
             // No longer desired, so terminate (deferred in a thread below) and remove.
+            routing_.Remove(p);
             processesToTerminate.emplace_back(std::move(*pi));
             pi = childProcesses_.erase(pi);
         }
@@ -183,6 +210,7 @@ try
 
     for (auto& newProcess : desiredChildProcesses)
     {
+        routing_.Insert(newProcess);
         childProcesses_.emplace_back(std::move(newProcess));
     }
 
@@ -201,10 +229,22 @@ CATCH_RETURN();
 HRESULT Orchestrator::Release() noexcept
 try
 {
-    for (auto& process : childProcesses_)
     {
-        process->Terminate();
+        std::scoped_lock lock(lifecycleLock_);
+        for (auto& process : childProcesses_)
+        {
+            process->Terminate();
+        }
     }
+
+    loop_.Stop();
+    dispatcher_.Stop();
+
+    const auto stats = ipc::GetCompressionStats();
+    if (stats.Compressed || stats.Decompressed)
+        spdlog::info("Compressed {} msgs from {} to {} bytes in {}us, {} incompressible. Decompressed {} in {}us",
+            stats.Compressed, stats.RawBytes, stats.CompressedBytes, stats.CompressMicros, stats.Incompressible,
+            stats.Decompressed, stats.DecompressMicros);
     return S_OK;
 }
 CATCH_RETURN();
@@ -218,63 +258,123 @@ try
 }
 CATCH_RETURN();
 
-HRESULT Orchestrator::SendToAllChildren(const std::string_view msg, const ipc::Target& target) noexcept
+HRESULT Orchestrator::SendToAllChildren(const std::string_view msg, const ipc::Target& target,
+    const ChildProcessInstance* sender, const std::shared_ptr<void>& credit) noexcept
 try
 {
+    // Framed on first use per frame version and then shared by all recipients of that version.
+    ipc::Frame frames[ipc::FrameVersion::Latest + 1];
+
+    // A target the broker made up itself has no id unless its service is a known one.
+    const ipc::ServiceId id =
+        target.Id != ipc::KnownServiceId::Unresolved ? target.Id : ipc::Services().Resolve(target.Service);
+
     // Dispatch to any process which may have a respective handler.
-    for (auto& process : childProcesses_)
-    {
-        // KnownService::All means a module has declared it wants to handle messages to any service, e.g. for
-        // debugging.
-        if (process->services_.contains(ipc::KnownService::All) || process->services_.contains(target.Service))
-        {
-            process->SendMsg(msg, target);
-        }
-    }
+    // KnownService::All means a module has declared it wants to handle messages to any service, e.g. for debugging.
+    routing_.ForEachSubscriber(id, [&](ChildProcessInstance* process) {
+        if (process == sender)
+            return;
+
+        const auto version = process->frameVersion_.load();
+        if (!frames[version])
+            frames[version] = ipc::Frame(msg, target, version);
+
+        process->SendMsg(frames[version], target, credit);
+    });
     return S_OK;
 }
 CATCH_RETURN();
 
-HRESULT Orchestrator::OnMessage(
-    ChildProcessInstance* fromProcess, const std::string_view msg, const ipc::Target& target) noexcept
+HRESULT Orchestrator::OnMessage(ChildProcessInstance* fromProcess, const std::string_view msg,
+    const ipc::Target& received, const std::shared_ptr<ChildProcessInstance::ReadGate>& gate) noexcept
 try
 {
     if (IsShuttingDown())
         return S_FALSE;
 
+    ipc::Target target = received;
+    if (target.Id == ipc::KnownServiceId::Unresolved)
+    {
+        // The host sent the GUID as it doesn't know an id for it yet. Tell it, so it won't need to again.
+        target.Id = ipc::Services().Intern(target.Service);
+        RETURN_IF_FAILED(fromProcess->AnnounceServiceIds(target.Id + 1));
+    }
+
     if (target.Service == ipc::KnownService::Broker)
     {
+        // The host accepted a frame version offered by HostInitMsg, frames to it may use it from now on.
+        const auto ack = json::parse(msg).get<ipc::HostInitAckMsg>();
+        fromProcess->frameVersion_.store(std::min(ack.FrameVersion, ipc::FrameVersion::Latest));
+        fromProcess->sendWindow_.store(ack.SendWindow);
+        return S_OK;
     }
-    else if (target.Service == ipc::KnownService::ModuleMetaConsumer)
+
+    // The host spent credit for it, which it gets back once the message is written to all recipients.
+    auto credit = fromProcess->TakeCredit(msg.size());
+
+    if (target.Service == ipc::KnownService::ModuleMetaConsumer)
     {
-        // Some module tells us which services it supports.
-        const auto mm = json::parse(msg).get<ipc::ModuleMeta>();
+        // Some module tells us which services it supports, only these are needed of it.
+        std::string_view              list;
+        std::vector<std::string_view> names;
+        std::vector<std::string>      parsed;
+        if (FAILED(ipc::PeekJson(msg, "Services", list)) || FAILED(ipc::PeekStrings(list, names)))
+        {
+            // Escaped after all, leave it to the parser.
+            const auto mm = json::parse(msg).get<ipc::ModuleMeta>();
+            parsed.assign(mm.Services.begin(), mm.Services.end());
+            names.assign(parsed.begin(), parsed.end());
+        }
 
-        for (const auto& s : mm.Services)
+        std::vector<ipc::ServiceId> services;
+        bool                        confStore = false;
+        for (const auto name : names)
         {
-            fromProcess->services_.emplace(Guid(s));
+            Guid service;
+            RETURN_IF_FAILED(service.Parse(name));
+            services.push_back(ipc::Services().Intern(service));
+            confStore |= service == ipc::KnownService::ConfStore;
         }
+        routing_.Add(fromProcess, services);
 
-        if (mm.Services.contains(ipc::KnownService::ConfStore.ToUtf8()))
+        if (confStore)
             confStoreReady_.SetEvent();
     }
     else
     {
-        if (target.Service == ipc::KnownService::ConfConsumer)
+        // Off the loop thread, routing may block. Reading from the sender is held off until the dispatcher caught up.
+        const HRESULT hr = dispatcher_.Post(
+            {std::string(msg), target, fromProcess->shared_from_this(), std::move(credit)}, [gate] { gate->Open(); });
+        RETURN_IF_FAILED(hr);
+        if (hr == S_FALSE)
+            gate->Close();
+    }
+    return S_OK;
+}
+CATCH_RETURN()
+
+HRESULT Orchestrator::Route(const std::string_view msg, const ipc::Target& target, const ChildProcessInstance* sender,
+    const std::shared_ptr<void>& credit) noexcept
+try
+{
+    if (IsShuttingDown())
+        return S_FALSE;
+
+    if (target.Service == ipc::KnownService::ConfConsumer)
+    {
+        // Some config changed.
+        // In case of the Broker config we need to recalc desired child processes, others aren't parsed at all.
+        std::string_view broker;
+        RETURN_IF_FAILED(ipc::PeekJson(msg, "Broker", broker));
+        if (!broker.empty())
         {
-            // Some config changed.
-            // In case of the Broker config we need to recalc desired child processes.
-            const json conf = json::parse(msg);
-            if (conf.contains("Broker"))
-            {
-                RETURN_IF_FAILED(UpdateChildProcessConfig(conf));
-                RETURN_IF_FAILED(LaunchChildProcesses());
-            }
+            RETURN_IF_FAILED(UpdateChildProcessConfig(json::parse(msg)));
+            RETURN_IF_FAILED(LaunchChildProcesses());
         }
-
-        // Dispatch to the world.
-        RETURN_IF_FAILED(SendToAllChildren(msg, target));
     }
+
+    // Dispatch to the world.
+    RETURN_IF_FAILED(SendToAllChildren(msg, target, sender, credit));
     return S_OK;
 }
 CATCH_RETURN()
@@ -1,5 +1,7 @@
 #pragma once
 #include <Windows.h>
+#include <atomic>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -10,6 +12,9 @@ using json = nlohmann::json;
 #include "ipc.h"
 
 #include "ChildProcessInstance.h"
+#include "RoutingIndex.h"
+#include "Dispatcher.h"
+#include "EventLoop.h"
 
 struct ChildProcessConfig;
 
@@ -41,17 +46,34 @@ public:
 
 private:
     // dispatch to all but the sending child process
-    HRESULT OnMessage(
-        ChildProcessInstance* fromProcess, const std::string_view msg, const ipc::Target& target) noexcept;
+    // Runs on the reader of the sender, which mostly is an event loop thread shared by all hosts: nothing here may
+    // block, or every host waits. That's interning service ids and announcing them, the Broker ack, adding the services
+    // of a ModuleMeta to routing_ and posting to dispatcher_. gate is closed instead while the dispatcher is behind.
+    HRESULT OnMessage(ChildProcessInstance* fromProcess, const std::string_view msg, const ipc::Target& received,
+        const std::shared_ptr<ChildProcessInstance::ReadGate>& gate) noexcept;
 
-    HRESULT SendToAllChildren(const std::string_view msg, const ipc::Target& target) noexcept;
+    // Runs on a Dispatcher thread, for all msgs OnMessage() doesn't handle itself. May block, e.g. on a full outbound
+    // queue or applying a Broker config, which holds off just the hosts posting to this thread.
+    HRESULT Route(const std::string_view msg, const ipc::Target& target, const ChildProcessInstance* sender,
+        const std::shared_ptr<void>& credit) noexcept;
+
+    // The sending host delivered to its own modules already. credit is held until written to all recipients.
+    HRESULT SendToAllChildren(const std::string_view msg, const ipc::Target& target,
+        const ChildProcessInstance* sender = nullptr, const std::shared_ptr<void>& credit = {}) noexcept;
 
     DWORD session_ = ipc::KnownSession::Any;
 
     bool shuttingDown_ = false;
 
     wil::unique_event_failfast                         confStoreReady_ {wil::EventOptions::ManualReset};
+    // Serializes changes to the set of child processes, e.g. applying a config while a crashed host is relaunched.
+    std::mutex                                         lifecycleLock_;
     std::vector<std::shared_ptr<ChildProcessConfig>>   childProcessesConfigs_;
-    std::vector<std::unique_ptr<ChildProcessInstance>> childProcesses_;
+    std::vector<std::shared_ptr<ChildProcessInstance>> childProcesses_;
     std::map<DWORD, wil::unique_handle>                jobObjects_;
+    RoutingIndex                                       routing_;
+    // Last, so its threads are gone before anything they use.
+    Dispatcher                                         dispatcher_;
+    // Reads from and watches all child processes, feeds dispatcher_ and is thus stopped before it.
+    ipc::EventLoop                                     loop_;
 };
@@ -0,0 +1,170 @@
+#include "pch.h"
+#include "OutboundQueue.h"
+#ifdef _WIN32
+#    include "TMProcess.h"
+#else
+#    include <pthread.h>
+#endif
+
+namespace
+{
+#ifdef _WIN32
+void SetWriterThreadName(DWORD pid)
+{
+    Process::SetThreadName(std::format(L"TM-Writer-{}", pid).c_str());
+}
+#else
+void SetWriterThreadName(DWORD pid)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "TM-Writer-%u", pid);
+    (void)::pthread_setname_np(::pthread_self(), name);
+}
+#endif
+}
+
+HRESULT OutboundQueue::Start(std::shared_ptr<ipc::Transport> transport, DWORD pid) noexcept
+try
+{
+    // The writer keeps the queue alive and ends once closed, so it never needs to be joined.
+    // This matters when a host hangs: terminating it must not wait for a write which never completes.
+    std::thread([self = shared_from_this(), transport, pid] {
+        SetWriterThreadName(pid);
+        self->Drain(*transport);
+    }).detach();
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT OutboundQueue::Push(const ipc::Frame& frame, bool mayDrop, const std::shared_ptr<void>& credit) noexcept
+try
+{
+    Entry            dropped;
+    std::unique_lock lock(lock_);
+    RETURN_HR_IF(E_NOT_VALID_STATE, closed_);
+    RETURN_IF_FAILED_EXPECTED(broken_);
+
+    const bool control = frame.Priority() == ipc::MsgPriority::Control;
+    if (mayDrop && !control && entries_.size() >= capacity_)
+    {
+        switch (policy_)
+        {
+            case OverflowPolicy::Block:
+            {
+                spaceAvailable_.wait(lock, [&] { return entries_.size() < capacity_ || closed_ || FAILED(broken_); });
+                RETURN_HR_IF(E_NOT_VALID_STATE, closed_);
+                RETURN_IF_FAILED_EXPECTED(broken_);
+                break;
+            }
+
+            case OverflowPolicy::DropOldest:
+            {
+                auto oldest = std::find_if(entries_.begin(), entries_.end(), [](const Entry& e) { return e.MayDrop; });
+                if (oldest != entries_.end())
+                {
+                    dropped = std::move(*oldest);
+                    entries_.erase(oldest);
+                    OnDropped();
+                }
+                break;
+            }
+
+            case OverflowPolicy::DropNewest:
+            {
+                OnDropped();
+                return S_FALSE;
+            }
+        }
+    }
+
+    if (control)
+        control_.push_back({frame, false, 0, ipc::TimestampNow(), credit});
+    else
+        entries_.push_back({frame, mayDrop, 0, 0, credit});
+    ++stats_.Enqueued;
+    stats_.MaxDepth = std::max(stats_.MaxDepth, entries_.size() + control_.size());
+
+    lock.unlock();
+    dataAvailable_.notify_one();
+    return S_OK;
+}
+CATCH_RETURN();
+
+void OutboundQueue::OnDropped() noexcept
+{
+    ++stats_.Dropped;
+    // Log at 1, 2, 4, 8... drops to not flood the log with a host which doesn't read at all.
+    if ((stats_.Dropped & (stats_.Dropped - 1)) == 0)
+        SPDLOG_WARN("Outbound queue full, dropped {} messages so far", stats_.Dropped);
+}
+
+void OutboundQueue::Close() noexcept
+{
+    {
+        std::scoped_lock lock(lock_);
+        closed_ = true;
+    }
+    dataAvailable_.notify_all();
+    spaceAvailable_.notify_all();
+}
+
+OutboundQueue::Stats OutboundQueue::GetStats() const
+{
+    std::scoped_lock lock(lock_);
+    Stats stats = stats_;
+    stats.Depth = entries_.size() + control_.size();
+    return stats;
+}
+
+void OutboundQueue::Drain(ipc::Transport& transport) noexcept
+{
+    // Released once lock_ is, like any entry.
+    std::deque<Entry> discarded;
+    for (;;)
+    {
+        Entry entry;
+        {
+            std::unique_lock lock(lock_);
+            dataAvailable_.wait(lock, [&] { return !control_.empty() || !entries_.empty() || closed_; });
+            // Control msgs overtake, a bulk msg in chunks holds them up for a chunk at most.
+            auto& lane = control_.empty() ? entries_ : control_;
+            if (lane.empty())
+                break;
+
+            entry = std::move(lane.front());
+            lane.pop_front();
+        }
+        spaceAvailable_.notify_one();
+
+        const ipc::Frame frame = entry.Frame.FrameAt(entry.Written);
+        const HRESULT    hr    = transport.SendFrame(frame);
+
+        std::scoped_lock lock(lock_);
+        if (SUCCEEDED(hr))
+        {
+            entry.Written += frame.Size();
+            if (entry.Written < entry.Frame.Size())
+            {
+                // More chunks to go, after what got queued meanwhile.
+                entry.MayDrop = false;
+                (entry.Queued ? control_ : entries_).push_back(std::move(entry));
+                continue;
+            }
+            if (entry.Queued)
+                stats_.MaxControlWait = std::max(stats_.MaxControlWait, ipc::TimestampNow() - entry.Queued);
+            ++stats_.Sent;
+            continue;
+        }
+
+        // Writes won't succeed anymore, discard what's left and let any blocked Push() fail.
+        broken_ = hr;
+        stats_.Failed += 1 + entries_.size() + control_.size();
+        discarded.swap(entries_);
+        std::move(control_.begin(), control_.end(), std::back_inserter(discarded));
+        control_.clear();
+        break;
+    }
+
+    spaceAvailable_.notify_all();
+    transport.Close();
+}
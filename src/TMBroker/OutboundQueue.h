@@ -0,0 +1,91 @@
+#pragma once
+#include "platform.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "ipc.h"
+#include "Transport.h"
+
+// Messages waiting to be written to a single host process.
+// A dedicated writer thread drains the queue, so a host not reading its input only stalls its own queue and not
+// the thread routing a message to all hosts.
+class OutboundQueue final : public std::enable_shared_from_this<OutboundQueue>
+{
+public:
+    // What to do with a message pushed while the queue is full.
+    enum class OverflowPolicy
+    {
+        Block,      // wait for the writer to make room
+        DropOldest, // discard the longest waiting message
+        DropNewest  // discard the pushed message
+    };
+
+    struct Stats
+    {
+        uint64_t Enqueued       = 0;
+        uint64_t Sent           = 0;
+        uint64_t Dropped        = 0;
+        uint64_t Failed         = 0;
+        size_t   Depth          = 0;
+        size_t   MaxDepth       = 0;
+        // Longest a control msg waited to be written, in microseconds.
+        uint64_t MaxControlWait = 0;
+    };
+
+    static constexpr size_t DefaultCapacity = 1024;
+
+    OutboundQueue(size_t capacity, OverflowPolicy policy) : capacity_(capacity ? capacity : 1), policy_(policy)
+    {
+    }
+
+    OutboundQueue(const OutboundQueue&)            = delete;
+    OutboundQueue& operator=(const OutboundQueue&) = delete;
+
+    // Starts writing queued messages. Messages pushed before are kept and written first.
+    HRESULT Start(std::shared_ptr<ipc::Transport> transport, DWORD pid) noexcept;
+
+    // Returns S_FALSE if the message was dropped.
+    // Messages with mayDrop == false are queued regardless of the capacity, e.g. commands for the host itself.
+    // Control messages (see ipc::MsgPriority) are never dropped and written before any bulk message waiting.
+    // The frame is shared, not copied, so a broadcast costs a reference per recipient.
+    // A frame of a msg in chunks is written a chunk at a time, taking turns with the frames queued behind it. These
+    // may thus arrive before it's complete. Once partly written it isn't dropped anymore.
+    // credit is released once the frame is written, dropped or failed, see ChildProcessInstance::TakeCredit().
+    HRESULT Push(const ipc::Frame& frame, bool mayDrop = true, const std::shared_ptr<void>& credit = {}) noexcept;
+
+    // Lets the writer send what's queued and then close the transport. Doesn't wait for the writer.
+    void Close() noexcept;
+
+    Stats GetStats() const;
+
+private:
+    struct Entry
+    {
+        ipc::Frame            Frame;
+        bool                  MayDrop;
+        // Bytes of Frame written so far.
+        size_t                Written = 0;
+        // When a control msg was pushed.
+        uint64_t              Queued  = 0;
+        // Released without holding lock_, it may push to another queue.
+        std::shared_ptr<void> Credit;
+    };
+
+    void Drain(ipc::Transport& transport) noexcept;
+    // Called with lock_ held.
+    void OnDropped() noexcept;
+
+    const size_t         capacity_;
+    const OverflowPolicy policy_;
+
+    mutable std::mutex      lock_;
+    std::condition_variable dataAvailable_;
+    std::condition_variable spaceAvailable_;
+    std::deque<Entry>       entries_;
+    std::deque<Entry>       control_;
+    bool                    closed_ = false;
+    // Set once a write failed, e.g. the host process died. Nothing gets written afterwards.
+    HRESULT                 broken_ = S_OK;
+    Stats                   stats_;
+};
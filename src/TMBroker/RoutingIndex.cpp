@@ -0,0 +1,92 @@
+#include "pch.h"
+#include "RoutingIndex.h"
+
+namespace
+{
+bool Contains(const RoutingIndex::Subscribers& subscribers, const ChildProcessInstance* process)
+{
+    return std::find_if(subscribers.begin(), subscribers.end(),
+               [process](const auto& subscriber) { return subscriber.get() == process; }) != subscribers.end();
+}
+
+void RemoveFrom(RoutingIndex::Subscribers& subscribers, const ChildProcessInstance* process)
+{
+    std::erase_if(subscribers, [process](const auto& subscriber) { return subscriber.get() == process; });
+}
+}
+
+void RoutingIndex::Insert(std::shared_ptr<ChildProcessInstance> process)
+{
+    Update([&](Table& table) {
+        const auto key = process.get();
+        table.Processes.try_emplace(key, Registration {std::move(process), {}});
+    });
+}
+
+void RoutingIndex::Remove(const ChildProcessInstance* process)
+{
+    Update([&](Table& table) {
+        auto registration = table.Processes.find(process);
+        if (registration == table.Processes.end())
+            return;
+
+        Unsubscribe(table, process, registration->second.Services);
+        table.Processes.erase(registration);
+    });
+}
+
+void RoutingIndex::Reset(const ChildProcessInstance* process)
+{
+    Update([&](Table& table) {
+        auto registration = table.Processes.find(process);
+        if (registration == table.Processes.end())
+            return;
+
+        Unsubscribe(table, process, registration->second.Services);
+        registration->second.Services.clear();
+    });
+}
+
+void RoutingIndex::Add(const ChildProcessInstance* process, const std::vector<ipc::ServiceId>& services)
+{
+    Update([&](Table& table) {
+        auto registration = table.Processes.find(process);
+        if (registration == table.Processes.end())
+            return;
+
+        auto& registered = registration->second.Services;
+        for (const auto& service : services)
+        {
+            if (std::find(registered.begin(), registered.end(), service) != registered.end())
+                continue;
+
+            registered.push_back(service);
+
+            if (service == ipc::KnownServiceId::All)
+            {
+                // Being listed per service as well would now deliver such messages twice.
+                Unsubscribe(table, process, registered);
+                table.All.push_back(registration->second.Process);
+            }
+            else if (!Contains(table.All, process))
+            {
+                if (service >= table.Services.size())
+                    table.Services.resize(service + 1);
+
+                table.Services[service].push_back(registration->second.Process);
+            }
+        }
+    });
+}
+
+void RoutingIndex::Unsubscribe(
+    Table& table, const ChildProcessInstance* process, const std::vector<ipc::ServiceId>& services)
+{
+    for (const auto service : services)
+    {
+        if (service == ipc::KnownServiceId::All)
+            RemoveFrom(table.All, process);
+        else if (service < table.Services.size())
+            RemoveFrom(table.Services[service], process);
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <absl/container/flat_hash_map.h>
+#include "ipc.h"
+#include "Epoch.h"
+
+class ChildProcessInstance;
+
+// Maps a service id to the host processes which announced a module providing it.
+// Updated as ModuleMeta arrives and as processes come and go, so routing a message only touches its recipients
+// instead of probing every process.
+// Routing reads an immutable snapshot without taking any lock, updates publish a modified copy.
+class RoutingIndex final
+{
+public:
+    using Subscribers = std::vector<std::shared_ptr<ChildProcessInstance>>;
+
+    // Makes process routable, its services are added as they're announced.
+    void Insert(std::shared_ptr<ChildProcessInstance> process);
+
+    // Forgets process, it stays alive until no reader can see it anymore.
+    void Remove(const ChildProcessInstance* process);
+
+    // Forgets the services of process, e.g. as it's about to restart.
+    void Reset(const ChildProcessInstance* process);
+
+    // Services of processes not inserted (anymore) are ignored.
+    void Add(const ChildProcessInstance* process, const std::vector<ipc::ServiceId>& services);
+
+    // Calls f once per process providing service, incl. those which want to receive messages to any service
+    // (KnownServiceId::All). Lock free, f may run concurrently with updates and thus see a process just removed.
+    template <typename F>
+    void ForEachSubscriber(ipc::ServiceId service, F&& f) const
+    {
+        Epoch::Guard guard;
+        const auto&  table = table_.Get();
+
+        for (const auto& process : table.All)
+            f(process.get());
+
+        if (service < table.Services.size())
+        {
+            for (const auto& process : table.Services[service])
+                f(process.get());
+        }
+    }
+
+private:
+    struct Registration
+    {
+        std::shared_ptr<ChildProcessInstance> Process;
+        std::vector<ipc::ServiceId>           Services;
+    };
+
+    struct Table
+    {
+        // Processes subscribed to KnownServiceId::All aren't listed per service as well, so nobody receives a
+        // message twice.
+        Subscribers                                                    All;
+        // Indexed by service id, ids are dense.
+        std::vector<Subscribers>                                       Services;
+        absl::flat_hash_map<const ChildProcessInstance*, Registration> Processes;
+    };
+
+    // Applies change to a copy of the current table and publishes it.
+    template <typename F>
+    void Update(F&& change)
+    {
+        std::scoped_lock lock(writeLock_);
+        // Only writers replace the table, so it can't be reclaimed while holding writeLock_.
+        auto next = std::make_unique<Table>(table_.Get());
+        change(*next);
+        table_.Publish(std::move(next));
+    }
+
+    static void Unsubscribe(
+        Table& table, const ChildProcessInstance* process, const std::vector<ipc::ServiceId>& services);
+
+    std::mutex      writeLock_;
+    Snapshot<Table> table_;
+};
@@ -0,0 +1,78 @@
+#include "pch.h"
+#include "LocalDelivery.h"
+#include "TMProcess.h"
+
+HRESULT LocalDelivery::Start(Dispatch dispatch) noexcept
+try
+{
+    RETURN_IF_WIN32_BOOL_FALSE(::ProcessIdToSessionId(::GetCurrentProcessId(), &session_));
+
+    worker_ = std::jthread([this, dispatch = std::move(dispatch)](std::stop_token stoken) {
+        Process::SetThreadName(L"TM-LocalDelivery");
+
+        for (;;)
+        {
+            Entry entry;
+            {
+                std::unique_lock lock(lock_);
+                if (!available_.wait(lock, stoken, [&] { return !inbox_.empty(); }))
+                    return;
+
+                entry = std::move(inbox_.front());
+                inbox_.pop_front();
+            }
+            dispatch(entry.Msg, entry.Target);
+        }
+    });
+    return S_OK;
+}
+CATCH_RETURN();
+
+void LocalDelivery::Stop() noexcept
+{
+    worker_.request_stop();
+    if (worker_.joinable())
+        worker_.join();
+}
+
+void LocalDelivery::AddServices(const std::vector<Guid>& services)
+{
+    std::scoped_lock lock(servicesLock_);
+    for (const auto& service : services)
+    {
+        if (service == ipc::KnownService::All)
+            all_ = true;
+        else
+            services_.insert(service);
+    }
+}
+
+bool LocalDelivery::IsLocal(const ipc::Target& target) const
+{
+    // Handled by the broker itself, which doesn't dispatch these to modules.
+    if (target.Service == ipc::KnownService::Broker || target.Service == ipc::KnownService::ModuleMetaConsumer)
+        return false;
+
+    // Same as the broker would only send it to this process if it runs within the target session.
+    if (target.Session != ipc::KnownSession::Any && target.Session != session_)
+        return false;
+
+    std::shared_lock lock(servicesLock_);
+    return all_ || services_.contains(target.Service);
+}
+
+HRESULT LocalDelivery::Deliver(const std::string_view msg, const ipc::Target& target) noexcept
+try
+{
+    if (!IsLocal(target))
+        return S_FALSE;
+
+    {
+        std::scoped_lock lock(lock_);
+        RETURN_HR_IF(E_NOT_VALID_STATE, !worker_.joinable() || worker_.get_stop_token().stop_requested());
+        inbox_.push_back({std::string(msg), target});
+    }
+    available_.notify_one();
+    return S_OK;
+}
+CATCH_RETURN();
@@ -0,0 +1,52 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <absl/container/flat_hash_set.h>
+#include "ipc.h"
+
+// Delivers messages from a module to services provided by modules of the same host process, so these don't take
+// the round trip through the broker. The message is still sent to the broker for remote subscribers, which in turn
+// skips the sending host.
+// Delivery runs on a thread of its own, so a module sending from within its OnMessage() doesn't re-enter modules.
+class LocalDelivery final
+{
+public:
+    using Dispatch = std::function<void(const std::string_view msg, const ipc::Target& target)>;
+
+    HRESULT Start(Dispatch dispatch) noexcept;
+    void    Stop() noexcept;
+
+    // Services announced by a module of this process via ModuleMeta.
+    void AddServices(const std::vector<Guid>& services);
+
+    // Queues msg for delivery if a module of this process provides target's service, returns S_FALSE otherwise.
+    // Subscribers of the same service elsewhere are reached via the broker.
+    HRESULT Deliver(const std::string_view msg, const ipc::Target& target) noexcept;
+
+private:
+    bool IsLocal(const ipc::Target& target) const;
+
+    struct Entry
+    {
+        std::string Msg;
+        ipc::Target Target;
+    };
+
+    DWORD session_ = ipc::KnownSession::Any;
+
+    mutable std::shared_mutex                    servicesLock_;
+    absl::flat_hash_set<Guid, absl::Hash<Guid>> services_;
+    // Some module wants to receive messages to any service.
+    bool all_ = false;
+
+    std::mutex                  lock_;
+    std::condition_variable_any available_;
+    std::deque<Entry>           inbox_;
+    std::jthread                worker_;
+};
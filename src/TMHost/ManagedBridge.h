@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <nethost/coreclr_delegates.h>
+#include "ipc.h"
+
+// Native half of the calls between the host and its managed modules, see SharedManagedUtils.Ipc.
+// Messages cross as UTF-8 bytes with their length, not zero-terminated, and services as binary GUIDs, laid out like
+// System.Guid. Neither side transcodes on the native half nor allocates for it.
+namespace ManagedBridge
+{
+// SharedManagedUtils.Ipc.MessageFromHostToModule
+using ToModule = std::add_pointer_t<int CORECLR_DELEGATE_CALLTYPE(
+    const char* msg, int32_t size, const GUID* service, int32_t session)>;
+
+inline int Deliver(ToModule toModule, const std::string_view msg, const ipc::Target& target) noexcept
+{
+    return toModule(msg.data(), (int32_t)msg.size(), &target.Service, (int32_t)target.Session);
+}
+
+// Arguments of MessageFromModuleToHost as a message and its target.
+inline HRESULT FromModule(const char* msg, int32_t size, const GUID* service, int32_t session,
+    std::string_view& message, ipc::Target& target) noexcept
+{
+    RETURN_HR_IF(E_INVALIDARG, !service || size < 0 || (!msg && size));
+
+    message = std::string_view(msg ? msg : "", (size_t)size);
+    target  = ipc::Target(Guid(*service), (DWORD)session);
+    return S_OK;
+}
+}
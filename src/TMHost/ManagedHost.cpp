@@ -35,10 +35,15 @@ ManagedHost::ManagedHost(ModuleHost* host, const std::wstring& assemblyPath /*=
 {
     FAIL_FAST_IF_MSG(TheManagedHost != 0, "There shall be only one ManagedHost");
     TheManagedHost = this;
+    FAIL_FAST_IF_FAILED(inbox_.Start([this](std::span<const ModuleInbox::Item> items) {
+        for (const auto& item : items)
+            Deliver(item);
+    }));
 }
 
 ManagedHost::~ManagedHost()
 {
+    inbox_.Stop();
     if (hostContext_)
     {
         closeHostContext_(hostContext_);
@@ -88,7 +93,7 @@ bool ManagedHost::RunAsync()
     if (!InitFunctionPointerFactory())
         return false;
 
-    invokeManagedMessageFromHostToModule_ = (OnMessageFromHostFuncSig)CreateFunction(_X("MessageFromHostToModule"));
+    invokeManagedMessageFromHostToModule_ = (ManagedBridge::ToModule)CreateFunction(_X("MessageFromHostToModule"));
     if (!invokeManagedMessageFromHostToModule_)
     {
         SPDLOG_ERROR(L"Failed to load MessageFromHostToModule from managed assembly '{}'", assemblyPath_.c_str());
@@ -268,24 +273,34 @@ extern "C" __declspec(dllexport) void OnLog(int serilogLevel, PCWSTR message)
 }
 #pragma endregion
 
-extern "C" __declspec(dllexport) HRESULT MessageFromModuleToHost(PCWSTR msg, PCWSTR service, int session)
+extern "C" __declspec(dllexport) HRESULT MessageFromModuleToHost(
+    const char* msg, int32_t size, const GUID* service, int32_t session)
 {
-    Guid guid;
-    RETURN_IF_FAILED(guid.Parse(service));
-    return ipc::Send(ToUtf8(msg), ipc::Target(guid, (DWORD)session));
+    std::string_view message;
+    ipc::Target      target;
+    RETURN_IF_FAILED(ManagedBridge::FromModule(msg, size, service, session, message, target));
+    RETURN_HR_IF_NULL(E_NOT_VALID_STATE, TheManagedHost);
+    return TheManagedHost->moduleHost_->SendFromModule(message, target, true, &TheManagedHost->inbox_);
 }
 
-// send message to all modules
+// queue message for all modules
 HRESULT ManagedHost::Send(const std::string_view msg, const ipc::Target& target) noexcept
+try
 {
-    RETURN_HR_IF_NULL(E_FAIL, invokeManagedMessageFromHostToModule_);
-
-    std::wstring m = ToUtf16(msg);
-    std::wstring s = target.Service.ToUtf16();
+    RETURN_IF_FAILED(inbox_.Push({std::string(msg), target}));
+    return S_OK;
+}
+CATCH_RETURN();
 
-    int res = invokeManagedMessageFromHostToModule_(m.c_str(), s.c_str(), (int32_t)target.Session);
+void ManagedHost::Deliver(const ModuleInbox::Item& item) noexcept
+{
+    if (!invokeManagedMessageFromHostToModule_)
+    {
+        LOG_HR(E_FAIL);
+        return;
+    }
 
-    return S_OK;
+    int res = ManagedBridge::Deliver(invokeManagedMessageFromHostToModule_, item.Bytes, item.Target);
 }
 
 void* ManagedHost::CreateFunction(const char_t* name) const
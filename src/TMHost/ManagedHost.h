@@ -5,6 +5,8 @@
 #include <nethost/hostfxr.h>
 
 #include "ipc.h"
+#include "ManagedBridge.h"
+#include "ModuleInbox.h"
 
 #ifdef _WIN32
 #    define _X(s) L##s
@@ -25,16 +27,26 @@ class ModuleHost;
 
 class ManagedHost final
 {
+    friend ModuleHost;
+
 public:
     ManagedHost(ModuleHost* host, const std::wstring& assemblyPath = L"");
     ~ManagedHost();
     bool    RunAsync();
     HRESULT LoadModule(const std::wstring& path);
     HRESULT UnloadModule(const std::wstring& name);
-    // send message to all modules
+    // queue message for all modules, handled in order on the managed modules' inbox thread
     HRESULT Send(const std::string_view msg, const ipc::Target& target) noexcept;
 
+    ModuleInbox::Stats GetInboxStats() const
+    {
+        return inbox_.GetStats();
+    }
+
 private:
+    // runs on the inbox thread
+    void Deliver(const ModuleInbox::Item& item) noexcept;
+
     bool LoadFxr();
 
 #if INIT_HOSTFXR_FROM == INIT_HOSTFXR_FROM_CMDLINE
@@ -81,8 +93,8 @@ private:
 
     ModuleHost* moduleHost_ = nullptr;
 
-    using OnMessageFromHostFuncSig =
-        std::add_pointer_t<int CORECLR_DELEGATE_CALLTYPE(const char_t* msg, const char_t* service, int32_t session)>;
+    ManagedBridge::ToModule invokeManagedMessageFromHostToModule_ = nullptr;
 
-    OnMessageFromHostFuncSig invokeManagedMessageFromHostToModule_ = nullptr;
+    // All managed modules share it, the managed side dispatches to them.
+    ModuleInbox inbox_ {L"Managed"};
 };
@@ -7,11 +7,24 @@ using json = nlohmann::json;
 #include "TMProcess.h"
 #include "ipc.h"
 #include "HostMsg.h"
+#include "ShmRing.h"
+#include "ServiceTable.h"
 #include "FileImage.h"
 #include "ModuleBase.h"
+#include "ModuleMeta.h"
 
 int ModuleHost::Run()
 {
+    FAIL_FAST_IF_FAILED(local_.Start([this](const std::string_view msg, const ipc::Target& target) {
+        std::scoped_lock lock(dispatchLock_);
+        Dispatch(msg, target);
+    }));
+
+    const auto onChunk = [this](const std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) {
+        DispatchChunk(bytes, offset, total, target);
+    };
+    ipc::PipeTransport::ForStdio()->SetOnChunk(onChunk);
+
     std::jthread reader;
     FAIL_FAST_IF_FAILED(ipc::StartRead(reader, [&](const std::string_view msg, const ipc::Target& target) {
         return OnMessageFromBroker(msg, target) == S_FALSE;
@@ -26,21 +39,110 @@ int ModuleHost::Run()
     //::DebugBreak();
 
     reader.request_stop();
+    shmReader_.request_stop();
+    credit_.Close();
 
     if (reader.joinable())
         reader.join();
 
+    if (shm_)
+    {
+        ipc::SetHostTransport(nullptr);
+        shm_->Close();
+    }
+    if (shmReader_.joinable())
+        shmReader_.join();
+
+    local_.Stop();
+
     return 0;
 }
 
+HRESULT ModuleHost::SendFromModule(
+    const std::string_view msg, const ipc::Target& target, bool wait, ModuleInbox* from) noexcept
+try
+{
+    // Modules sending while handling a message never wait for credit. It's granted by a message the broker reader
+    // may be stuck behind, waiting for room in the very inbox. Their msg goes anyway rather than failing, most
+    // modules don't check the result of a send and the msg would be lost. Only TrySendMsg fails without credit.
+    const auto ifShort = !wait                            ? SendCredit::IfShort::Fail
+                         : ModuleInbox::IsHandlerThread() ? SendCredit::IfShort::Overdraw
+                                                          : SendCredit::IfShort::Wait;
+    RETURN_IF_FAILED_EXPECTED(credit_.Spend(msg.size(), ifShort));
+    // Refunded unless the msg reaches the broker, which grants credit back for sent msgs only.
+    auto refund = wil::scope_exit([&] { credit_.Grant(msg.size()); });
+
+    if (target.Service == ipc::KnownService::ModuleMetaConsumer)
+    {
+        // Known locally before the broker learns about it, so the broker never sends a message back to this process
+        // which was already delivered locally.
+        const auto        mm = json::parse(msg).get<ipc::ModuleMeta>();
+        std::vector<Guid> services;
+        for (const auto& s : mm.Services)
+        {
+            services.emplace_back(s);
+        }
+        local_.AddServices(services);
+        if (from)
+            from->AddServices(services);
+    }
+
+    RETURN_IF_FAILED(ipc::Send(msg, target));
+    refund.release();
+    RETURN_IF_FAILED(local_.Deliver(msg, target));
+    return S_OK;
+}
+CATCH_RETURN();
+
+void ModuleHost::Dispatch(const std::string_view msg, const ipc::Target& target) noexcept
+{
+    // Routed here rather than rejected by each module, so most msgs never cross a module's boundary.
+    for (auto& mod : nativeModules_)
+    {
+        if (mod->inbox_.Wants(target))
+            LOG_IF_FAILED(mod->Send(msg, target));
+    }
+
+    if (managedHost_ && managedHost_->inbox_.Wants(target))
+    {
+        managedHost_->Send(msg, target);
+    }
+}
+
+void ModuleHost::DispatchChunk(
+    const std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) noexcept
+{
+    // Msgs to the host itself are handled as a whole.
+    if (target.Service == ipc::KnownService::HostInit || target.Service == ipc::KnownService::ServiceIds ||
+        target.Service == target_.Service)
+        return;
+
+    std::scoped_lock lock(dispatchLock_);
+    for (auto& mod : nativeModules_)
+    {
+        if (mod->inbox_.Wants(target))
+            LOG_IF_FAILED(mod->SendChunk(bytes, offset, total, target));
+    }
+}
+
+void ModuleHost::LogInboxStats(const std::wstring& name, const ModuleInbox::Stats& stats) noexcept
+{
+    if (!stats.Handled)
+        return;
+
+    spdlog::info(L"Module {} handled {} msgs in {}us, longest {}us. Inbox depth {}, max {}, full {} times", name,
+        stats.Handled, stats.HandlerMicros, stats.MaxHandlerMicros, stats.Depth, stats.MaxDepth, stats.FullWaits);
+}
+
 HRESULT ModuleHost::OnMessageFromBroker(const std::string_view msg, const ipc::Target& target)
 try
 {
     if (spdlog::should_log(spdlog::level::trace))
     {
-        std::string m = msg.data();
+        std::string m = target.Meta.Payload == ipc::PayloadType::Binary ? std::format("<{} bytes binary>", msg.size())
+                                                                         : std::string(msg);
         std::erase_if(m, [](char c) { return c == '\r' || c == '\n'; });
-        spdlog::trace("RX-H: {} for {}", m, Strings::ToUtf8(target.ToString()));
+        spdlog::trace("RX-H: {} for {} after {}us", m, Strings::ToUtf8(target.ToString()), target.Meta.Age());
     }
 
     /*while (!::IsDebuggerPresent())
@@ -59,6 +161,47 @@ try
 
         target_    = ipc::Target(init.Service);
         groupName_ = init.GroupName;
+
+        if (init.SharedMemory)
+        {
+            // From now on all messages flow through the shared memory channel set up by the broker.
+            auto shm = std::make_shared<ipc::ShmChannel>(ipc::PipeTransport::ForStdio());
+            FAIL_FAST_IF_FAILED_MSG(shm->Open(*init.SharedMemory), "Failed to open shared memory channel");
+            shm_ = shm;
+            ipc::SetHostTransport(shm_.get());
+            shm_->SetOnChunk(
+                [this](const std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) {
+                    DispatchChunk(bytes, offset, total, target);
+                });
+
+            FAIL_FAST_IF_FAILED(shm_->StartRead(
+                shmReader_,
+                [this](const std::string_view msg, const ipc::Target& target) {
+                    return OnMessageFromBroker(msg, target) == S_FALSE;
+                },
+                ::GetCurrentProcessId()));
+        }
+
+        // Use the broker's frame version if this host knows it and tell the broker so, via the channel it reads.
+        const uint8_t frameVersion = std::min(init.FrameVersion, ipc::FrameVersion::Latest);
+        if (frameVersion != ipc::FrameVersion::Legacy)
+        {
+            ipc::SetCompressAbove(init.CompressAbove);
+            ipc::SetMaxReassembly(init.MaxReassembly);
+            credit_.SetWindow(init.SendWindow);
+            ipc::PipeTransport::ForStdio()->SetFrameVersion(frameVersion);
+            if (shm_)
+                shm_->SetFrameVersion(frameVersion);
+
+            const json ack = ipc::HostInitAckMsg {frameVersion, init.SendWindow};
+            RETURN_IF_FAILED(ipc::Send(ack.dump(), ipc::Target(ipc::KnownService::Broker)));
+        }
+    }
+    else if (target.Service == ipc::KnownService::ServiceIds)
+    {
+        // Frames following this one may carry these ids.
+        const auto ids = json::parse(msg).get<ipc::ServiceIdsMsg>();
+        RETURN_IF_FAILED(ipc::Services().Learn(ids.First, ids.Services));
     }
     else
     {
@@ -66,26 +209,56 @@ try
 
         if (target.Service == target_.Service)
         {
-            auto       j       = json::parse(msg);
-            const auto hostMsg = j.get<ipc::HostCmdMsg>();
+            const auto      payload = target.Meta.Payload;
+            ipc::HostCmdMsg hostMsg;
+            RETURN_IF_FAILED(ipc::Parse(msg, payload, hostMsg));
 
+            // Not serialized with the delivery to modules, a module may wait for it while local delivery is busy.
+            if (hostMsg.Cmd == ipc::HostCmdMsg::Cmd::Credit)
+            {
+                ipc::HostCreditArgs args;
+                RETURN_IF_FAILED(ipc::Parse(hostMsg.Args, payload, args));
+                credit_.Grant(args.Bytes);
+                return S_OK;
+            }
+
+            std::scoped_lock lock(dispatchLock_);
             switch (hostMsg.Cmd)
             {
                 case ipc::HostCmdMsg::Cmd::Terminate:
                 {
                     if (managedHost_)
                     {
-                        managedHost_->Send(msg, ipc::Target(ipc::KnownService::ManagedHost));
+                        // The managed side only reads the JSON form.
+                        const json terminate = ipc::HostCmdMsg {ipc::HostCmdMsg::Cmd::Terminate, ""};
+                        managedHost_->Send(terminate.dump(), ipc::Target(ipc::KnownService::ManagedHost));
                     }
 
+                    const auto stats = ipc::GetCompressionStats();
+                    if (stats.Compressed || stats.Decompressed)
+                        spdlog::info("Compressed {} msgs from {} to {} bytes in {}us. Decompressed {} in {}us",
+                            stats.Compressed, stats.RawBytes, stats.CompressedBytes, stats.CompressMicros,
+                            stats.Decompressed, stats.DecompressMicros);
+
+                    const auto credit = credit_.GetStats();
+                    if (credit.Waits || credit.Rejected || credit.Overdrawn)
+                        spdlog::info("Waited {} times for send credit, {}us in all. Rejected {} and overdrew {} sends "
+                                     "without credit",
+                            credit.Waits, credit.WaitMicros, credit.Rejected, credit.Overdrawn);
+
+                    for (const auto& mod : nativeModules_)
+                        LogInboxStats(mod->inbox_.Name(), mod->GetInboxStats());
+                    if (managedHost_)
+                        LogInboxStats(L"Managed", managedHost_->GetInboxStats());
+
                     terminate_.SetEvent();
                     return S_FALSE; // exit stdin read-loop
                 }
 
                 case ipc::HostCmdMsg::Cmd::CtrlModule:
                 {
-                    auto       ja   = json::parse(hostMsg.Args);
-                    const auto args = ja.get<ipc::HostCtrlModuleArgs>();
+                    ipc::HostCtrlModuleArgs args;
+                    RETURN_IF_FAILED(ipc::Parse(hostMsg.Args, payload, args));
 
                     if (args.Cmd == ipc::HostCtrlModuleArgs::Cmd::Load)
                         LoadModule(ToUtf16(args.Module));
@@ -102,16 +275,8 @@ try
         }
         else
         {
-            // Broadcast to all loaded modules.
-            for (auto& mod : nativeModules_)
-            {
-                LOG_IF_FAILED(mod->Send(msg, target));
-            }
-
-            if (managedHost_)
-            {
-                managedHost_->Send(msg, target);
-            }
+            std::scoped_lock lock(dispatchLock_);
+            Dispatch(msg, target);
         }
     }
 
@@ -189,7 +354,7 @@ CATCH_RETURN();
 HRESULT ModuleHost::LoadNativeModule(const std::filesystem::path& path) noexcept
 try
 {
-    auto mod = std::make_unique<NativeModule>(path);
+    auto mod = std::make_unique<NativeModule>(this, path);
     RETURN_IF_FAILED(mod->Load());
 
     nativeModules_.push_back(std::move(mod));
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "ipc.h"
+#include "Transport.h"
 #include "ManagedHost.h"
 #include "NativeModule.h"
+#include "LocalDelivery.h"
+#include "SendCredit.h"
 
 class ModuleHost final
 {
@@ -13,10 +16,23 @@ public:
     ModuleHost() = default;
     int Run();
 
+    // message from a module, waits for credit unless wait is false (fails then) or it's sent while handling a message
+    // (overdraws then)
+    // from is the sending module's inbox, if known, which learns the services it announces
+    HRESULT SendFromModule(const std::string_view msg, const ipc::Target& target, bool wait = true,
+        ModuleInbox* from = nullptr) noexcept;
+
 private:
     // message from broker
     HRESULT OnMessageFromBroker(const std::string_view msg, const ipc::Target& target);
 
+    // Queue for the loaded modules handling target's service, call with dispatchLock_ held.
+    void Dispatch(const std::string_view msg, const ipc::Target& target) noexcept;
+    // Chunk of a large message from broker to the native modules consuming chunks.
+    void DispatchChunk(const std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) noexcept;
+
+    static void LogInboxStats(const std::wstring& name, const ModuleInbox::Stats& stats) noexcept;
+
     HRESULT LoadModule(const std::wstring& name) noexcept;
     HRESULT UnloadModule(const std::wstring& name) noexcept;
 
@@ -29,4 +45,11 @@ private:
     wil::unique_event_failfast                 terminate_ {wil::EventOptions::ManualReset};
     std::unique_ptr<ManagedHost>               managedHost_;
     std::vector<std::unique_ptr<NativeModule>> nativeModules_;
+    std::shared_ptr<ipc::Transport>            shm_;
+    std::jthread                               shmReader_;
+    LocalDelivery                              local_;
+    SendCredit                                 credit_;
+    // Guards loading and unloading modules against dispatching to them. Modules aren't required to be thread safe,
+    // each gets messages from the broker and local ones in turn on the thread of its inbox.
+    std::mutex                                 dispatchLock_;
 };
@@ -0,0 +1,142 @@
+#include "pch.h"
+#include <chrono>
+#include "ModuleInbox.h"
+#include "TMProcess.h"
+
+namespace
+{
+thread_local bool t_handler = false;
+
+uint64_t MicrosSince(std::chrono::steady_clock::time_point start) noexcept
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+        .count();
+}
+}
+
+ModuleInbox::ModuleInbox(std::wstring name, size_t capacity, size_t maxBytes)
+    : name_(std::move(name)), capacity_(std::max<size_t>(capacity, 1)), maxBytes_(maxBytes)
+{
+}
+
+ModuleInbox::~ModuleInbox()
+{
+    Stop();
+}
+
+HRESULT ModuleInbox::Start(Handler handler) noexcept
+try
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, worker_.joinable());
+
+    worker_ = std::jthread([this, handler = std::move(handler)](std::stop_token stoken) {
+        Process::SetThreadName(std::format(L"TM-Inbox-{}", name_).c_str());
+        t_handler = true;
+
+        std::vector<Item> batch;
+        for (;;)
+        {
+            batch.clear();
+            {
+                std::unique_lock lock(lock_);
+                if (!available_.wait(lock, stoken, [&] { return !items_.empty(); }))
+                    return;
+
+                while (!items_.empty() && batch.size() < MaxBatch)
+                {
+                    bytes_ -= items_.front().Bytes.size();
+                    batch.push_back(std::move(items_.front()));
+                    items_.pop_front();
+                }
+            }
+            room_.notify_all();
+
+            const auto start = std::chrono::steady_clock::now();
+            handler(batch);
+            const auto micros = MicrosSince(start);
+
+            std::scoped_lock lock(lock_);
+            stats_.Handled += batch.size();
+            stats_.HandlerMicros += micros;
+            stats_.MaxHandlerMicros = std::max(stats_.MaxHandlerMicros, micros);
+        }
+    });
+    return S_OK;
+}
+CATCH_RETURN();
+
+void ModuleInbox::Stop() noexcept
+{
+    {
+        std::scoped_lock lock(lock_);
+        stopped_ = true;
+    }
+    room_.notify_all();
+
+    worker_.request_stop();
+    if (worker_.joinable())
+        worker_.join();
+
+    std::scoped_lock lock(lock_);
+    items_.clear();
+    bytes_ = 0;
+}
+
+HRESULT ModuleInbox::Push(Item item) noexcept
+try
+{
+    {
+        std::unique_lock lock(lock_);
+        RETURN_HR_IF(E_NOT_VALID_STATE, stopped_ || !worker_.joinable());
+
+        const auto hasRoom = [&] {
+            return stopped_ || items_.empty() ||
+                   (items_.size() < capacity_ && bytes_ + item.Bytes.size() <= maxBytes_);
+        };
+        if (!hasRoom())
+        {
+            ++stats_.FullWaits;
+            room_.wait(lock, hasRoom);
+            RETURN_HR_IF(E_NOT_VALID_STATE, stopped_);
+        }
+
+        bytes_ += item.Bytes.size();
+        items_.push_back(std::move(item));
+        stats_.MaxDepth = std::max(stats_.MaxDepth, items_.size());
+    }
+    available_.notify_one();
+    return S_OK;
+}
+CATCH_RETURN();
+
+ModuleInbox::Stats ModuleInbox::GetStats() const
+{
+    std::scoped_lock lock(lock_);
+    Stats stats = stats_;
+    stats.Depth = items_.size();
+    return stats;
+}
+
+void ModuleInbox::AddServices(const std::vector<Guid>& services)
+{
+    std::scoped_lock lock(servicesLock_);
+    announced_ = true;
+    for (const auto& service : services)
+    {
+        if (service == ipc::KnownService::All)
+            all_ = true;
+        else
+            services_.insert(service);
+    }
+}
+
+bool ModuleInbox::Wants(const ipc::Target& target) const
+{
+    std::shared_lock lock(servicesLock_);
+    return !announced_ || all_ || services_.contains(target.Service);
+}
+
+bool ModuleInbox::IsHandlerThread() noexcept
+{
+    return t_handler;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include <absl/container/flat_hash_set.h>
+#include "ipc.h"
+
+// Messages for a single module, handled in order on a thread of its own, so a slow module delays only its own
+// messages rather than all modules of the process and the pipe from the broker.
+// Bounded, queuing into a full inbox waits until the module caught up.
+class ModuleInbox final
+{
+public:
+    static constexpr size_t DefaultCapacity = 1024;
+    // A single message larger than this is still queued, once the inbox is empty.
+    static constexpr size_t DefaultMaxBytes = 64 * 1024 * 1024;
+    // Most items handed to the handler at once.
+    static constexpr size_t MaxBatch        = 256;
+
+    // A whole message if Total is 0, a chunk of a large one otherwise.
+    struct Item
+    {
+        std::string Bytes;
+        ipc::Target Target;
+        DWORD       Offset = 0;
+        DWORD       Total  = 0;
+    };
+    // Gets all items queued meanwhile at once, in order.
+    using Handler = std::function<void(std::span<const Item> items)>;
+
+    struct Stats
+    {
+        uint64_t Handled          = 0;
+        // Time spent in the handler in all, and the longest single call, which may handle a batch of items.
+        uint64_t HandlerMicros    = 0;
+        uint64_t MaxHandlerMicros = 0;
+        size_t   Depth            = 0;
+        size_t   MaxDepth         = 0;
+        // Pushes which had to wait for room.
+        uint64_t FullWaits        = 0;
+    };
+
+    explicit ModuleInbox(std::wstring name, size_t capacity = DefaultCapacity, size_t maxBytes = DefaultMaxBytes);
+    ~ModuleInbox();
+
+    ModuleInbox(const ModuleInbox&)            = delete;
+    ModuleInbox& operator=(const ModuleInbox&) = delete;
+
+    HRESULT Start(Handler handler) noexcept;
+    // Returns once the item being handled is done, the ones still queued are dropped.
+    void    Stop() noexcept;
+
+    // Waits while the inbox is full, fails once stopped.
+    HRESULT Push(Item item) noexcept;
+
+    Stats GetStats() const;
+
+    // Services the module announced via ModuleMeta, it's only dispatched msgs for these from now on.
+    void AddServices(const std::vector<Guid>& services);
+    // Whether a msg for target is dispatched to the module, any is until it announced its services.
+    bool Wants(const ipc::Target& target) const;
+
+    const std::wstring& Name() const
+    {
+        return name_;
+    }
+
+    // True on the thread of any inbox, these must not wait for anything a module's message may be queued behind.
+    static bool IsHandlerThread() noexcept;
+
+private:
+    const std::wstring name_;
+    const size_t       capacity_;
+    const size_t       maxBytes_;
+
+    mutable std::shared_mutex                    servicesLock_;
+    absl::flat_hash_set<Guid, absl::Hash<Guid>> services_;
+    bool                                         announced_ = false;
+    // The module wants to receive messages to any service.
+    bool                                         all_       = false;
+
+    mutable std::mutex          lock_;
+    std::condition_variable_any available_;
+    std::condition_variable     room_;
+    std::deque<Item>            items_;
+    size_t                      bytes_   = 0;
+    bool                        stopped_ = false;
+    Stats                       stats_;
+    std::jthread                worker_;
+};
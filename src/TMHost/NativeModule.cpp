@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "NativeModule.h"
+#include "ModuleHost.h"
 
 HRESULT NativeModule::Load()
 {
@@ -14,7 +15,21 @@ HRESULT NativeModule::Load()
     LoadEntry(TermModule);
     LoadEntry(OnMessage);
 
+    // Only modules taking several messages per call export it, these get no calls to OnMessage.
+    OnMessages_ = reinterpret_cast<decltype(Entry::OnMessages)*>(GetProcAddress(hmodule_.get(), "OnMessages"));
+
+    // Only modules consuming large messages as they arrive export it.
+    OnMessageChunk_ =
+        reinterpret_cast<decltype(Entry::OnMessageChunk)*>(GetProcAddress(hmodule_.get(), "OnMessageChunk"));
+
+    // Optional, only modules sending without waiting for credit export it.
+    const auto initFlowControl =
+        reinterpret_cast<decltype(Entry::InitFlowControl)*>(GetProcAddress(hmodule_.get(), "InitFlowControl"));
+    if (initFlowControl)
+        RETURN_IF_FAILED(initFlowControl(OnTryMsg));
+
     RETURN_IF_FAILED(InitModule_(this, OnMsg, OnDiag));
+    RETURN_IF_FAILED(inbox_.Start([this](std::span<const ModuleInbox::Item> items) { Deliver(items); }));
 
 #undef LoadEntry
     return S_OK;
@@ -24,20 +39,101 @@ HRESULT NativeModule::Unload()
 {
     auto freeLib = wil::scope_exit([&] { hmodule_.reset(); });
 
+    // The module isn't called anymore once terminated.
+    inbox_.Stop();
     RETURN_IF_FAILED(TermModule_());
 
     return S_OK;
 }
 
 HRESULT NativeModule::Send(const std::string_view msg, const ipc::Target& target) noexcept
+try
+{
+    RETURN_IF_FAILED(inbox_.Push({std::string(msg), target}));
+    return S_OK;
+}
+CATCH_RETURN();
+
+HRESULT NativeModule::SendChunk(
+    const std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) noexcept
+try
+{
+    if (!OnMessageChunk_)
+        return S_FALSE;
+
+    RETURN_IF_FAILED(inbox_.Push({std::string(bytes), target, offset, total}));
+    return S_OK;
+}
+CATCH_RETURN();
+
+void NativeModule::Deliver(std::span<const ModuleInbox::Item> items) noexcept
+try
+{
+    if (!OnMessages_)
+    {
+        for (const auto& item : items)
+            Deliver(item);
+        return;
+    }
+
+    // Whole messages are handed over in one call, up to a chunk, which goes in between to keep them in order.
+    const auto flush = [&] {
+        if (!spans_.empty())
+            LOG_IF_FAILED(OnMessages_(spans_.data(), (DWORD)spans_.size()));
+        spans_.clear();
+    };
+    for (const auto& item : items)
+    {
+        if (item.Total)
+        {
+            flush();
+            Deliver(item);
+        }
+        else if (!Streamed(item.Target))
+        {
+            spans_.push_back({item.Bytes.data(), (DWORD)item.Bytes.size(), &item.Target});
+        }
+    }
+    flush();
+}
+CATCH_LOG();
+
+void NativeModule::Deliver(const ModuleInbox::Item& item) noexcept
 {
-    return OnMessage_(msg.data(), &target);
+    if (!item.Total)
+    {
+        if (!Streamed(item.Target))
+            LOG_IF_FAILED(OnMessage_(item.Bytes.c_str(), &item.Target));
+        return;
+    }
+
+    const HRESULT hr =
+        OnMessageChunk_(item.Bytes.data(), (DWORD)item.Bytes.size(), item.Offset, item.Total, &item.Target);
+    LOG_IF_FAILED(hr);
+    if (hr == S_OK && item.Offset + item.Bytes.size() == item.Total)
+        streamed_ = item.Target.Meta.Id;
+}
+
+bool NativeModule::Streamed(const ipc::Target& target) noexcept
+{
+    if (!target.Meta.Id || target.Meta.Id != streamed_)
+        return false;
+
+    streamed_ = 0;
+    return true;
 }
 
 HRESULT CALLBACK NativeModule::OnMsg(void* mod, PCSTR msg, const Guid* service, DWORD session) noexcept
 {
     auto m = static_cast<NativeModule*>(mod);
-    RETURN_IF_FAILED(ipc::Send(msg, ipc::Target(*service, session)));
+    RETURN_IF_FAILED(m->host_->SendFromModule(msg, ipc::Target(*service, session), true, &m->inbox_));
+    return S_OK;
+}
+
+HRESULT CALLBACK NativeModule::OnTryMsg(void* mod, PCSTR msg, const Guid* service, DWORD session) noexcept
+{
+    auto m = static_cast<NativeModule*>(mod);
+    RETURN_IF_FAILED_EXPECTED(m->host_->SendFromModule(msg, ipc::Target(*service, session), false, &m->inbox_));
     return S_OK;
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ipc.h"
+#include "ModuleInbox.h"
 
 // forward declarations for module entry points
 namespace Entry
@@ -8,6 +9,12 @@ namespace Entry
 HRESULT InitModule(void* mod, ipc::SendMsg sendMsg, ipc::SendDiag sendDiag);
 HRESULT TermModule();
 HRESULT OnMessage(PCSTR msg, const ipc::Target* target);
+// Optional, see ModuleBase::HandleMessages().
+HRESULT OnMessages(const ipc::MsgSpan* msgs, DWORD count);
+// Optional, see ModuleBase::InitFlowControl().
+HRESULT InitFlowControl(ipc::TrySendMsg trySendMsg);
+// Optional, see ModuleBase::HandleChunk().
+HRESULT OnMessageChunk(PCSTR chunk, DWORD size, DWORD offset, DWORD total, const ipc::Target* target);
 }
 
 class ModuleHost;
@@ -16,25 +23,53 @@ class NativeModule final
     friend ModuleHost;
 
 public:
-    NativeModule(const std::filesystem::path& path) : path_(path)
+    NativeModule(ModuleHost* host, const std::filesystem::path& path)
+        : host_(host), path_(path), inbox_(path.stem().wstring())
     {
     }
 
     HRESULT Load();
     HRESULT Unload();
 
-    // send message to module
+    // queue message for the module, handled in order on the module's inbox thread
     HRESULT Send(const std::string_view msg, const ipc::Target& target) noexcept;
+    // queue chunk of a large message for the module, if it consumes them
+    HRESULT SendChunk(const std::string_view bytes, DWORD offset, DWORD total, const ipc::Target& target) noexcept;
+
+    ModuleInbox::Stats GetInboxStats() const
+    {
+        return inbox_.GetStats();
+    }
     // message from module
     static HRESULT CALLBACK OnMsg(void* mod, PCSTR msg, const Guid* service, DWORD session) noexcept;
+    // message from module, which doesn't wait for credit
+    static HRESULT CALLBACK OnTryMsg(void* mod, PCSTR msg, const Guid* service, DWORD session) noexcept;
     // log from module
     static HRESULT CALLBACK OnDiag(void* mod, PCSTR msg) noexcept;
 
 private:
+    // run on the inbox thread
+    void Deliver(std::span<const ModuleInbox::Item> items) noexcept;
+    void Deliver(const ModuleInbox::Item& item) noexcept;
+    // Whether the module consumed all chunks of target's message, so it doesn't get it as a whole.
+    bool Streamed(const ipc::Target& target) noexcept;
+
+    ModuleHost*                 host_;
     const std::filesystem::path path_;
     wil::unique_hmodule         hmodule_;
 
     decltype(&Entry::InitModule) InitModule_ = nullptr;
     decltype(&Entry::TermModule) TermModule_ = nullptr;
     decltype(&Entry::OnMessage)  OnMessage_  = nullptr;
+
+    decltype(&Entry::OnMessages) OnMessages_ = nullptr;
+    // Reused for each batch.
+    std::vector<ipc::MsgSpan>    spans_;
+
+    decltype(&Entry::OnMessageChunk) OnMessageChunk_ = nullptr;
+    // Id of the last message the module consumed all chunks of, it doesn't get it as a whole anymore.
+    uint64_t                         streamed_       = 0;
+
+    // Last, so its thread is stopped before the module is freed.
+    ModuleInbox inbox_;
 };
@@ -0,0 +1,71 @@
+#include "pch.h"
+#include "SendCredit.h"
+
+void SendCredit::SetWindow(size_t window) noexcept
+{
+    {
+        std::scoped_lock lock(lock_);
+        window_    = window;
+        available_ = (int64_t)window;
+    }
+    granted_.notify_all();
+}
+
+HRESULT SendCredit::Spend(size_t size, IfShort ifShort) noexcept
+try
+{
+    std::unique_lock lock(lock_);
+    RETURN_HR_IF(E_NOT_VALID_STATE, closed_);
+    if (!window_)
+        return S_OK;
+
+    if (available_ <= 0)
+    {
+        if (ifShort == IfShort::Fail)
+        {
+            ++stats_.Rejected;
+            return E_PENDING;
+        }
+        if (ifShort == IfShort::Overdraw)
+        {
+            ++stats_.Overdrawn;
+            available_ -= (int64_t)size;
+            return S_OK;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        granted_.wait(lock, [&] { return available_ > 0 || !window_ || closed_; });
+        const auto waited = std::chrono::steady_clock::now() - start;
+        ++stats_.Waits;
+        stats_.WaitMicros += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(waited).count();
+        RETURN_HR_IF(E_NOT_VALID_STATE, closed_);
+    }
+
+    available_ -= (int64_t)size;
+    return S_OK;
+}
+CATCH_RETURN();
+
+void SendCredit::Grant(size_t size) noexcept
+{
+    {
+        std::scoped_lock lock(lock_);
+        available_ += (int64_t)size;
+    }
+    granted_.notify_all();
+}
+
+void SendCredit::Close() noexcept
+{
+    {
+        std::scoped_lock lock(lock_);
+        closed_ = true;
+    }
+    granted_.notify_all();
+}
+
+SendCredit::Stats SendCredit::GetStats() const
+{
+    std::scoped_lock lock(lock_);
+    return stats_;
+}
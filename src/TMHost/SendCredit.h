@@ -0,0 +1,58 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include "ipc.h"
+
+// Credit of this host for sending messages to the broker, see HostInitMsg::SendWindow.
+// Sending spends the message's size, the broker grants it back once the message is written to all its recipients.
+// A sender without credit waits, so a module sending faster than its recipients read is slowed down to their pace
+// instead of piling up messages within the broker.
+class SendCredit final
+{
+public:
+    // What a send does without credit.
+    enum class IfShort
+    {
+        Wait,
+        // Fails with E_PENDING.
+        Fail,
+        // Goes anyway, for senders which must not wait, the overdraft is paid back by later grants.
+        Overdraw
+    };
+
+    struct Stats
+    {
+        // Sends which had to wait for credit, and how long in all.
+        uint64_t Waits      = 0;
+        uint64_t WaitMicros = 0;
+        // Sends which didn't want to wait and failed with E_PENDING.
+        uint64_t Rejected   = 0;
+        // Sends which went without credit.
+        uint64_t Overdrawn  = 0;
+    };
+
+    // Unlimited until a window is set, e.g. for a broker not offering flow control.
+    void SetWindow(size_t window) noexcept;
+
+    // Spends size bytes, a message larger than what's left is let through as long as there's any credit at all.
+    // Without credit it does as ifShort says. Fails once closed.
+    HRESULT Spend(size_t size, IfShort ifShort) noexcept;
+
+    void Grant(size_t size) noexcept;
+
+    // Lets senders waiting for credit fail.
+    void Close() noexcept;
+
+    Stats GetStats() const;
+
+private:
+    mutable std::mutex      lock_;
+    std::condition_variable granted_;
+    size_t                  window_    = 0;
+    // A large message may overdraw it.
+    int64_t                 available_ = 0;
+    bool                    closed_    = false;
+    Stats                   stats_;
+};